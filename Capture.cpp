@@ -0,0 +1,617 @@
+#include "Capture.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void capture_write_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+}
+
+void capture_write_u32(uint8_t *buf, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+void capture_write_u64(uint8_t *buf, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+uint16_t capture_read_u16(const uint8_t *buf)
+{
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+uint32_t capture_read_u32(const uint8_t *buf)
+{
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+            ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+uint64_t capture_read_u64(const uint8_t *buf)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)buf[i] << (8 * i);
+    }
+    return value;
+}
+
+CaptureWriter::CaptureWriter()
+{
+    m_offset = 0;
+    m_running_max_us = 0;
+    m_block = Block();
+    memset(m_channel_offsets, 0, sizeof(m_channel_offsets));
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+int CaptureWriter::open(const char *folder)
+{
+    if (m_file.isOpen()) {
+        return -EEXIST;
+    }
+
+    using namespace std::chrono;
+    uint64_t wall_clock_us = duration_cast<microseconds>(
+            system_clock::now().time_since_epoch()).count();
+    uint64_t monotonic_us = duration_cast<microseconds>(
+            steady_clock::now().time_since_epoch()).count();
+
+    char path[512];
+    time_t now = wall_clock_us / 1000000;
+    struct tm tm_now = {};
+    localtime_r(&now, &tm_now);
+    char date[32];
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm_now);
+    snprintf(path, sizeof(path), "%s/capture-%s.llc", folder, date);
+
+    int ret = create(path, wall_clock_us, monotonic_us);
+    if (ret == 0) {
+        printf("Capturing traffic to '%s'\n", path);
+    }
+    return ret;
+}
+
+int CaptureWriter::create(const char *path, uint64_t start_wall_clock_us,
+        uint64_t start_monotonic_us)
+{
+    int ret = m_file.open(path);
+    if (ret < 0) {
+        printf("Failed to create capture file '%s': %d (%s)\n", path, ret,
+                strerror(-ret));
+        return ret;
+    }
+
+    uint8_t header[CAPTURE_HEADER_SIZE];
+    memcpy(header, CAPTURE_MAGIC, 8);
+    capture_write_u64(header + 8, start_wall_clock_us);
+    capture_write_u64(header + 16, start_monotonic_us);
+    m_file.write(header, sizeof(header));
+
+    m_offset = CAPTURE_HEADER_SIZE;
+    m_running_max_us = 0;
+    m_blocks.clear();
+    m_block_channel_offsets.clear();
+    m_block = Block();
+    endBlock();
+    return 0;
+}
+
+int CaptureWriter::close()
+{
+    if (!m_file.isOpen()) {
+        return 0;
+    }
+    int ret = writeIndex();
+    int close_ret = m_file.close();
+    return ret < 0 ? ret : close_ret;
+}
+
+bool CaptureWriter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+void CaptureWriter::write(const LowLevelMessage &message, CaptureSource source,
+        uint64_t timestamp_us)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    /* Header, client ID, command, length, payload and terminator at most */
+    size_t max_size = CAPTURE_RECORD_HEADER_SIZE + 5 +
+            message.get_payload_size();
+    if (m_buffer.size() < max_size) {
+        m_buffer.resize(max_size);
+    }
+    uint8_t *frame = m_buffer.data() + CAPTURE_RECORD_HEADER_SIZE;
+    ssize_t size;
+    if (source == CAPTURE_SOURCE_SERIAL) {
+        size = message.get_frame_with_cid(frame, max_size -
+                CAPTURE_RECORD_HEADER_SIZE);
+    } else {
+        size = message.get_frame_without_cid(frame, max_size -
+                CAPTURE_RECORD_HEADER_SIZE);
+    }
+    if (size < 0 || size > CAPTURE_MAX_FRAME_SIZE) {
+        return;
+    }
+
+    if (m_offset - m_block.offset >= CAPTURE_BLOCK_SIZE) {
+        endBlock();
+    }
+
+    int client_id = message.get_client_id();
+    capture_write_u64(m_buffer.data(), timestamp_us);
+    m_buffer[8] = (uint8_t)source;
+    m_buffer[9] = (uint8_t)(client_id < 0 ? 0xFF : client_id);
+    capture_write_u16(&m_buffer[10], (uint16_t)size);
+    if (m_file.write(m_buffer.data(), CAPTURE_RECORD_HEADER_SIZE + size) < 0) {
+        /* No index after a partial record */
+        printf("Failed to write capture record, capture stopped\n");
+        m_file.close();
+        return;
+    }
+
+    if (source == CAPTURE_SOURCE_SERIAL && message.is_data_channel_msg()) {
+        unsigned int channel = message.get_data_channel();
+        if (!(m_block.channels & (1u << channel))) {
+            m_block.channels |= 1u << channel;
+            m_channel_offsets[channel] = m_offset - m_block.offset;
+        }
+    } else if (client_id >= 0 && client_id < 32) {
+        m_block.clients |= 1u << client_id;
+    }
+    if (timestamp_us < m_block.min_us) {
+        m_block.min_us = timestamp_us;
+    }
+    if (timestamp_us > m_block.max_us) {
+        m_block.max_us = timestamp_us;
+    }
+    m_block.records++;
+    m_offset += CAPTURE_RECORD_HEADER_SIZE + size;
+}
+
+void CaptureWriter::endBlock()
+{
+    if (m_block.records > 0) {
+        if (m_block.max_us > m_running_max_us) {
+            m_running_max_us = m_block.max_us;
+        }
+        m_block.running_max_us = m_running_max_us;
+        m_block.first_channel_offset = m_block_channel_offsets.size();
+        for (unsigned int i = 0; i < DATA_CHANNEL_COUNT; i++) {
+            if (m_block.channels & (1u << i)) {
+                m_block_channel_offsets.push_back(m_channel_offsets[i]);
+            }
+        }
+        m_blocks.push_back(m_block);
+    }
+
+    m_block = Block();
+    m_block.offset = m_offset;
+    m_block.min_us = UINT64_MAX;
+}
+
+int CaptureWriter::writeIndex()
+{
+    endBlock();
+
+    uint8_t buf[CAPTURE_RECORD_HEADER_SIZE + 12];
+    memset(buf, 0, sizeof(buf));
+    buf[8] = CAPTURE_SOURCE_INDEX;
+    buf[9] = 0xFF;
+    memcpy(buf + CAPTURE_RECORD_HEADER_SIZE, "INDX", 4);
+    capture_write_u32(buf + CAPTURE_RECORD_HEADER_SIZE + 4, m_blocks.size());
+    capture_write_u32(buf + CAPTURE_RECORD_HEADER_SIZE + 8,
+            m_block_channel_offsets.size());
+    bool ok = m_file.write(buf, sizeof(buf)) == 0;
+
+    for (size_t i = 0; i < m_blocks.size() && ok; i++) {
+        const Block &block = m_blocks[i];
+        uint8_t entry[CAPTURE_BLOCK_ENTRY_SIZE];
+        capture_write_u64(entry, block.offset);
+        capture_write_u64(entry + 8, block.min_us);
+        capture_write_u64(entry + 16, block.max_us);
+        capture_write_u64(entry + 24, block.running_max_us);
+        capture_write_u32(entry + 32, block.records);
+        capture_write_u32(entry + 36, block.channels);
+        capture_write_u32(entry + 40, block.clients);
+        capture_write_u32(entry + 44, block.first_channel_offset);
+        ok = m_file.write(entry, sizeof(entry)) == 0;
+    }
+    for (size_t i = 0; i < m_block_channel_offsets.size() && ok; i++) {
+        uint8_t offset[4];
+        capture_write_u32(offset, m_block_channel_offsets[i]);
+        ok = m_file.write(offset, sizeof(offset)) == 0;
+    }
+
+    uint8_t footer[CAPTURE_FOOTER_SIZE];
+    capture_write_u64(footer, m_offset);
+    memcpy(footer + 8, CAPTURE_FOOTER_MAGIC, 8);
+    if (!ok || m_file.write(footer, sizeof(footer)) < 0) {
+        printf("Failed to write capture index\n");
+        return -EIO;
+    }
+    return 0;
+}
+
+CaptureReader::CaptureReader()
+{
+    m_file = nullptr;
+    m_start_wall_clock_us = 0;
+    m_start_monotonic_us = 0;
+}
+
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+int CaptureReader::open(const char *path)
+{
+    if (m_file != nullptr) {
+        return -EEXIST;
+    }
+
+    m_file = fopen(path, "rb");
+    if (m_file == nullptr) {
+        return -errno;
+    }
+
+    uint8_t header[CAPTURE_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, m_file) != 1 ||
+            (memcmp(header, CAPTURE_MAGIC, 8) != 0 &&
+            memcmp(header, CAPTURE_MAGIC_V1, 8) != 0)) {
+        close();
+        return -EBADMSG;
+    }
+    m_start_wall_clock_us = capture_read_u64(header + 8);
+    m_start_monotonic_us = capture_read_u64(header + 16);
+    return 0;
+}
+
+void CaptureReader::close()
+{
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+uint64_t CaptureReader::startWallClockUs() const
+{
+    return m_start_wall_clock_us;
+}
+
+uint64_t CaptureReader::startMonotonicUs() const
+{
+    return m_start_monotonic_us;
+}
+
+int CaptureReader::next(LowLevelMessage &message, CaptureSource &source,
+        uint64_t &timestamp_us)
+{
+    if (m_file == nullptr) {
+        return -EBADF;
+    }
+
+    uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+    size_t n = fread(header, 1, sizeof(header), m_file);
+    if (n == 0) {
+        return 0;
+    } else if (n != sizeof(header)) {
+        return -EBADMSG;
+    }
+    if (header[8] == CAPTURE_SOURCE_INDEX) {
+        return 0;
+    }
+
+    size_t size = capture_read_u16(header + 10);
+    m_frame.resize(size);
+    if (size > 0 && fread(&m_frame[0], size, 1, m_file) != 1) {
+        return -EBADMSG;
+    }
+
+    timestamp_us = capture_read_u64(header);
+    source = (CaptureSource)header[8];
+
+    LowLevelMessage frame(source == CAPTURE_SOURCE_SERIAL ?
+            LL_MSG_SIDE_SERIAL : LL_MSG_SIDE_SOCKET);
+    frame.set_client_id(header[9] == 0xFF ? UNKNOWN_CLIENT_ID : header[9]);
+    int err;
+    frame.append_bytes((const uint8_t *)m_frame.data(), size, err);
+    if (!frame.ready()) {
+        return -EBADMSG;
+    }
+    message = frame;
+    return 1;
+}
+
+CaptureQuery::Filter::Filter()
+{
+    begin_us = 0;
+    end_us = UINT64_MAX;
+    channels = UINT32_MAX;
+    clients = UINT32_MAX;
+}
+
+CaptureQuery::CaptureQuery()
+{
+    m_data = nullptr;
+    m_size = 0;
+    m_start_wall_clock_us = 0;
+    m_start_monotonic_us = 0;
+    m_records_end = 0;
+    m_block_count = 0;
+    m_blocks = nullptr;
+    m_channel_offsets = nullptr;
+    m_channel_offset_count = 0;
+}
+
+CaptureQuery::~CaptureQuery()
+{
+    close();
+}
+
+int CaptureQuery::open(const char *path)
+{
+    if (m_data != nullptr) {
+        return -EEXIST;
+    }
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) < 0) {
+        int ret = -errno;
+        ::close(fd);
+        return ret;
+    }
+    if ((size_t)st.st_size < CAPTURE_HEADER_SIZE) {
+        ::close(fd);
+        return -EBADMSG;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return -errno;
+    }
+    m_data = (const uint8_t *)data;
+    m_size = st.st_size;
+
+    if (memcmp(m_data, CAPTURE_MAGIC, 8) != 0 &&
+            memcmp(m_data, CAPTURE_MAGIC_V1, 8) != 0) {
+        close();
+        return -EBADMSG;
+    }
+    m_start_wall_clock_us = capture_read_u64(m_data + 8);
+    m_start_monotonic_us = capture_read_u64(m_data + 16);
+    m_records_end = m_size;
+
+    /* Without a valid index, the file is scanned whole */
+    const size_t index_header_size = CAPTURE_RECORD_HEADER_SIZE + 12;
+    if (m_size < CAPTURE_HEADER_SIZE + index_header_size +
+            CAPTURE_FOOTER_SIZE || memcmp(m_data + m_size - 8,
+            CAPTURE_FOOTER_MAGIC, 8) != 0) {
+        return 0;
+    }
+    uint64_t index = capture_read_u64(m_data + m_size - CAPTURE_FOOTER_SIZE);
+    if (index < CAPTURE_HEADER_SIZE ||
+            index + index_header_size + CAPTURE_FOOTER_SIZE > m_size) {
+        return 0;
+    }
+    const uint8_t *header = m_data + index;
+    uint64_t block_count = capture_read_u32(header + 16);
+    uint64_t offset_count = capture_read_u32(header + 20);
+    if (header[8] != CAPTURE_SOURCE_INDEX ||
+            memcmp(header + CAPTURE_RECORD_HEADER_SIZE, "INDX", 4) != 0 ||
+            index + index_header_size + block_count *
+            CAPTURE_BLOCK_ENTRY_SIZE + offset_count * 4 +
+            CAPTURE_FOOTER_SIZE != m_size) {
+        return 0;
+    }
+    m_records_end = index;
+    m_block_count = block_count;
+    m_blocks = header + index_header_size;
+    m_channel_offsets = m_blocks + block_count * CAPTURE_BLOCK_ENTRY_SIZE;
+    m_channel_offset_count = offset_count;
+
+    m_later_min_us.resize(block_count);
+    uint64_t min_us = UINT64_MAX;
+    for (size_t i = block_count; i-- > 0;) {
+        uint64_t block_min_us = capture_read_u64(blockEntry(i) + 8);
+        min_us = block_min_us < min_us ? block_min_us : min_us;
+        m_later_min_us[i] = min_us;
+    }
+    return 0;
+}
+
+void CaptureQuery::close()
+{
+    if (m_data != nullptr) {
+        munmap((void *)m_data, m_size);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_records_end = 0;
+    m_block_count = 0;
+    m_blocks = nullptr;
+    m_channel_offsets = nullptr;
+    m_channel_offset_count = 0;
+    m_later_min_us.clear();
+}
+
+bool CaptureQuery::indexed() const
+{
+    return m_blocks != nullptr;
+}
+
+uint64_t CaptureQuery::startWallClockUs() const
+{
+    return m_start_wall_clock_us;
+}
+
+uint64_t CaptureQuery::startMonotonicUs() const
+{
+    return m_start_monotonic_us;
+}
+
+long CaptureQuery::run(const Filter &filter, const Callback &callback) const
+{
+    long count = 0;
+    if (m_data == nullptr) {
+        return -EBADF;
+    }
+    if (!indexed()) {
+        long ret = scan(CAPTURE_HEADER_SIZE, m_records_end, filter, callback,
+                count);
+        return ret < 0 ? ret : count;
+    }
+
+    /* First block which may hold records from begin_us on */
+    size_t lo = 0;
+    size_t hi = m_block_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (capture_read_u64(blockEntry(mid) + 24) < filter.begin_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (size_t i = lo; i < m_block_count; i++) {
+        const uint8_t *entry = blockEntry(i);
+
+        /* Routing order is not strictly chronological: done once no
+         * later block holds a record before the end of the range */
+        if (m_later_min_us[i] >= filter.end_us) {
+            break;
+        }
+        if (capture_read_u64(entry + 8) >= filter.end_us ||
+                capture_read_u64(entry + 16) < filter.begin_us) {
+            continue;
+        }
+        uint32_t channel_mask = capture_read_u32(entry + 36);
+        uint32_t channels = channel_mask & filter.channels;
+        uint32_t clients = capture_read_u32(entry + 40) & filter.clients;
+        bool any_client = filter.clients == UINT32_MAX;
+        if (channels == 0 && clients == 0 && !any_client) {
+            continue;
+        }
+
+        uint64_t begin = capture_read_u64(entry);
+        uint64_t end = i + 1 < m_block_count ?
+                capture_read_u64(blockEntry(i + 1)) : m_records_end;
+
+        /* Only data channels: from the first frame of one of them */
+        if (clients == 0 && !any_client) {
+            uint32_t first = capture_read_u32(entry + 44);
+            uint32_t start = UINT32_MAX;
+            for (uint32_t mask = channels; mask != 0; mask &= mask - 1) {
+                unsigned int channel = __builtin_ctz(mask);
+                size_t k = first + __builtin_popcount(channel_mask &
+                        ((1u << channel) - 1));
+                if (k >= m_channel_offset_count) {
+                    return -EBADMSG;
+                }
+                uint32_t offset = capture_read_u32(m_channel_offsets + 4 * k);
+                start = offset < start ? offset : start;
+            }
+            begin += start;
+        }
+
+        if (begin > end || end > m_records_end) {
+            return -EBADMSG;
+        }
+        long ret = scan(begin, end, filter, callback, count);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return count;
+}
+
+long CaptureQuery::scan(uint64_t begin, uint64_t end, const Filter &filter,
+        const Callback &callback, long &count) const
+{
+    LowLevelMessage serial(LL_MSG_SIDE_SERIAL);
+    LowLevelMessage socket(LL_MSG_SIDE_SOCKET);
+
+    uint64_t pos = begin;
+    while (pos < end) {
+        if (end - pos < CAPTURE_RECORD_HEADER_SIZE) {
+            return -EBADMSG;
+        }
+        const uint8_t *header = m_data + pos;
+        if (header[8] == CAPTURE_SOURCE_INDEX) {
+            break;
+        }
+        size_t size = capture_read_u16(header + 10);
+        if (end - pos - CAPTURE_RECORD_HEADER_SIZE < size) {
+            return -EBADMSG;
+        }
+        pos += CAPTURE_RECORD_HEADER_SIZE + size;
+
+        uint64_t timestamp_us = capture_read_u64(header);
+        if (timestamp_us < filter.begin_us || timestamp_us >= filter.end_us) {
+            continue;
+        }
+
+        /* Selected on the raw bytes, parsed only if selected */
+        CaptureSource source = (CaptureSource)header[8];
+        const uint8_t *frame = header + CAPTURE_RECORD_HEADER_SIZE;
+        uint8_t client_id = header[9];
+        if (source == CAPTURE_SOURCE_SERIAL && size >= 3 &&
+                frame[2] < DATA_CHANNEL_COUNT) {
+            if (!(filter.channels & (1u << frame[2]))) {
+                continue;
+            }
+        } else if (client_id < 32 ? !(filter.clients & (1u << client_id)) :
+                filter.clients != UINT32_MAX) {
+            continue;
+        }
+
+        LowLevelMessage &message = source == CAPTURE_SOURCE_SERIAL ?
+                serial : socket;
+        int err;
+        if (message.read_in_place(frame, size, err) != size ||
+                err != LL_MSG_OK) {
+            return -EBADMSG;
+        }
+        if (source != CAPTURE_SOURCE_SERIAL) {
+            message.set_client_id(client_id == 0xFF ? UNKNOWN_CLIENT_ID :
+                    client_id);
+        }
+        message.set_timestamp(timestamp_us * 1000);
+        callback(message, source, timestamp_us);
+        count++;
+    }
+    return 0;
+}
+
+const uint8_t *CaptureQuery::blockEntry(size_t index) const
+{
+    return m_blocks + index * CAPTURE_BLOCK_ENTRY_SIZE;
+}
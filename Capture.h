@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "FileWriter.h"
+#include "LowLevelMessage.h"
+
+/* Capture file of the routed traffic:
+ *   header: "LLCAP2\0\0", u64 wall-clock time of the start (us since epoch),
+ *           u64 monotonic time of the start (us)
+ *   records: u64 monotonic timestamp (us), u8 source, u8 client ID,
+ *            u16 frame size, frame as seen on the source (i.e. with the
+ *            client ID for serial frames only)
+ *   index, written by close(): a record header of source
+ *          CAPTURE_SOURCE_INDEX ending the records, then
+ *          "INDX", u32 block count, u32 channel offset count,
+ *          blocks: u64 file offset, u64 min timestamp, u64 max timestamp,
+ *                  u64 max timestamp of the block and of the previous ones,
+ *                  u32 record count, u32 channel mask, u32 client mask,
+ *                  u32 index of the first channel offset of the block
+ *          channel offsets: by block then by channel of its mask, u32 offset
+ *                  in the block of the first record of the channel
+ *   footer: u64 file offset of the index, "LLCAPEND"
+ * Records are grouped in blocks of about CAPTURE_BLOCK_SIZE bytes. The
+ * channels of a block are those of its data-channel frames read from serial,
+ * its clients those of the other records. Timestamps are in routing order,
+ * which is not strictly chronological. Version 1 files have no index, nor do
+ * the captures of a server which did not stop cleanly. Frames of more than
+ * 65535 bytes are not captured.
+ * All integers are little-endian. */
+#define CAPTURE_MAGIC "LLCAP2\0\0"
+#define CAPTURE_MAGIC_V1 "LLCAP1\0\0"
+#define CAPTURE_HEADER_SIZE 24
+#define CAPTURE_RECORD_HEADER_SIZE 12
+#define CAPTURE_MAX_FRAME_SIZE UINT16_MAX
+#define CAPTURE_BLOCK_SIZE (64 * 1024)
+#define CAPTURE_BLOCK_ENTRY_SIZE 48
+#define CAPTURE_FOOTER_MAGIC "LLCAPEND"
+#define CAPTURE_FOOTER_SIZE 16
+
+enum CaptureSource {
+    CAPTURE_SOURCE_SERIAL = 0,
+    CAPTURE_SOURCE_SOCKET = 1,
+    CAPTURE_SOURCE_INDEX = 0xFF,
+};
+
+class CaptureWriter
+{
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    /* Create a new capture file in the folder */
+    int open(const char *folder);
+
+    /* Create the capture file path, with the given start times */
+    int create(const char *path, uint64_t start_wall_clock_us,
+            uint64_t start_monotonic_us);
+
+    /* Write the index and close */
+    int close();
+    bool isOpen() const;
+
+    void write(const LowLevelMessage &message, CaptureSource source,
+            uint64_t timestamp_us);
+
+private:
+    struct Block {
+        uint64_t offset;
+        uint64_t min_us;
+        uint64_t max_us;
+        uint64_t running_max_us;
+        uint32_t records;
+        uint32_t channels;
+        uint32_t clients;
+        uint32_t first_channel_offset;
+    };
+
+    void endBlock();
+    int writeIndex();
+
+    FileWriter m_file;
+    uint64_t m_offset;
+    uint64_t m_running_max_us;
+    Block m_block;
+    uint32_t m_channel_offsets[DATA_CHANNEL_COUNT]; /* Of the current block */
+    std::vector<Block> m_blocks;
+    std::vector<uint32_t> m_block_channel_offsets;
+    std::vector<uint8_t> m_buffer;
+};
+
+class CaptureReader
+{
+public:
+    CaptureReader();
+    ~CaptureReader();
+
+    int open(const char *path);
+    void close();
+
+    uint64_t startWallClockUs() const;
+    uint64_t startMonotonicUs() const;
+
+    /* Returns 1 when a record was read, 0 at the end of the file, or a
+     * negative error code */
+    int next(LowLevelMessage &message, CaptureSource &source,
+            uint64_t &timestamp_us);
+
+private:
+    FILE *m_file;
+    uint64_t m_start_wall_clock_us;
+    uint64_t m_start_monotonic_us;
+    std::string m_frame;
+};
+
+/* Records of a capture file mapped in memory, selected by time range, data
+ * channel and client with the index: blocks out of the selection are
+ * skipped, so a query costs in proportion to the records it returns. Files
+ * without index are scanned whole. */
+class CaptureQuery
+{
+public:
+    struct Filter {
+        Filter();
+        uint64_t begin_us;  /* [begin, end) monotonic timestamps */
+        uint64_t end_us;
+        uint32_t channels;  /* Data-channel frames read from serial */
+        uint32_t clients;   /* Other records: commands, replies, control
+                             * messages. UINT32_MAX includes the records
+                             * of no client */
+    };
+
+    /* The message borrows its bytes from the mapping, valid until close() */
+    typedef std::function<void(const LowLevelMessage &message,
+            CaptureSource source, uint64_t timestamp_us)> Callback;
+
+    CaptureQuery();
+    ~CaptureQuery();
+
+    int open(const char *path);
+    void close();
+    bool indexed() const;
+
+    uint64_t startWallClockUs() const;
+    uint64_t startMonotonicUs() const;
+
+    /* Returns the number of records selected, or a negative error code if
+     * the file is corrupted (the records before are still given) */
+    long run(const Filter &filter, const Callback &callback) const;
+
+private:
+    long scan(uint64_t begin, uint64_t end, const Filter &filter,
+            const Callback &callback, long &count) const;
+    const uint8_t *blockEntry(size_t index) const;
+
+    const uint8_t *m_data;
+    size_t m_size;
+    uint64_t m_start_wall_clock_us;
+    uint64_t m_start_monotonic_us;
+    uint64_t m_records_end;
+    size_t m_block_count;
+    const uint8_t *m_blocks;
+    const uint8_t *m_channel_offsets;
+    size_t m_channel_offset_count;
+    std::vector<uint64_t> m_later_min_us; /* Min timestamp from each block on */
+};
+
+void capture_write_u16(uint8_t *buf, uint16_t value);
+void capture_write_u32(uint8_t *buf, uint32_t value);
+void capture_write_u64(uint8_t *buf, uint64_t value);
+uint16_t capture_read_u16(const uint8_t *buf);
+uint32_t capture_read_u32(const uint8_t *buf);
+uint64_t capture_read_u64(const uint8_t *buf);
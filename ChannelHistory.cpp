@@ -0,0 +1,67 @@
+#include "ChannelHistory.h"
+
+ChannelHistory::ChannelHistory() = default;
+
+ChannelHistory::~ChannelHistory() = default;
+
+void ChannelHistory::clear()
+{
+    for (Ring &ring : m_rings) {
+        ring.next = 0;
+        ring.count = 0;
+    }
+}
+
+void ChannelHistory::push(const LowLevelMessage &message,
+        uint64_t timestamp_us)
+{
+    Ring &ring = m_rings[message.get_data_channel()];
+
+    /* Assignment reuses the frame buffer of the overwritten entry */
+    Entry &entry = ring.entries[ring.next];
+    entry.message = message;
+    entry.timestamp_us = timestamp_us;
+
+    ring.next = (ring.next + 1) % CHANNEL_HISTORY_SIZE;
+    if (ring.count < CHANNEL_HISTORY_SIZE) {
+        ring.count++;
+    }
+}
+
+size_t ChannelHistory::size(unsigned int channel) const
+{
+    return m_rings[channel].count;
+}
+
+const LowLevelMessage &ChannelHistory::at(unsigned int channel,
+        size_t index) const
+{
+    return entryAt(channel, index).message;
+}
+
+uint64_t ChannelHistory::timestampAt(unsigned int channel, size_t index) const
+{
+    return entryAt(channel, index).timestamp_us;
+}
+
+const ChannelHistory::Entry &ChannelHistory::entryAt(unsigned int channel,
+        size_t index) const
+{
+    const Ring &ring = m_rings[channel];
+    size_t position = (ring.next + CHANNEL_HISTORY_SIZE - 1 - index) %
+            CHANNEL_HISTORY_SIZE;
+    return ring.entries[position];
+}
+
+ChannelHistory::Entry::Entry() :
+        message(LL_MSG_SIDE_SERIAL)
+{
+    timestamp_us = 0;
+}
+
+ChannelHistory::Ring::Ring() :
+        entries(CHANNEL_HISTORY_SIZE)
+{
+    next = 0;
+    count = 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "LowLevelMessage.h"
+
+#define CHANNEL_HISTORY_SIZE 64
+
+/* Last CHANNEL_HISTORY_SIZE frames received on each data channel, with their
+ * reception time, so that late subscribers can get them immediately. */
+class ChannelHistory
+{
+public:
+    ChannelHistory();
+    ~ChannelHistory();
+
+    void clear();
+    void push(const LowLevelMessage &message, uint64_t timestamp_us);
+
+    /* Number of frames stored for the channel */
+    size_t size(unsigned int channel) const;
+
+    /* Frame received index frames before the last one (0: last frame) */
+    const LowLevelMessage &at(unsigned int channel, size_t index) const;
+    uint64_t timestampAt(unsigned int channel, size_t index) const;
+
+private:
+    struct Entry {
+        Entry();
+        LowLevelMessage message;
+        uint64_t timestamp_us;
+    };
+
+    struct Ring {
+        Ring();
+        std::vector<Entry> entries;
+        size_t next;
+        size_t count;
+    };
+
+    const Entry &entryAt(unsigned int channel, size_t index) const;
+
+    Ring m_rings[DATA_CHANNEL_COUNT];
+};
@@ -0,0 +1,130 @@
+#include "Config.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+static std::string trim(const std::string &str)
+{
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return "";
+    }
+    size_t last = str.find_last_not_of(" \t\r\n");
+    return str.substr(first, last - first + 1);
+}
+
+Config::Config() = default;
+
+Config::~Config() = default;
+
+int Config::load(const char *path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        printf("Failed to open config file '%s': %d (%s)\n", path, -errno,
+                strerror(errno));
+        return -errno;
+    }
+
+    std::string line;
+    unsigned int line_number = 0;
+    int ret = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        std::string str = trim(line);
+        if (str.empty() || str[0] == '#') {
+            continue;
+        }
+        size_t separator = str.find('=');
+        if (separator == std::string::npos) {
+            printf("Invalid line %u in config file '%s'\n", line_number,
+                    path);
+            ret = -EINVAL;
+            break;
+        }
+        m_entries.emplace_back(trim(str.substr(0, separator)),
+                trim(str.substr(separator + 1)));
+    }
+    if (ret == 0 && file.bad()) {
+        printf("Failed to read config file '%s'\n", path);
+        ret = -EIO;
+    }
+
+    return ret;
+}
+
+bool Config::has(const char *key) const
+{
+    return get(key, nullptr) != nullptr;
+}
+
+const char *Config::get(const char *key, const char *default_value) const
+{
+    /* The last occurrence wins */
+    for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it) {
+        if (it->first == key) {
+            return it->second.c_str();
+        }
+    }
+    return default_value;
+}
+
+int Config::getInt(const char *key, long default_value, long &value) const
+{
+    const char *str = get(key, nullptr);
+    if (str == nullptr) {
+        value = default_value;
+        return 0;
+    }
+    char *end = nullptr;
+    errno = 0;
+    long ret = strtol(str, &end, 0);
+    if (end == str || *end != '\0' || errno == ERANGE) {
+        printf("Invalid integer value for '%s': %s\n", key, str);
+        return -EINVAL;
+    }
+    value = ret;
+    return 0;
+}
+
+std::vector<std::string> Config::getAll(const char *key) const
+{
+    std::vector<std::string> ret;
+    for (const std::pair<std::string, std::string> &entry : m_entries) {
+        if (entry.first == key) {
+            ret.push_back(entry.second);
+        }
+    }
+    return ret;
+}
+
+int Config::parseCommandRange(const std::string &value, uint8_t &first,
+        uint8_t &last, std::string &arguments)
+{
+    const char *str = value.c_str();
+    char *end = nullptr;
+
+    unsigned long a = strtoul(str, &end, 0);
+    if (end == str || a > UINT8_MAX) {
+        return -EINVAL;
+    }
+    unsigned long b = a;
+    if (*end == '-') {
+        str = end + 1;
+        b = strtoul(str, &end, 0);
+        if (end == str || b > UINT8_MAX || b < a) {
+            return -EINVAL;
+        }
+    }
+    if (*end != '\0' && *end != ' ' && *end != '\t') {
+        return -EINVAL;
+    }
+
+    first = a;
+    last = b;
+    arguments = trim(end);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Settings read from a configuration file made of "key = value" lines.
+ * Blank lines and lines starting with '#' are ignored. A key may appear
+ * several times, e.g. to describe several entries of a table. */
+class Config
+{
+public:
+    Config();
+    ~Config();
+
+    int load(const char *path);
+
+    bool has(const char *key) const;
+    const char *get(const char *key, const char *default_value) const;
+    /* Returns -EINVAL, printing why, if the value is not an integer */
+    int getInt(const char *key, long default_value, long &value) const;
+    std::vector<std::string> getAll(const char *key) const;
+
+    /* Parse a "<first>[-<last>] [arguments]" command ID range (decimal or
+     * 0x-prefixed), returning the arguments */
+    static int parseCommandRange(const std::string &value, uint8_t &first,
+            uint8_t &last, std::string &arguments);
+
+private:
+    std::vector<std::pair<std::string, std::string>> m_entries;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+
+/* Control messages are the frames sent by a client with a data-channel
+ * command. Data channels only flow from the board to the clients, so the
+ * router consumes these frames instead of forwarding them to the serial port.
+ * The payload is an opcode followed by its arguments, multi-byte values being
+ * little-endian. The channel is the data-channel command of the frame.
+ * A payload of a single byte keeps its original meaning: 0 unsubscribes from
+ * the channel, any other value subscribes to it. */
+enum LowLevelControlOpcode {
+    LL_CTRL_UNSUBSCRIBE = 0,            /* No argument */
+    LL_CTRL_SUBSCRIBE = 1,              /* No argument */
+    LL_CTRL_SUBSCRIBE_DECIMATED = 2,    /* u16: forward 1 sample out of N */
+    LL_CTRL_SUBSCRIBE_RATE = 3,         /* u16: at most N samples per second */
+    LL_CTRL_SESSION_OPTIONS = 4,        /* u8: LowLevelSessionOption flags,
+                                         * the channel is ignored */
+    LL_CTRL_SUBSCRIBE_HISTORY = 5,      /* u8 count, u16 max age in ms (0: no
+                                         * limit): subscribe and get the last
+                                         * samples of the channel at once */
+    LL_CTRL_HISTORY = 6,                /* Same as above, without subscribing */
+    LL_CTRL_RESUME_SESSION = 7,         /* u64 token, u8 LowLevelResumeFlag
+                                         * flags: see below, the channel is
+                                         * ignored */
+};
+
+/* Session resumption. A client picks a random non-zero token and sends it
+ * with LL_CTRL_RESUME_SESSION right after connecting. When the router knows
+ * the token, it restores the client ID (if still free), the subscriptions
+ * and the session options of the previous connection, and, with
+ * LL_RESUME_REPLAY, sends the frames the client missed meanwhile. Sessions
+ * are kept for session_timeout_ms after a disconnection.
+ * The router answers with a control reply record (see below) of opcode
+ * LL_CTRL_RESUME_SESSION, carrying: u8 LowLevelResumeStatus, u8 client ID,
+ * u16 number of missed frames which follow, u16 number of missed frames
+ * lost. Commands must not be sent before this reply. */
+enum LowLevelResumeFlag {
+    LL_RESUME_REPLAY = 0x01,
+};
+
+enum LowLevelResumeStatus {
+    LL_RESUME_NEW_SESSION = 0,
+    LL_RESUME_RESUMED = 1,
+};
+
+/* Control reply record: 0xFD | opcode | length | payload. Only sent in reply
+ * to the control messages documented as such. */
+#define LL_CTRL_REPLY_HEADER_BYTE 0xFD
+
+/* Per-connection options, all disabled when a client connects */
+enum LowLevelSessionOption {
+    LL_SESSION_COMPRESSION = 0x01,      /* See TelemetryCodec.h */
+    LL_SESSION_TIMESTAMPS = 0x02,       /* Timestamp record before frames */
+    LL_SESSION_BATCH = 0x04,            /* Batch records, see below */
+};
+
+/* Batch record: 0xFA | u16 length | records. With LL_SESSION_BATCH, the
+ * records (frames, compressed frames, timestamp and control reply records)
+ * the router has for a client in one loop iteration are sent as a single
+ * batch record, or several if they exceed LL_BATCH_MAX_SIZE bytes: records
+ * never straddle two batches. WebSocket clients then get one binary message
+ * per batch instead of one per frame.
+ * Clients may send their frames in batch records too, with or without the
+ * option. A receiver may also just skip the 3 header bytes and parse the
+ * records as if they were not batched. */
+#define LL_BATCH_HEADER_BYTE 0xFA
+#define LL_BATCH_HEADER_SIZE 3
+#define LL_BATCH_MAX_SIZE 65535
+
+static inline void ll_write_batch_header(uint8_t *buf, uint16_t length)
+{
+    buf[0] = LL_BATCH_HEADER_BYTE;
+    buf[1] = (uint8_t)(length & 0xFF);
+    buf[2] = (uint8_t)(length >> 8);
+}
+
+/* Timestamp record, sent before each frame when LL_SESSION_TIMESTAMPS is
+ * enabled: 0xFB | u64 CLOCK_MONOTONIC time (ns) at which the server read the
+ * frame from the serial port (0 if unknown). Only meaningful to clients
+ * running on the same host as the server. */
+#define LL_TIMESTAMP_HEADER_BYTE 0xFB
+#define LL_TIMESTAMP_RECORD_SIZE 9
+
+static inline void ll_write_timestamp_record(uint8_t *buf,
+        uint64_t timestamp_ns)
+{
+    buf[0] = LL_TIMESTAMP_HEADER_BYTE;
+    for (int i = 0; i < 8; i++) {
+        buf[1 + i] = (uint8_t)(timestamp_ns >> (8 * i));
+    }
+}
+
+static inline uint16_t ll_ctrl_read_u16(const uint8_t *buf)
+{
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+static inline void ll_ctrl_write_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = (uint8_t)(value & 0xFF);
+    buf[1] = (uint8_t)(value >> 8);
+}
+
+static inline uint64_t ll_ctrl_read_u64(const uint8_t *buf)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)buf[i] << (8 * i);
+    }
+    return value;
+}
+
+static inline void ll_ctrl_write_u64(uint8_t *buf, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+}
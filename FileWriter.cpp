@@ -0,0 +1,112 @@
+#include "FileWriter.h"
+
+#include <cerrno>
+#include <sched.h>
+#include <unistd.h>
+
+#define FILE_WRITER_IDLE_SLEEP_US 1000
+
+FileWriter::FileWriter() :
+        m_chunks(FILE_WRITER_QUEUE_SIZE)
+{
+    m_file = nullptr;
+    m_running = false;
+    m_error = 0;
+}
+
+FileWriter::~FileWriter()
+{
+    close();
+}
+
+int FileWriter::open(const char *path)
+{
+    if (m_file != nullptr) {
+        return -EEXIST;
+    }
+
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr) {
+        return -errno;
+    }
+    m_chunk.clear();
+    m_chunk.reserve(FILE_WRITER_CHUNK_SIZE);
+    m_error = 0;
+    m_running = true;
+    m_thread = std::thread(&FileWriter::run, this);
+    return 0;
+}
+
+int FileWriter::close()
+{
+    if (m_file == nullptr) {
+        return 0;
+    }
+
+    /* The thread writes the chunks left before stopping */
+    handOver();
+    m_running = false;
+    m_thread.join();
+    int ret = m_error;
+    if (fclose(m_file) != 0 && ret == 0) {
+        ret = -EIO;
+    }
+    m_file = nullptr;
+    return ret;
+}
+
+bool FileWriter::isOpen() const
+{
+    return m_file != nullptr;
+}
+
+int FileWriter::write(const void *data, size_t size)
+{
+    if (m_file == nullptr) {
+        return -EBADF;
+    }
+    if (m_error != 0) {
+        return m_error;
+    }
+
+    const uint8_t *bytes = (const uint8_t *)data;
+    m_chunk.insert(m_chunk.end(), bytes, bytes + size);
+    if (m_chunk.size() >= FILE_WRITER_CHUNK_SIZE) {
+        handOver();
+    }
+    return 0;
+}
+
+void FileWriter::handOver()
+{
+    if (m_chunk.empty()) {
+        return;
+    }
+    while (!m_chunks.emplace(std::move(m_chunk))) {
+        sched_yield();
+    }
+    m_chunk = std::vector<uint8_t>();
+    m_chunk.reserve(FILE_WRITER_CHUNK_SIZE);
+}
+
+void FileWriter::run()
+{
+    while (true) {
+        bool running = m_running;
+        bool written = false;
+        while (std::vector<uint8_t> *chunk = m_chunks.front()) {
+            if (m_error == 0 &&
+                    fwrite(chunk->data(), chunk->size(), 1, m_file) != 1) {
+                m_error = -EIO;
+            }
+            m_chunks.pop();
+            written = true;
+        }
+        if (!running) {
+            break;
+        }
+        if (!written) {
+            usleep(FILE_WRITER_IDLE_SLEEP_US);
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "SpscQueue.h"
+
+#define FILE_WRITER_CHUNK_SIZE (256 * 1024)
+#define FILE_WRITER_QUEUE_SIZE 64
+
+/* File written by a background thread, so that recording the traffic never
+ * blocks the routing loop on the disk. write() appends to a chunk, handed
+ * over to the thread once full: the file holds the bytes written up to the
+ * last full chunk, all of them after close(). write() only waits when the
+ * thread is FILE_WRITER_QUEUE_SIZE chunks behind.
+ * A write error is returned by the next write() or by close(), the bytes
+ * written after it being discarded. */
+class FileWriter
+{
+public:
+    FileWriter();
+    ~FileWriter();
+
+    int open(const char *path);
+    int close();
+    bool isOpen() const;
+
+    /* Returns 0, or -EIO if a previous write failed */
+    int write(const void *data, size_t size);
+
+private:
+    void run();
+    void handOver();
+
+    FILE *m_file;
+    std::vector<uint8_t> m_chunk;
+    SpscQueue<std::vector<uint8_t>> m_chunks;
+    std::atomic<bool> m_running;
+    std::atomic<int> m_error;
+    std::thread m_thread;
+};
@@ -0,0 +1,752 @@
+#include "Handover.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define HANDOVER_MAGIC "LLHO"
+#define HANDOVER_HEADER_SIZE 10
+#define HANDOVER_ACK 0x06
+#define HANDOVER_NACK 0x15
+#define HANDOVER_MAX_FDS (SOCK_INTERFACE_MAX_CLIENTS + 3)
+#define HANDOVER_MAX_BODY (64 * 1024 * 1024)
+#define HANDOVER_NO_FD 0xFF
+#define HANDOVER_MAX_FRAME 4096
+
+HandoverClient::HandoverClient()
+{
+    client_id = UNKNOWN_CLIENT_ID;
+    fd = -1;
+    websocket = SocketWorker::WS_NONE;
+    subscriptions = {};
+    session_token = 0;
+    session_replay = false;
+}
+
+HandoverState::HandoverState() :
+        serial_message(LL_MSG_SIDE_SERIAL)
+{
+    listen_fd = -1;
+    websocket_fd = -1;
+    serial_fd = -1;
+}
+
+HandoverState::~HandoverState()
+{
+    for (int fd : {listen_fd, websocket_fd, serial_fd}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    for (HandoverClient &client : clients) {
+        if (client.fd >= 0) {
+            ::close(client.fd);
+        }
+    }
+}
+
+/* Exchange, the new instance connecting to the running one:
+ *   new -> running: hello "LLHO" | u8 version
+ *   running -> new: u8 ACK if it uses the same version, then header and body
+ *                   (the descriptors along with the header), or u8 NACK
+ *   new -> running: u8 ACK once the state is deserialized, or u8 NACK
+ * The running instance exits on ACK, and resumes from its state otherwise.
+ *
+ * State serialization, multi-byte values being little-endian.
+ *   header: "LLHO" | u8 version | u8 fd count | u32 body size
+ *   body:   u8 listen fd | u8 websocket fd | u8 serial fd (indexes in the
+ *           SCM_RIGHTS array, 0xFF: none)
+ *           u16 size | incomplete serial frame
+ *           u16 count | count * (u8 client id | u16 size | frame without cid)
+ *           u8 count | count * client
+ *   client: u8 id | u8 fd | u8 WebSocketState | u64 session token | u8 replay
+ *           u32 subscribed | u32 filtered | per filtered channel: u16
+ *           decimation | u16 counter | u64 min interval | u64 last sent
+ *           u8 has connection, if set: u8 options | u8 batch header bytes
+ *           left | u16 size | incomplete frame | u32 size | WebSocket input | u32 size | output | u32
+ *           channel mask | per channel: u16 size | encoder reference payload
+ */
+namespace {
+
+class Writer
+{
+public:
+    void u8(uint8_t value)
+    {
+        data.push_back(value);
+    }
+
+    void u16(uint16_t value)
+    {
+        integer(value, 2);
+    }
+
+    void u32(uint32_t value)
+    {
+        integer(value, 4);
+    }
+
+    void u64(uint64_t value)
+    {
+        integer(value, 8);
+    }
+
+    void bytes(const uint8_t *buf, size_t size)
+    {
+        data.insert(data.end(), buf, buf + size);
+    }
+
+    /* Received bytes of an incomplete frame, dropped if too large */
+    void partialFrame(const LowLevelMessage &message)
+    {
+        uint8_t buf[HANDOVER_MAX_FRAME];
+        ssize_t size = message.get_received_bytes(buf, sizeof(buf));
+        size = size < 0 ? 0 : size;
+        u16(size);
+        bytes(buf, size);
+    }
+
+    std::vector<uint8_t> data;
+
+private:
+    void integer(uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; i++) {
+            data.push_back(value >> (8 * i));
+        }
+    }
+};
+
+class Reader
+{
+public:
+    Reader(const uint8_t *buf, size_t size) : m_buf(buf), m_size(size)
+    {
+        m_pos = 0;
+        error = false;
+    }
+
+    uint8_t u8()
+    {
+        return integer(1);
+    }
+
+    uint16_t u16()
+    {
+        return integer(2);
+    }
+
+    uint32_t u32()
+    {
+        return integer(4);
+    }
+
+    uint64_t u64()
+    {
+        return integer(8);
+    }
+
+    const uint8_t *bytes(size_t size)
+    {
+        if (m_size - m_pos < size) {
+            error = true;
+            return nullptr;
+        }
+        const uint8_t *ret = m_buf + m_pos;
+        m_pos += size;
+        return ret;
+    }
+
+    void partialFrame(LowLevelMessage &message)
+    {
+        size_t size = u16();
+        const uint8_t *buf = bytes(size);
+        int err;
+        message.reset();
+        if (buf != nullptr && message.append_bytes(buf, size, err) != size) {
+            error = true;
+        }
+    }
+
+    bool error;
+
+private:
+    uint64_t integer(size_t size)
+    {
+        const uint8_t *buf = bytes(size);
+        uint64_t value = 0;
+        for (size_t i = 0; buf != nullptr && i < size; i++) {
+            value |= (uint64_t)buf[i] << (8 * i);
+        }
+        return value;
+    }
+
+    const uint8_t *m_buf;
+    size_t m_size;
+    size_t m_pos;
+};
+
+}
+
+static uint8_t add_fd(std::vector<int> &fds, int fd)
+{
+    if (fd < 0) {
+        return HANDOVER_NO_FD;
+    }
+    fds.push_back(fd);
+    return fds.size() - 1;
+}
+
+static int take_fd(std::vector<int> &fds, uint8_t index)
+{
+    if (index >= fds.size()) {
+        return -1;
+    }
+    int fd = fds[index];
+    fds[index] = -1;
+    return fd;
+}
+
+static void serialize(const HandoverState &state, Writer &writer,
+        std::vector<int> &fds)
+{
+    writer.u8(add_fd(fds, state.listen_fd));
+    writer.u8(add_fd(fds, state.websocket_fd));
+    writer.u8(add_fd(fds, state.serial_fd));
+    writer.partialFrame(state.serial_message);
+
+    writer.u16(state.serial_frames.size());
+    for (const LowLevelMessage &frame : state.serial_frames) {
+        uint8_t buf[HANDOVER_MAX_FRAME];
+        ssize_t size = frame.get_frame_without_cid(buf, sizeof(buf));
+        size = size < 0 ? 0 : size;
+        writer.u8(frame.get_client_id());
+        writer.u16(size);
+        writer.bytes(buf, size);
+    }
+
+    writer.u8(state.clients.size());
+    for (const HandoverClient &client : state.clients) {
+        writer.u8(client.client_id);
+        writer.u8(add_fd(fds, client.fd));
+        writer.u8(client.websocket);
+        writer.u64(client.session_token);
+        writer.u8(client.session_replay);
+
+        const Subscriptions::ClientState &subscriptions = client.subscriptions;
+        writer.u32(subscriptions.subscribed);
+        writer.u32(subscriptions.filtered);
+        for (unsigned int c = 0; c < DATA_CHANNEL_COUNT; c++) {
+            if (subscriptions.filtered & (1u << c)) {
+                const Subscriptions::Filter &filter = subscriptions.filters[c];
+                writer.u16(filter.decimation);
+                writer.u16(filter.counter);
+                writer.u64(filter.min_interval_us);
+                writer.u64(filter.last_sent_us);
+            }
+        }
+
+        writer.u8(client.connection != nullptr);
+        if (client.connection == nullptr) {
+            continue;
+        }
+        const SocketWorker::ClientSnapshot &connection = *client.connection;
+        writer.u8(connection.options);
+        writer.u8(connection.batch_skip);
+        writer.partialFrame(connection.message);
+        writer.u32(connection.input.size());
+        writer.bytes(connection.input.data(), connection.input.size());
+        writer.u32(connection.output.size());
+        writer.bytes(connection.output.data(), connection.output.size());
+        uint32_t channels = 0;
+        for (unsigned int c = 0; c < DATA_CHANNEL_COUNT; c++) {
+            if (!connection.encoder.previous(c).empty()) {
+                channels |= 1u << c;
+            }
+        }
+        writer.u32(channels);
+        for (unsigned int c = 0; c < DATA_CHANNEL_COUNT; c++) {
+            if (channels & (1u << c)) {
+                const std::vector<uint8_t> &previous =
+                        connection.encoder.previous(c);
+                writer.u16(previous.size());
+                writer.bytes(previous.data(), previous.size());
+            }
+        }
+    }
+}
+
+static int deserialize(Reader &reader, std::vector<int> &fds,
+        HandoverState &state)
+{
+    state.listen_fd = take_fd(fds, reader.u8());
+    state.websocket_fd = take_fd(fds, reader.u8());
+    state.serial_fd = take_fd(fds, reader.u8());
+    reader.partialFrame(state.serial_message);
+
+    size_t frame_count = reader.u16();
+    for (size_t i = 0; i < frame_count && !reader.error; i++) {
+        LowLevelMessage frame(LL_MSG_SIDE_SOCKET);
+        uint8_t client_id = reader.u8();
+        size_t size = reader.u16();
+        const uint8_t *buf = reader.bytes(size);
+        int err;
+        if (buf == nullptr || frame.append_bytes(buf, size, err) != size ||
+                !frame.ready()) {
+            return -EPROTO;
+        }
+        frame.set_client_id(client_id);
+        state.serial_frames.push_back(frame);
+    }
+
+    size_t client_count = reader.u8();
+    for (size_t i = 0; i < client_count && !reader.error; i++) {
+        state.clients.emplace_back();
+        HandoverClient &client = state.clients.back();
+        client.client_id = reader.u8();
+        client.fd = take_fd(fds, reader.u8());
+        client.websocket = (SocketWorker::WebSocketState)reader.u8();
+        client.session_token = reader.u64();
+        client.session_replay = reader.u8() != 0;
+        if (client.client_id >= SOCK_INTERFACE_MAX_CLIENTS || client.fd < 0 ||
+                client.websocket > SocketWorker::WS_OPEN) {
+            return -EPROTO;
+        }
+
+        Subscriptions::ClientState &subscriptions = client.subscriptions;
+        subscriptions.subscribed = reader.u32();
+        subscriptions.filtered = reader.u32();
+        for (unsigned int c = 0; c < DATA_CHANNEL_COUNT; c++) {
+            if (subscriptions.filtered & (1u << c)) {
+                Subscriptions::Filter &filter = subscriptions.filters[c];
+                filter.decimation = reader.u16();
+                filter.counter = reader.u16();
+                filter.min_interval_us = reader.u64();
+                filter.last_sent_us = reader.u64();
+            }
+        }
+
+        if (reader.u8() == 0) {
+            continue;
+        }
+        client.connection.reset(new SocketWorker::ClientSnapshot());
+        SocketWorker::ClientSnapshot &connection = *client.connection;
+        connection.options = reader.u8();
+        connection.batch_skip = reader.u8();
+        reader.partialFrame(connection.message);
+        size_t size = reader.u32();
+        const uint8_t *buf = reader.bytes(size);
+        if (buf != nullptr) {
+            connection.input.assign(buf, buf + size);
+        }
+        size = reader.u32();
+        buf = reader.bytes(size);
+        if (buf != nullptr) {
+            connection.output.assign(buf, buf + size);
+        }
+        uint32_t channels = reader.u32();
+        for (unsigned int c = 0; c < DATA_CHANNEL_COUNT; c++) {
+            if (channels & (1u << c)) {
+                size = reader.u16();
+                buf = reader.bytes(size);
+                if (buf != nullptr) {
+                    connection.encoder.setPrevious(c,
+                            std::vector<uint8_t>(buf, buf + size));
+                }
+            }
+        }
+    }
+
+    if (reader.error || state.listen_fd < 0 || state.serial_fd < 0) {
+        return -EPROTO;
+    }
+    return 0;
+}
+
+static int set_timeout(int fd, int option, unsigned int timeout_ms)
+{
+    timeval timeout = {};
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    if (setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout)) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+static int fill_address(const char *path, sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Handover socket path too long: '%s'\n", path);
+        return -ENAMETOOLONG;
+    }
+    strcpy(address.sun_path, path);
+    return 0;
+}
+
+static int recv_all(int fd, uint8_t *buf, size_t size)
+{
+    size_t received = 0;
+    while (received < size) {
+        ssize_t ret = recv(fd, buf + received, size - received, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        } else if (ret == 0) {
+            return -ECONNRESET;
+        }
+        received += ret;
+    }
+    return 0;
+}
+
+static int send_all(int fd, const uint8_t *buf, size_t size)
+{
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t ret = send(fd, buf + sent, size - sent, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        sent += ret;
+    }
+    return 0;
+}
+
+Handover::Handover()
+{
+    m_server = -1;
+    m_client = -1;
+    m_hello_size = 0;
+    m_accepted_ns = 0;
+}
+
+Handover::~Handover()
+{
+    close();
+}
+
+int Handover::receive(const char *path, HandoverState &state)
+{
+    sockaddr_un address;
+    int ret = fill_address(path, address);
+    if (ret < 0) {
+        return ret;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Failed to create handover socket: %d (%s)\n", -errno,
+                strerror(errno));
+        return -errno;
+    }
+    if (connect(fd, (sockaddr*)(&address), sizeof(address)) < 0) {
+        ret = -errno;
+        ::close(fd);
+        /* No instance running */
+        if (ret == -ENOENT || ret == -ECONNREFUSED) {
+            return 0;
+        }
+        printf("Failed to connect to handover socket: %d (%s)\n", ret,
+                strerror(-ret));
+        return ret;
+    }
+    set_timeout(fd, SO_RCVTIMEO, HANDOVER_TIMEOUT_MS);
+    set_timeout(fd, SO_SNDTIMEO, HANDOVER_TIMEOUT_MS);
+
+    /* Nothing is handed over to another version */
+    uint8_t hello[HANDOVER_HELLO_SIZE];
+    memcpy(hello, HANDOVER_MAGIC, 4);
+    hello[4] = HANDOVER_VERSION;
+    uint8_t reply = HANDOVER_NACK;
+    ret = send_all(fd, hello, sizeof(hello));
+    if (ret == 0) {
+        ret = recv_all(fd, &reply, 1);
+    }
+    if (ret == 0 && reply != HANDOVER_ACK) {
+        printf("The running instance uses another handover version\n");
+        ret = -EPROTO;
+    }
+    if (ret < 0) {
+        ::close(fd);
+        printf("Failed to receive the handover state: %d (%s)\n", ret,
+                strerror(-ret));
+        return ret;
+    }
+
+    /* The descriptors come with the first bytes of the header */
+    uint8_t header[HANDOVER_HEADER_SIZE];
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+    } control;
+    iovec iov = {header, sizeof(header)};
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buf;
+    message.msg_controllen = sizeof(control.buf);
+    ssize_t size = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+
+    std::vector<int> fds;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); size > 0 && cmsg != nullptr;
+            cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *data = (const int *)CMSG_DATA(cmsg);
+            fds.insert(fds.end(), data, data + count);
+        }
+    }
+
+    std::vector<uint8_t> body;
+    if (size < 0) {
+        ret = -errno;
+    } else if (size == 0) {
+        ret = -ECONNRESET;
+    } else if (message.msg_flags & MSG_CTRUNC) {
+        ret = -EPROTO;
+    } else {
+        ret = recv_all(fd, header + size, sizeof(header) - size);
+    }
+    if (ret == 0 && (memcmp(header, HANDOVER_MAGIC, 4) != 0 ||
+            header[4] != HANDOVER_VERSION || header[5] != fds.size())) {
+        ret = -EPROTO;
+    }
+    if (ret == 0) {
+        size_t body_size = header[6] | header[7] << 8 | header[8] << 16 |
+                (uint32_t)header[9] << 24;
+        if (body_size > HANDOVER_MAX_BODY) {
+            ret = -EPROTO;
+        } else {
+            body.resize(body_size);
+            ret = recv_all(fd, body.data(), body.size());
+        }
+    }
+    if (ret == 0) {
+        Reader reader(body.data(), body.size());
+        ret = deserialize(reader, fds, state);
+    }
+
+    /* Without ACK, the running instance resumes from its state */
+    reply = ret == 0 ? HANDOVER_ACK : HANDOVER_NACK;
+    int send_ret = send_all(fd, &reply, 1);
+    if (ret == 0) {
+        ret = send_ret;
+    }
+
+    /* The previous instance closes the connection once it released the
+     * ports it does not hand over (e.g. the pause socket). Acknowledged, the
+     * state is ours whatever happens meanwhile */
+    uint8_t byte;
+    while (ret == 0 && (size = recv(fd, &byte, 1, 0)) != 0) {
+        if (size < 0 && errno != EINTR) {
+            printf("Running instance not seen exiting: %d (%s)\n", -errno,
+                    strerror(errno));
+            break;
+        }
+    }
+    ::close(fd);
+
+    /* Descriptors not taken by the state */
+    for (int unused : fds) {
+        if (unused >= 0) {
+            ::close(unused);
+        }
+    }
+    if (ret < 0) {
+        printf("Failed to receive the handover state: %d (%s)\n", ret,
+                strerror(-ret));
+        return ret;
+    }
+    return 1;
+}
+
+int Handover::listen(const char *path)
+{
+    if (m_server >= 0) {
+        return -EEXIST;
+    }
+
+    sockaddr_un address;
+    int ret = fill_address(path, address);
+    if (ret < 0) {
+        return ret;
+    }
+
+    m_server = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_server < 0) {
+        printf("Failed to create handover socket: %d (%s)\n", -errno,
+                strerror(errno));
+        return -errno;
+    }
+
+    /* Left over by an instance which did not exit cleanly */
+    unlink(path);
+    if (bind(m_server, (sockaddr*)(&address), sizeof(address)) < 0 ||
+            ::listen(m_server, 1) < 0) {
+        printf("Failed to listen on handover socket: %d (%s)\n", -errno,
+                strerror(errno));
+        ret = -errno;
+        close();
+        return ret;
+    }
+    m_path = path;
+
+    return 0;
+}
+
+bool Handover::requested()
+{
+    if (m_server < 0) {
+        return false;
+    }
+    if (m_client < 0) {
+        m_client = accept4(m_server, nullptr, nullptr,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (m_client < 0) {
+            return false;
+        }
+        m_hello_size = 0;
+        m_accepted_ns = ll_monotonic_ns();
+    }
+    if (m_hello_size == sizeof(m_hello)) {
+        return true;
+    }
+
+    /* Sent by the new instance as soon as connected, read over the loop
+     * iterations so that a stray connection does not stall the routing */
+    int ret = 0;
+    ssize_t size = recv(m_client, m_hello + m_hello_size,
+            sizeof(m_hello) - m_hello_size, 0);
+    if (size > 0) {
+        m_hello_size += size;
+    } else if (size == 0) {
+        ret = -ECONNRESET;
+    } else if (errno != EAGAIN && errno != EINTR) {
+        ret = -errno;
+    } else if (ll_monotonic_ns() - m_accepted_ns >
+            HANDOVER_TIMEOUT_MS * 1000000ULL) {
+        ret = -ETIMEDOUT;
+    }
+    if (ret == 0 && m_hello_size < sizeof(m_hello)) {
+        return false;
+    }
+
+    if (ret == 0 && memcmp(m_hello, HANDOVER_MAGIC, 4) != 0) {
+        ret = -EPROTO;
+    }
+    if (ret < 0) {
+        printf("Failed to accept the handover request: %d (%s)\n", ret,
+                strerror(-ret));
+    } else if (m_hello[4] != HANDOVER_VERSION) {
+        printf("Handover refused: new instance version %u, %u expected\n",
+                m_hello[4], HANDOVER_VERSION);
+        uint8_t reply = HANDOVER_NACK;
+        send_all(m_client, &reply, 1);
+        ret = -EPROTO;
+    }
+    if (ret < 0) {
+        ::close(m_client);
+        m_client = -1;
+        return false;
+    }
+
+    /* The state is sent with blocking calls */
+    fcntl(m_client, F_SETFL, fcntl(m_client, F_GETFL) & ~O_NONBLOCK);
+    set_timeout(m_client, SO_RCVTIMEO, HANDOVER_TIMEOUT_MS);
+    set_timeout(m_client, SO_SNDTIMEO, HANDOVER_TIMEOUT_MS);
+    return true;
+}
+
+int Handover::send(const HandoverState &state)
+{
+    if (m_client < 0) {
+        return -ENOTCONN;
+    }
+
+    Writer writer;
+    std::vector<int> fds;
+    serialize(state, writer, fds);
+    if (fds.size() > HANDOVER_MAX_FDS) {
+        return -EMSGSIZE;
+    }
+
+    uint8_t header[HANDOVER_HEADER_SIZE];
+    memcpy(header, HANDOVER_MAGIC, 4);
+    header[4] = HANDOVER_VERSION;
+    header[5] = fds.size();
+    for (size_t i = 0; i < 4; i++) {
+        header[6 + i] = writer.data.size() >> (8 * i);
+    }
+
+    union {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+    } control = {};
+    iovec iov = {header, sizeof(header)};
+    msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buf;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    uint8_t ack = HANDOVER_ACK;
+    int ret = send_all(m_client, &ack, 1);
+    if (ret == 0) {
+        ssize_t size = sendmsg(m_client, &message, MSG_NOSIGNAL);
+        if (size < 0) {
+            ret = -errno;
+        } else {
+            ret = send_all(m_client, header + size, sizeof(header) - size);
+        }
+    }
+    if (ret == 0) {
+        ret = send_all(m_client, writer.data.data(), writer.data.size());
+    }
+
+    /* The new instance may still fail to take the state over */
+    uint8_t reply = HANDOVER_NACK;
+    if (ret == 0) {
+        ret = recv_all(m_client, &reply, 1);
+    }
+    if (ret == 0 && reply != HANDOVER_ACK) {
+        ret = -EPROTO;
+    }
+    if (ret < 0) {
+        printf("Failed to hand the state over: %d (%s)\n", ret,
+                strerror(-ret));
+        return ret;
+    }
+
+    return 0;
+}
+
+void Handover::close()
+{
+    if (m_server >= 0) {
+        ::close(m_server);
+        m_server = -1;
+        unlink(m_path.c_str());
+        m_path.clear();
+    }
+    if (m_client >= 0) {
+        ::close(m_client);
+        m_client = -1;
+    }
+}
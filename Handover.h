@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "LowLevelMessage.h"
+#include "SocketWorker.h"
+#include "Subscriptions.h"
+
+#define HANDOVER_VERSION 3
+#define HANDOVER_TIMEOUT_MS 5000
+#define HANDOVER_HELLO_SIZE 5
+
+/* A client connection handed over to another process */
+struct HandoverClient {
+    HandoverClient();
+
+    int client_id;
+    int fd;
+    SocketWorker::WebSocketState websocket;
+    std::unique_ptr<SocketWorker::ClientSnapshot> connection;
+    Subscriptions::ClientState subscriptions;
+    uint64_t session_token; /* 0: no session */
+    bool session_replay;
+};
+
+/* Everything a running router hands over to the instance replacing it. The
+ * file descriptors it holds are closed by its destructor, unless adopted
+ * (set to -1) in the meantime. */
+struct HandoverState {
+    HandoverState();
+    ~HandoverState();
+    HandoverState(const HandoverState &) = delete;
+    HandoverState &operator=(const HandoverState &) = delete;
+
+    int listen_fd;
+    int websocket_fd;   /* -1 if none */
+    int serial_fd;
+    LowLevelMessage serial_message; /* Incomplete frame */
+    std::vector<LowLevelMessage> serial_frames; /* Not sent to the board yet */
+    std::vector<HandoverClient> clients;
+};
+
+/* Zero-downtime upgrade. An instance started with a handover socket path
+ * first connects to it: if another instance of the same handover version
+ * listens there, it sends its listening sockets, client sockets, serial port
+ * and routing state over the Unix socket (the descriptors with SCM_RIGHTS).
+ * It exits once the new instance acknowledged the state, which then resumes
+ * routing from it and listens at the path in turn, and resumes from the state
+ * itself otherwise. */
+class Handover
+{
+public:
+    Handover();
+    ~Handover();
+
+    /* Returns 1 if the state of a running instance was received, 0 if no
+     * instance listens at path, or a negative error code */
+    int receive(const char *path, HandoverState &state);
+
+    int listen(const char *path);
+
+    /* Non-blocking: true once a new instance of the same version asked for
+     * the state */
+    bool requested();
+
+    /* Send the state to the new instance, which then waits for close().
+     * Returns 0 once the new instance acknowledged it, or a negative error
+     * code: the state is then still owned by the caller */
+    int send(const HandoverState &state);
+    void close();
+
+private:
+    int m_server;
+    int m_client;
+    uint8_t m_hello[HANDOVER_HELLO_SIZE];
+    size_t m_hello_size;
+    uint64_t m_accepted_ns;
+    std::string m_path;
+};
@@ -0,0 +1,84 @@
+#include "LatencyHistogram.h"
+
+#include <cstdio>
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+LatencyHistogram::~LatencyHistogram() = default;
+
+void LatencyHistogram::add(uint64_t value_ns)
+{
+    int bucket = value_ns == 0 ? 0 : 63 - __builtin_clzll(value_ns);
+    if (bucket >= LATENCY_HISTOGRAM_BUCKETS) {
+        bucket = LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value_ns, std::memory_order_relaxed);
+
+    uint64_t min = m_min.load(std::memory_order_relaxed);
+    while (value_ns < min && !m_min.compare_exchange_weak(min, value_ns,
+            std::memory_order_relaxed)) {
+    }
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value_ns > max && !m_max.compare_exchange_weak(max, value_ns,
+            std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (std::atomic<uint64_t> &bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(UINT64_MAX, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::print(const char *name) const
+{
+    uint64_t count = m_count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        printf("  %s: no sample\n", name);
+        return;
+    }
+
+    printf("  %s: %lu samples, min %.1f us, mean %.1f us, max %.1f us\n",
+            name, count, m_min.load(std::memory_order_relaxed) / 1e3,
+            m_sum.load(std::memory_order_relaxed) / 1e3 / count,
+            m_max.load(std::memory_order_relaxed) / 1e3);
+    printf("    p50 < %.1f us, p99 < %.1f us, p99.9 < %.1f us\n",
+            percentile(0.5) / 1e3, percentile(0.99) / 1e3,
+            percentile(0.999) / 1e3);
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        uint64_t n = m_buckets[i].load(std::memory_order_relaxed);
+        if (n > 0) {
+            printf("    < %10.1f us: %lu\n", (double)(2ULL << i) / 1e3, n);
+        }
+    }
+}
+
+/* Upper bound of the bucket holding the percentile */
+uint64_t LatencyHistogram::percentile(double ratio) const
+{
+    uint64_t count = m_count.load(std::memory_order_relaxed);
+    uint64_t rank = (uint64_t)(count * ratio);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return 2ULL << i;
+        }
+    }
+    return m_max.load(std::memory_order_relaxed);
+}
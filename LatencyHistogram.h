@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#define LATENCY_HISTOGRAM_BUCKETS 40
+
+/* Distribution of durations in ns, with power-of-two buckets: bucket i
+ * counts the values in [2^i, 2^(i+1)). add() may be called concurrently
+ * from several threads, and costs a few relaxed atomic operations. */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+    ~LatencyHistogram();
+
+    void add(uint64_t value_ns);
+    void reset();
+
+    uint64_t count() const;
+
+    /* Print count, min, mean, max, percentiles and non-empty buckets */
+    void print(const char *name) const;
+
+private:
+    uint64_t percentile(double ratio) const;
+
+    std::atomic<uint64_t> m_buckets[LATENCY_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_min;
+    std::atomic<uint64_t> m_max;
+};
@@ -0,0 +1,127 @@
+#include "LocalClient.h"
+
+#include <cerrno>
+#include <utility>
+
+LocalClient::LocalClient(size_t queue_size, Callback callback) :
+        m_callback(std::move(callback)),
+        m_to_router(queue_size),
+        m_to_client(queue_size)
+{
+    m_client_id.store(UNKNOWN_CLIENT_ID, std::memory_order_relaxed);
+    m_dropped.store(0, std::memory_order_relaxed);
+    m_truncated.store(0, std::memory_order_relaxed);
+    m_info_truncated = false;
+}
+
+LocalClient::~LocalClient() = default;
+
+int LocalClient::clientId() const
+{
+    return m_client_id.load(std::memory_order_acquire);
+}
+
+int LocalClient::send(uint8_t command, const uint8_t *payload, size_t size)
+{
+    LowLevelMessage msg(LL_MSG_SIDE_SOCKET);
+    int ret = msg.set_frame(command, payload, size);
+    if (ret < 0) {
+        return ret;
+    }
+    return send(msg);
+}
+
+int LocalClient::send(const LowLevelMessage &msg)
+{
+    if (!msg.ready()) {
+        return -EINVAL;
+    }
+
+    /* As the read time of a socket frame */
+    LowLevelMessage sent(msg);
+    sent.set_timestamp(ll_monotonic_ns());
+    if (!m_to_router.emplace(std::move(sent))) {
+        return -EAGAIN;
+    }
+    return 0;
+}
+
+LowLevelMessage *LocalClient::front()
+{
+    return m_to_client.front();
+}
+
+void LocalClient::pop()
+{
+    m_to_client.pop();
+}
+
+size_t LocalClient::dropped() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+size_t LocalClient::truncated() const
+{
+    return m_truncated.load(std::memory_order_relaxed);
+}
+
+void LocalClient::setClientId(int client_id)
+{
+    m_client_id.store(client_id, std::memory_order_release);
+    m_info.clear();
+}
+
+LowLevelMessage *LocalClient::frontSent()
+{
+    return m_to_router.front();
+}
+
+void LocalClient::popSent()
+{
+    m_to_router.pop();
+}
+
+void LocalClient::deliver(const LowLevelMessage &msg)
+{
+    if (m_callback) {
+        m_callback(msg);
+    } else if (!m_to_client.push(msg)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/* Delivered whole once its last piece is received */
+void LocalClient::deliverFragment(const LowLevelInfoFragment &fragment)
+{
+    if (fragment.first) {
+        const uint8_t header[] = {0xFF, (uint8_t)fragment.client_id,
+                fragment.command, 0xFF};
+        m_info.assign(header, header + sizeof(header));
+        m_info_truncated = false;
+    } else if (m_info.empty()) {
+        return;
+    }
+    size_t room = LOCAL_CLIENT_MAX_INFO_SIZE - 1 - m_info.size();
+    size_t size = fragment.size < room ? fragment.size : room;
+    m_info.insert(m_info.end(), fragment.data, fragment.data + size);
+    m_info_truncated |= size < fragment.size;
+    if (!fragment.last) {
+        return;
+    }
+
+    if (m_info_truncated) {
+        m_truncated.fetch_add(1, std::memory_order_relaxed);
+        m_info.push_back('\0');
+    }
+
+    /* Read as a serial frame, which carries its client ID */
+    LowLevelMessage msg(LL_MSG_SIDE_SERIAL);
+    int err = LL_MSG_OK;
+    msg.read_in_place(m_info.data(), m_info.size(), err);
+    msg.set_timestamp(fragment.timestamp_ns);
+    if (msg.ready()) {
+        deliver(msg);
+    }
+    m_info.clear();
+}
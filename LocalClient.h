@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "LowLevelMessage.h"
+#include "SpscQueue.h"
+
+#define LOCAL_CLIENT_DEFAULT_QUEUE_SIZE 1024
+#define LOCAL_CLIENT_MAX_INFO_SIZE (64 * 1024)
+
+/* In-process client of a MessageRouter embedded in the application (see
+ * MessageRouter::attachLocalClient()). It takes a client slot as a socket
+ * client does, and exchanges the same frames with the router, as
+ * LowLevelMessage objects passed through lock-free queues: no socket, no
+ * encoding, no worker thread. Session options, batch records, control
+ * replies and session resumption only apply to socket clients: frames
+ * carry their serial read time in any case.
+ *
+ * The application side (send(), front(), pop()) may be used from one thread
+ * while the router runs in another one. With a callback, the frames for the
+ * client are passed to it from MessageRouter::communicate() instead, in the
+ * router thread, e.g. when the control loop runs the router itself. */
+class LocalClient
+{
+public:
+    typedef std::function<void(const LowLevelMessage &msg)> Callback;
+
+    explicit LocalClient(size_t queue_size = LOCAL_CLIENT_DEFAULT_QUEUE_SIZE,
+            Callback callback = nullptr);
+    ~LocalClient();
+
+    LocalClient(const LocalClient &) = delete;
+    LocalClient &operator=(const LocalClient &) = delete;
+
+    /* Client slot, UNKNOWN_CLIENT_ID while the router is not open */
+    int clientId() const;
+
+    /* Application side: queue a frame for the router, a command or a
+     * control message (see ControlMessage.h). Returns -EAGAIN if the queue
+     * is full */
+    int send(uint8_t command, const uint8_t *payload, size_t size);
+    int send(const LowLevelMessage &msg);
+
+    /* Application side, without callback: oldest frame received, nullptr if
+     * none. When the queue is full, the newest frames are dropped */
+    LowLevelMessage *front();
+    void pop();
+    size_t dropped() const;
+
+    /* Info frames forwarded cut-through are reassembled, truncated to
+     * LOCAL_CLIENT_MAX_INFO_SIZE bytes */
+    size_t truncated() const;
+
+    /* Router side */
+    void setClientId(int client_id);
+    LowLevelMessage *frontSent();
+    void popSent();
+    void deliver(const LowLevelMessage &msg);
+    void deliverFragment(const LowLevelInfoFragment &fragment);
+
+private:
+    std::atomic<int> m_client_id;
+    Callback m_callback;
+    SpscQueue<LowLevelMessage> m_to_router;
+    SpscQueue<LowLevelMessage> m_to_client;
+    std::atomic<size_t> m_dropped;
+    std::atomic<size_t> m_truncated;
+    std::vector<uint8_t> m_info; /* Info frame forwarded cut-through */
+    bool m_info_truncated;
+};
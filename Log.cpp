@@ -0,0 +1,193 @@
+#include "Log.h"
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <unistd.h>
+
+#define LOG_RATE_WINDOW_NS 1000000000ULL
+#define LOG_IDLE_SLEEP_US 10000
+
+/* Bounded multi-producer queue of formatted messages, each slot carrying
+ * the sequence number which tells whether it is free or filled */
+struct LogSlot {
+    std::atomic<size_t> sequence;
+    char text[LOG_MESSAGE_SIZE];
+};
+
+static LogSlot s_slots[LOG_QUEUE_SIZE];
+static std::atomic<size_t> s_enqueue_pos(0);
+static size_t s_dequeue_pos = 0; /* Background thread only */
+static std::atomic<uint32_t> s_dropped(0);
+static std::atomic<LogSite *> s_sites(nullptr);
+static std::atomic<bool> s_running(false);
+static std::thread s_thread;
+
+static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0,
+        "LOG_QUEUE_SIZE must be a power of two");
+
+/* Cheap clock: the rate limit does not need more than ms resolution */
+static uint64_t coarse_ns()
+{
+    timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+LogSite::LogSite(const char *site_file, int site_line) :
+        window_start_ns(0),
+        window_count(0),
+        suppressed(0)
+{
+    file = site_file;
+    line = site_line;
+    next = s_sites.load(std::memory_order_relaxed);
+    while (!s_sites.compare_exchange_weak(next, this,
+            std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+static bool rate_limit(LogSite &site)
+{
+    uint64_t now = coarse_ns();
+    uint64_t start = site.window_start_ns.load(std::memory_order_relaxed);
+    if (now - start >= LOG_RATE_WINDOW_NS &&
+            site.window_start_ns.compare_exchange_strong(start, now,
+                    std::memory_order_relaxed)) {
+        site.window_count.store(0, std::memory_order_relaxed);
+    }
+    if (site.window_count.fetch_add(1, std::memory_order_relaxed) >=
+            LOG_RATE_LIMIT) {
+        site.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+static void enqueue(const char *format, va_list args)
+{
+    size_t pos = s_enqueue_pos.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    while (true) {
+        slot = &s_slots[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == pos) {
+            if (s_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed)) {
+                break;
+            }
+        } else if ((intptr_t)(sequence - pos) < 0) {
+            s_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = s_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void log_message(LogSite &site, const char *format, ...)
+{
+    if (!rate_limit(site)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    if (s_running.load(std::memory_order_acquire)) {
+        enqueue(format, args);
+    } else {
+        vprintf(format, args);
+    }
+    va_end(args);
+}
+
+/* Background thread only */
+static bool drain()
+{
+    bool written = false;
+    while (true) {
+        LogSlot &slot = s_slots[s_dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) !=
+                s_dequeue_pos + 1) {
+            break;
+        }
+        fputs(slot.text, stdout);
+        slot.sequence.store(s_dequeue_pos + LOG_QUEUE_SIZE,
+                std::memory_order_release);
+        s_dequeue_pos++;
+        written = true;
+    }
+    return written;
+}
+
+static void report_suppressed()
+{
+    uint32_t dropped = s_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        printf("Log queue full, %u messages dropped\n", dropped);
+    }
+    for (LogSite *site = s_sites.load(std::memory_order_acquire);
+            site != nullptr; site = site->next) {
+        uint32_t suppressed = site->suppressed.exchange(0,
+                std::memory_order_relaxed);
+        if (suppressed > 0) {
+            const char *file = strrchr(site->file, '/');
+            printf("(%s:%d: %u similar messages suppressed)\n",
+                    file != nullptr ? file + 1 : site->file, site->line,
+                    suppressed);
+        }
+    }
+}
+
+static void run()
+{
+    uint64_t last_report = coarse_ns();
+    while (s_running.load(std::memory_order_acquire)) {
+        bool written = drain();
+        uint64_t now = coarse_ns();
+        if (now - last_report >= LOG_RATE_WINDOW_NS) {
+            report_suppressed();
+            last_report = now;
+            written = true;
+        }
+        if (written) {
+            fflush(stdout);
+        } else {
+            usleep(LOG_IDLE_SLEEP_US);
+        }
+    }
+    drain();
+    report_suppressed();
+    fflush(stdout);
+}
+
+int log_start()
+{
+    if (s_running) {
+        return -EEXIST;
+    }
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        s_slots[i].sequence.store(s_dequeue_pos + i,
+                std::memory_order_relaxed);
+    }
+    s_enqueue_pos.store(s_dequeue_pos, std::memory_order_relaxed);
+    s_running.store(true, std::memory_order_release);
+    s_thread = std::thread(run);
+    return 0;
+}
+
+void log_stop()
+{
+    if (!s_running) {
+        return;
+    }
+    s_running.store(false, std::memory_order_release);
+    s_thread.join();
+}
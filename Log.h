@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#define LOG_QUEUE_SIZE 1024
+#define LOG_MESSAGE_SIZE 240
+#define LOG_RATE_LIMIT 10   /* Messages per second and per call site */
+
+/* Diagnostic messages, written to stdout by a background thread.
+ *
+ * LL_LOG() may be called from any thread. Each call site may emit at most
+ * LOG_RATE_LIMIT messages per second: the others are only counted, and the
+ * background thread prints how many were suppressed. A suppressed message
+ * costs a few atomic operations, no formatting and no system call.
+ * Until log_start() is called, messages are printed synchronously. */
+#define LL_LOG(...) \
+    do { \
+        static LogSite ll_log_site(__FILE__, __LINE__); \
+        log_message(ll_log_site, __VA_ARGS__); \
+    } while (0)
+
+struct LogSite {
+    LogSite(const char *site_file, int site_line);
+
+    const char *file;
+    int line;
+    std::atomic<uint64_t> window_start_ns;
+    std::atomic<uint32_t> window_count;
+    std::atomic<uint32_t> suppressed;
+    LogSite *next;  /* Registered sites, scanned by the background thread */
+};
+
+void log_message(LogSite &site, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+int log_start();
+void log_stop();
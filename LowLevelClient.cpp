@@ -0,0 +1,561 @@
+#include "LowLevelClient.h"
+#include "ControlMessage.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+LowLevelClient::LowLevelClient() :
+        m_rx_message(LL_MSG_SIDE_SOCKET),
+        m_rx_decoded(LL_MSG_SIDE_SOCKET)
+{
+    m_fd = -1;
+    m_rx_state = NONE;
+    m_rx_control = false;
+    m_rx_timestamp = 0;
+    m_rx_timestamp_bytes = 0;
+    m_rx_command = 0;
+    m_rx_length = 0;
+    m_request_count = 0;
+    m_dropped_data = 0;
+    m_options = 0;
+    m_batch_offset = SIZE_MAX;
+}
+
+LowLevelClient::~LowLevelClient()
+{
+    close();
+}
+
+int LowLevelClient::connect(const char *address_string, uint16_t server_port)
+{
+    int ret;
+
+    if (m_fd >= 0) {
+        return -EISCONN;
+    }
+
+    sockaddr_in server_address = {};
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(server_port);
+    ret = inet_pton(AF_INET, address_string, &server_address.sin_addr);
+    if (ret != 1) {
+        return -EINVAL;
+    }
+
+    m_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (m_fd < 0) {
+        return -errno;
+    }
+
+    ret = ::connect(m_fd, (sockaddr*)(&server_address),
+            sizeof(server_address));
+    if (ret < 0) {
+        ret = -errno;
+        close();
+        return ret;
+    }
+
+    /* Small frames must not wait for Nagle's algorithm */
+    int option_value = 1;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &option_value,
+            sizeof(option_value));
+
+    int flags = fcntl(m_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(m_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        ret = -errno;
+        close();
+        return ret;
+    }
+
+    return 0;
+}
+
+int LowLevelClient::close()
+{
+    int ret = 0;
+
+    if (m_fd >= 0) {
+        if (::close(m_fd) < 0) {
+            ret = -errno;
+        }
+        m_fd = -1;
+    }
+    m_rx_message.reset();
+    m_rx_state = NONE;
+    m_rx_timestamp = 0;
+    m_decoder.reset();
+    m_output.clear();
+    m_options = 0;
+    m_batch_offset = SIZE_MAX;
+    m_resume_callbacks.clear();
+
+    /* Pending requests will never get a reply */
+    for (std::deque<Request> &requests : m_requests) {
+        for (Request &request : requests) {
+            if (request.promise) {
+                request.promise->set_exception(std::make_exception_ptr(
+                        std::runtime_error("LowLevelClient closed")));
+            }
+        }
+        requests.clear();
+    }
+    m_request_count = 0;
+
+    return ret;
+}
+
+bool LowLevelClient::isConnected() const
+{
+    return m_fd >= 0;
+}
+
+int LowLevelClient::fd() const
+{
+    return m_fd;
+}
+
+int LowLevelClient::sendCommand(uint8_t command, const uint8_t *payload,
+        size_t size, ReplyCallback callback)
+{
+    LowLevelMessage message(LL_MSG_SIDE_SOCKET);
+    int ret = message.set_frame(command, payload, size);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = queueFrame(message);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (callback) {
+        Request request;
+        request.callback = std::move(callback);
+        m_requests[command].push_back(std::move(request));
+        m_request_count++;
+    }
+    return 0;
+}
+
+std::future<LowLevelMessage> LowLevelClient::sendCommandAsync(uint8_t command,
+        const uint8_t *payload, size_t size)
+{
+    std::shared_ptr<std::promise<LowLevelMessage>> promise =
+            std::make_shared<std::promise<LowLevelMessage>>();
+    std::future<LowLevelMessage> future = promise->get_future();
+
+    LowLevelMessage message(LL_MSG_SIDE_SOCKET);
+    int ret = message.set_frame(command, payload, size);
+    if (ret == 0) {
+        ret = queueFrame(message);
+    }
+    if (ret < 0) {
+        promise->set_exception(std::make_exception_ptr(
+                std::system_error(-ret, std::generic_category())));
+        return future;
+    }
+
+    Request request;
+    request.promise = std::move(promise);
+    m_requests[command].push_back(std::move(request));
+    m_request_count++;
+    return future;
+}
+
+int LowLevelClient::subscribe(const uint8_t *channels, size_t count,
+        bool subscribe)
+{
+    uint8_t payload[1] = {(uint8_t)(subscribe ? LL_CTRL_SUBSCRIBE :
+            LL_CTRL_UNSUBSCRIBE)};
+    return queueControl(channels, count, payload, sizeof(payload));
+}
+
+int LowLevelClient::subscribeDecimated(const uint8_t *channels, size_t count,
+        uint16_t decimation)
+{
+    uint8_t payload[3] = {LL_CTRL_SUBSCRIBE_DECIMATED};
+    ll_ctrl_write_u16(payload + 1, decimation);
+    return queueControl(channels, count, payload, sizeof(payload));
+}
+
+int LowLevelClient::subscribeRate(const uint8_t *channels, size_t count,
+        uint16_t max_rate)
+{
+    uint8_t payload[3] = {LL_CTRL_SUBSCRIBE_RATE};
+    ll_ctrl_write_u16(payload + 1, max_rate);
+    return queueControl(channels, count, payload, sizeof(payload));
+}
+
+int LowLevelClient::subscribeHistory(const uint8_t *channels, size_t count,
+        uint8_t samples, uint16_t max_age_ms)
+{
+    uint8_t payload[4] = {LL_CTRL_SUBSCRIBE_HISTORY, samples};
+    ll_ctrl_write_u16(payload + 2, max_age_ms);
+    return queueControl(channels, count, payload, sizeof(payload));
+}
+
+int LowLevelClient::requestHistory(const uint8_t *channels, size_t count,
+        uint8_t samples, uint16_t max_age_ms)
+{
+    uint8_t payload[4] = {LL_CTRL_HISTORY, samples};
+    ll_ctrl_write_u16(payload + 2, max_age_ms);
+    return queueControl(channels, count, payload, sizeof(payload));
+}
+
+int LowLevelClient::setSessionOptions(uint8_t options)
+{
+    uint8_t channel = 0;
+    uint8_t payload[2] = {LL_CTRL_SESSION_OPTIONS, options};
+    int ret = queueControl(&channel, 1, payload, sizeof(payload));
+    if (ret == 0) {
+        m_options = options;
+    }
+    return ret;
+}
+
+int LowLevelClient::resumeSession(uint64_t token, bool replay,
+        ResumeCallback callback)
+{
+    uint8_t channel = 0;
+    uint8_t payload[10] = {LL_CTRL_RESUME_SESSION};
+    ll_ctrl_write_u64(payload + 1, token);
+    payload[9] = replay ? LL_RESUME_REPLAY : 0;
+    int ret = queueControl(&channel, 1, payload, sizeof(payload));
+    if (ret == 0) {
+        m_resume_callbacks.push_back(std::move(callback));
+    }
+    return ret;
+}
+
+void LowLevelClient::setUnsolicitedCallback(ReplyCallback callback)
+{
+    m_unsolicited_callback = std::move(callback);
+}
+
+int LowLevelClient::poll(int timeout_ms)
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+
+    int ret = flush();
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (timeout_ms != 0) {
+        pollfd pfd = {};
+        pfd.fd = m_fd;
+        pfd.events = POLLIN | (m_output.empty() ? 0 : POLLOUT);
+        ret = ::poll(&pfd, 1, timeout_ms);
+        if (ret < 0) {
+            return errno == EINTR ? 0 : -errno;
+        } else if (ret == 0) {
+            return 0;
+        }
+        if (pfd.revents & POLLOUT) {
+            ret = flush();
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
+    return readSocket();
+}
+
+size_t LowLevelClient::receiveData(DataSample *samples, size_t max_count)
+{
+    if (samples == nullptr) {
+        return 0;
+    }
+
+    size_t count = std::min(max_count, m_data.size());
+    std::copy(m_data.begin(), m_data.begin() + count, samples);
+    m_data.erase(m_data.begin(), m_data.begin() + count);
+    return count;
+}
+
+size_t LowLevelClient::pendingData() const
+{
+    return m_data.size();
+}
+
+size_t LowLevelClient::pendingRequests() const
+{
+    return m_request_count;
+}
+
+size_t LowLevelClient::droppedData() const
+{
+    return m_dropped_data;
+}
+
+int LowLevelClient::queueFrame(const LowLevelMessage &message)
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+
+    beginRecord(message.get_payload_size() + 3);
+    size_t offset = m_output.size();
+    m_output.resize(offset + message.get_payload_size() + 3);
+    ssize_t size = message.get_frame_without_cid(m_output.data() + offset,
+            m_output.size() - offset);
+    if (size < 0) {
+        m_output.resize(offset);
+        endRecord();
+        return size;
+    }
+    m_output.resize(offset + size);
+    endRecord();
+    return 0;
+}
+
+int LowLevelClient::queueControl(const uint8_t *channels, size_t count,
+        const uint8_t *payload, size_t size)
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+    if (channels == nullptr && count > 0) {
+        return -EFAULT;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (channels[i] >= DATA_CHANNEL_COUNT) {
+            return -EINVAL;
+        }
+    }
+
+    /* The messages of every channel go out in a single flush */
+    m_output.reserve(m_output.size() + (size + 3) * count);
+    for (size_t i = 0; i < count; i++) {
+        uint8_t header[3] = {0xFF, channels[i], (uint8_t)size};
+        beginRecord(size + 3);
+        m_output.insert(m_output.end(), header, header + sizeof(header));
+        m_output.insert(m_output.end(), payload, payload + size);
+        endRecord();
+    }
+    return 0;
+}
+
+void LowLevelClient::beginRecord(size_t size)
+{
+    if (!(m_options & LL_SESSION_BATCH)) {
+        return;
+    }
+    if (m_batch_offset == SIZE_MAX || m_output.size() - m_batch_offset -
+            LL_BATCH_HEADER_SIZE + size > LL_BATCH_MAX_SIZE) {
+        m_batch_offset = m_output.size();
+        m_output.resize(m_output.size() + LL_BATCH_HEADER_SIZE);
+    }
+}
+
+void LowLevelClient::endRecord()
+{
+    if (m_batch_offset != SIZE_MAX && (m_options & LL_SESSION_BATCH)) {
+        ll_write_batch_header(m_output.data() + m_batch_offset,
+                m_output.size() - m_batch_offset - LL_BATCH_HEADER_SIZE);
+    }
+}
+
+int LowLevelClient::flush()
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+
+    /* Commands queued from now on go to the next batch */
+    m_batch_offset = SIZE_MAX;
+
+    size_t nb_bytes_sent = 0;
+    while (nb_bytes_sent < m_output.size()) {
+        ssize_t ret = send(m_fd, m_output.data() + nb_bytes_sent,
+                m_output.size() - nb_bytes_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            int err = -errno;
+            close();
+            return err;
+        } else if (ret == 0) {
+            close();
+            return -ENOTCONN;
+        }
+        nb_bytes_sent += ret;
+    }
+    m_output.erase(m_output.begin(), m_output.begin() + nb_bytes_sent);
+    return 0;
+}
+
+int LowLevelClient::readSocket()
+{
+    int nb_frames = 0;
+
+    while (m_fd >= 0) {
+        ssize_t size = recv(m_fd, m_buffer, sizeof(m_buffer), MSG_DONTWAIT);
+        if (size == 0) {
+            close();
+            return -ENOTCONN;
+        } else if (size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            int err = -errno;
+            close();
+            return err;
+        }
+
+        for (ssize_t i = 0; i < size; i++) {
+            appendByte(m_buffer[i], nb_frames);
+        }
+
+        if ((size_t)size < sizeof(m_buffer)) {
+            break;
+        }
+    }
+
+    return nb_frames;
+}
+
+void LowLevelClient::appendByte(uint8_t byte, int &nb_frames)
+{
+    switch (m_rx_state) {
+        case NONE: {
+            int ret = m_rx_message.append_byte(byte);
+            if (ret == LL_MSG_HEADER_ERR &&
+                    (byte == LL_COMPRESSED_HEADER_BYTE ||
+                    byte == LL_CTRL_REPLY_HEADER_BYTE)) {
+                m_rx_control = byte == LL_CTRL_REPLY_HEADER_BYTE;
+                m_rx_state = COMMAND;
+            } else if (ret == LL_MSG_HEADER_ERR &&
+                    byte == LL_BATCH_HEADER_BYTE) {
+                /* The records of a batch are parsed as usual */
+                m_rx_length = LL_BATCH_HEADER_SIZE - 1;
+                m_rx_state = BATCH;
+            } else if (ret == LL_MSG_HEADER_ERR &&
+                    byte == LL_TIMESTAMP_HEADER_BYTE) {
+                m_rx_timestamp = 0;
+                m_rx_timestamp_bytes = 0;
+                m_rx_state = TIMESTAMP;
+            } else if (m_rx_message.ready()) {
+                m_decoder.update(m_rx_message);
+                m_rx_message.set_timestamp(m_rx_timestamp);
+                m_rx_timestamp = 0;
+                dispatch(m_rx_message);
+                m_rx_message.reset();
+                nb_frames++;
+            }
+            return;
+        }
+        case TIMESTAMP:
+            m_rx_timestamp |= (uint64_t)byte << (8 * m_rx_timestamp_bytes);
+            if (++m_rx_timestamp_bytes == LL_TIMESTAMP_RECORD_SIZE - 1) {
+                m_rx_state = NONE;
+            }
+            return;
+        case BATCH:
+            if (--m_rx_length == 0) {
+                m_rx_state = NONE;
+            }
+            return;
+        case COMMAND:
+            m_rx_command = byte;
+            m_rx_state = LENGTH;
+            return;
+        case LENGTH:
+            m_rx_length = byte;
+            m_rx_body.clear();
+            m_rx_state = BODY;
+            if (m_rx_length > 0) {
+                return;
+            }
+            break;
+        case BODY:
+            m_rx_body.push_back(byte);
+            if (m_rx_body.size() < m_rx_length) {
+                return;
+            }
+            break;
+        default:
+            return;
+    }
+
+    m_rx_state = NONE;
+    if (m_rx_control) {
+        dispatchControlReply();
+        return;
+    }
+
+    /* Complete compressed frame */
+    if (m_decoder.decode(m_rx_command, m_rx_body.data(), m_rx_body.size(),
+            m_rx_decoded) == 0) {
+        m_rx_decoded.set_timestamp(m_rx_timestamp);
+        dispatch(m_rx_decoded);
+        nb_frames++;
+    }
+    m_rx_timestamp = 0;
+}
+
+void LowLevelClient::dispatchControlReply()
+{
+    if (m_rx_command != LL_CTRL_RESUME_SESSION || m_rx_body.size() < 6 ||
+            m_resume_callbacks.empty()) {
+        return;
+    }
+    ResumeCallback callback = std::move(m_resume_callbacks.front());
+    m_resume_callbacks.pop_front();
+    if (callback) {
+        callback(m_rx_body[0], m_rx_body[1],
+                ll_ctrl_read_u16(m_rx_body.data() + 2),
+                ll_ctrl_read_u16(m_rx_body.data() + 4));
+    }
+}
+
+void LowLevelClient::dispatch(const LowLevelMessage &message)
+{
+    uint8_t command = message.get_command();
+
+    if (message.is_data_channel_msg()) {
+        if (m_data.size() >= LL_CLIENT_DATA_QUEUE_SIZE) {
+            m_data.pop_front();
+            m_dropped_data++;
+        }
+        m_data.emplace_back();
+        DataSample &sample = m_data.back();
+        sample.channel = command;
+        sample.timestamp_ns = message.get_timestamp();
+        sample.size = std::min(message.get_payload_size(),
+                (size_t)LL_CLIENT_MAX_PAYLOAD);
+        memcpy(sample.payload, message.get_payload(), sample.size);
+        return;
+    }
+
+    std::deque<Request> &requests = m_requests[command];
+    if (requests.empty()) {
+        if (m_unsolicited_callback) {
+            m_unsolicited_callback(message);
+        }
+        return;
+    }
+
+    Request request = std::move(requests.front());
+    requests.pop_front();
+    m_request_count--;
+    if (request.callback) {
+        request.callback(message);
+    }
+    if (request.promise) {
+        request.promise->set_value(message);
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+#include "LowLevelMessage.h"
+#include "TelemetryCodec.h"
+
+#define LL_CLIENT_BUFFER_SIZE 4096
+#define LL_CLIENT_DATA_QUEUE_SIZE 4096
+#define LL_CLIENT_MAX_PAYLOAD 255
+
+/* Client side of the LowLevelServer protocol.
+ *
+ * All calls are non-blocking except connect(). Commands are appended to an
+ * output buffer, which is written by flush() or poll() in as few send() calls
+ * as possible, and pipelined: any number of them may be in flight. Replies
+ * are matched to requests in submission order, per command ID: the first
+ * frame received with the same command ID completes the oldest request.
+ *
+ * The object is not thread-safe: callbacks are run and futures are fulfilled
+ * from poll(), which must be called from the thread owning the client. */
+class LowLevelClient
+{
+public:
+    typedef std::function<void(const LowLevelMessage &reply)> ReplyCallback;
+
+    /* Reply to resumeSession(): LowLevelResumeStatus, client slot, number of
+     * frames replayed right after, and of frames lost while disconnected */
+    typedef std::function<void(uint8_t status, uint8_t client_id,
+            uint16_t replayed, uint16_t lost)> ResumeCallback;
+
+    struct DataSample {
+        uint8_t channel;
+        /* Time at which the server read the sample (see
+         * LL_SESSION_TIMESTAMPS), 0 if the option is disabled */
+        uint64_t timestamp_ns;
+        size_t size;
+        uint8_t payload[LL_CLIENT_MAX_PAYLOAD];
+    };
+
+    LowLevelClient();
+    ~LowLevelClient();
+
+    int connect(const char *address_string, uint16_t server_port);
+    int close();
+    bool isConnected() const;
+
+    /* Socket file descriptor, to integrate the client in an event loop */
+    int fd() const;
+
+    /* Queue a command. The callback, if any, is called with the reply */
+    int sendCommand(uint8_t command, const uint8_t *payload, size_t size,
+            ReplyCallback callback = nullptr);
+    std::future<LowLevelMessage> sendCommandAsync(uint8_t command,
+            const uint8_t *payload, size_t size);
+
+    /* Queue the subscription messages of several channels at once */
+    int subscribe(const uint8_t *channels, size_t count, bool subscribe = true);
+
+    /* Subscribe and receive only 1 sample out of decimation, or at most
+     * max_rate samples per second (0: no limit) */
+    int subscribeDecimated(const uint8_t *channels, size_t count,
+            uint16_t decimation);
+    int subscribeRate(const uint8_t *channels, size_t count,
+            uint16_t max_rate);
+
+    /* Subscribe (or not) and get at once up to samples past samples of each
+     * channel no older than max_age_ms (0: no limit) */
+    int subscribeHistory(const uint8_t *channels, size_t count,
+            uint8_t samples, uint16_t max_age_ms = 0);
+    int requestHistory(const uint8_t *channels, size_t count,
+            uint8_t samples, uint16_t max_age_ms = 0);
+
+    /* Negotiate LowLevelSessionOption flags (see ControlMessage.h). With
+     * LL_SESSION_TIMESTAMPS, the server receive time of replies is available
+     * through LowLevelMessage::get_timestamp(). With LL_SESSION_BATCH, the
+     * commands queued between two flushes are also sent as batch records */
+    int setSessionOptions(uint8_t options);
+
+    /* Bind the connection to the session token, chosen by the application
+     * and kept across reconnects. Resuming a session restores the client
+     * slot, subscriptions and session options of the previous connection,
+     * and with replay, the frames it missed in the meantime */
+    int resumeSession(uint64_t token, bool replay = true,
+            ResumeCallback callback = nullptr);
+
+    /* Frames which do not match any pending request (e.g. info frames) */
+    void setUnsolicitedCallback(ReplyCallback callback);
+
+    /* Send as much of the queued commands as the socket accepts */
+    int flush();
+
+    /* Send the queued commands and process the received frames, waiting at
+     * most timeout_ms for the socket to be ready (0: do not wait).
+     * Returns the number of frames received, or a negative error code */
+    int poll(int timeout_ms = 0);
+
+    /* Copy at most max_count received data-channel samples into samples.
+     * Returns the number of samples copied. When the internal queue is full,
+     * the oldest samples are dropped */
+    size_t receiveData(DataSample *samples, size_t max_count);
+    size_t pendingData() const;
+    size_t pendingRequests() const;
+    size_t droppedData() const;
+
+private:
+    int queueFrame(const LowLevelMessage &message);
+    int queueControl(const uint8_t *channels, size_t count,
+            const uint8_t *payload, size_t size);
+    void beginRecord(size_t size);
+    void endRecord();
+    int readSocket();
+    void appendByte(uint8_t byte, int &nb_frames);
+    void dispatch(const LowLevelMessage &message);
+    void dispatchControlReply();
+
+    struct Request {
+        ReplyCallback callback;
+        std::shared_ptr<std::promise<LowLevelMessage>> promise;
+    };
+
+    /* Records which are not regular frames */
+    enum RecordReadState {
+        NONE, COMMAND, LENGTH, BODY, TIMESTAMP, BATCH
+    };
+
+    int m_fd;
+    LowLevelMessage m_rx_message;
+    LowLevelMessage m_rx_decoded;
+    RecordReadState m_rx_state;
+    bool m_rx_control; /* Record is a control reply, not a compressed frame */
+    uint64_t m_rx_timestamp;
+    size_t m_rx_timestamp_bytes;
+    uint8_t m_rx_command;
+    size_t m_rx_length;
+    std::vector<uint8_t> m_rx_body;
+    TelemetryDecoder m_decoder;
+    std::vector<uint8_t> m_output;
+    uint8_t m_options;
+    size_t m_batch_offset; /* Of the open batch in m_output, SIZE_MAX if none */
+    std::deque<Request> m_requests[256];
+    size_t m_request_count;
+    std::deque<DataSample> m_data;
+    size_t m_dropped_data;
+    ReplyCallback m_unsolicited_callback;
+    std::deque<ResumeCallback> m_resume_callbacks;
+    uint8_t m_buffer[LL_CLIENT_BUFFER_SIZE];
+};
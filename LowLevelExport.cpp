@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "Capture.h"
+#include "Config.h"
+#include "TelemetryExporter.h"
+
+/* Convert the data-channel frames of a capture file (see Capture.h) into a
+ * columnar file (see TelemetryExporter.h), using the channel_schema entries
+ * of a LowLevelServer config file */
+int main(int argc, char *argv[])
+{
+    int ret;
+    const char *config_file = nullptr;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config_file = optarg;
+                break;
+            default: /* '?' */
+                config_file = nullptr;
+                optind = argc;
+                break;
+        }
+    }
+    if (config_file == nullptr || argc - optind != 2) {
+        printf("Usage: %s -c config file capture.llc output.llcol\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *capture_file = argv[optind];
+    const char *output_file = argv[optind + 1];
+
+    Config config;
+    TelemetryExporter exporter;
+    ret = config.load(config_file);
+    if (ret == 0) {
+        ret = exporter.configure(config);
+    }
+    if (ret < 0 || !exporter.hasSchema()) {
+        printf("Invalid config file '%s' (channel_schema required)\n",
+                config_file);
+        exit(EXIT_FAILURE);
+    }
+
+    CaptureReader reader;
+    ret = reader.open(capture_file);
+    if (ret < 0) {
+        printf("Failed to open capture file '%s': %d (%s)\n", capture_file,
+                ret, strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    ret = exporter.open(output_file, reader.startWallClockUs(),
+            reader.startMonotonicUs());
+    if (ret < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    LowLevelMessage message(LL_MSG_SIDE_SERIAL);
+    CaptureSource source;
+    uint64_t timestamp_us;
+    size_t samples = 0;
+    while ((ret = reader.next(message, source, timestamp_us)) > 0) {
+        if (source == CAPTURE_SOURCE_SERIAL && message.is_data_channel_msg()) {
+            exporter.write(message, timestamp_us);
+            samples++;
+        }
+    }
+    if (ret < 0) {
+        printf("Capture file truncated or corrupted: %d (%s)\n", ret,
+                strerror(-ret));
+    }
+
+    if (exporter.close() < 0) {
+        printf("Failed to write '%s'\n", output_file);
+        exit(EXIT_FAILURE);
+    }
+    printf("%lu data-channel samples read, %lu not matching their schema\n",
+            samples, exporter.skipped());
+    return 0;
+}
@@ -1,10 +1,21 @@
 #include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
 #include "LowLevelMessage.h"
+#include "LowLevelProtocol.h"
 
 #define HEADER_BYTE (0xFF)
 #define INFO_FRAME_LENGTH (0xFF)
 #define BROADCAST_CLIENT_ID (0xFE)
 
+uint64_t ll_monotonic_ns()
+{
+    timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 LowLevelMessage::LowLevelMessage(LowLevelMessageSide msg_side)
 {
     switch (msg_side) {
@@ -18,6 +29,7 @@ LowLevelMessage::LowLevelMessage(LowLevelMessageSide msg_side)
             throw std::invalid_argument("MSG_SIDE");
     }
     m_client_id = UNKNOWN_CLIENT_ID;
+    m_timestamp_ns = 0;
     m_read_state = HEADER;
     m_payload_length = 0;
     m_read_until_eof = false;
@@ -51,18 +63,32 @@ int LowLevelMessage::append_byte(uint8_t byte)
                 ret = LL_MSG_CLIENT_ID_ERR;
             }
             break;
-        case COMMAND:
+        case COMMAND: {
+            /* Clients send control messages on data channels */
+            uint8_t direction = m_read_client_id ? LL_DIR_FROM_BOARD :
+                    LL_DIR_TO_BOARD;
             if (byte < DATA_CHANNEL_COUNT) {
                 m_data_channel_msg = true;
                 m_data_channel = byte;
+            } else if (!(ll_command_spec(byte).direction & direction)) {
+                ret = LL_MSG_COMMAND_ERR;
+                break;
             }
             m_frame.push_back(byte);
             m_read_state = LENGTH;
             break;
-        case LENGTH:
-            if (byte > INFO_FRAME_LENGTH) {
+        }
+        case LENGTH: {
+            int16_t expected = ll_command_spec(m_frame.front()).payload_size;
+            if (expected == LL_SIZE_INFO && byte != INFO_FRAME_LENGTH) {
+                ret = LL_MSG_SIZE_ERR;
+            } else if (expected >= 0 && byte != expected &&
+                    !(m_data_channel_msg && !m_read_client_id)) {
                 ret = LL_MSG_SIZE_ERR;
             } else {
+                if (byte != INFO_FRAME_LENGTH) {
+                    m_frame.reserve(byte + 2);
+                }
                 m_frame.push_back(byte);
                 if (byte == INFO_FRAME_LENGTH) {
                     m_payload_length = 0;
@@ -79,6 +105,7 @@ int LowLevelMessage::append_byte(uint8_t byte)
                 }
             }
             break;
+        }
         case PAYLOAD:
             m_frame.push_back(byte);
             if (m_read_until_eof) {
@@ -103,16 +130,115 @@ int LowLevelMessage::append_byte(uint8_t byte)
     return ret;
 }
 
+size_t LowLevelMessage::append_bytes(const uint8_t *data, size_t size,
+        int &err)
+{
+    size_t i = 0;
+    err = LL_MSG_OK;
+
+    while (i < size && err == LL_MSG_OK && m_read_state != FULL) {
+        if (m_read_state != PAYLOAD) {
+            err = append_byte(data[i++]);
+            continue;
+        }
+
+        /* Bulk copy of the payload */
+        size_t n;
+        if (m_read_until_eof) {
+            const void *eof = memchr(data + i, '\0', size - i);
+            n = eof == nullptr ? size - i :
+                    (const uint8_t *)eof - (data + i) + 1;
+            m_frame.append(data + i, data + i + n);
+            if (eof != nullptr) {
+                m_read_state = FULL;
+            }
+        } else {
+            size_t missing = m_payload_length + 2 - m_frame.size();
+            n = missing < size - i ? missing : size - i;
+            m_frame.append(data + i, data + i + n);
+            if (n == missing) {
+                m_read_state = FULL;
+            }
+        }
+        i += n;
+    }
+
+    return i;
+}
+
+size_t LowLevelMessage::read_in_place(const uint8_t *data, size_t size,
+        int &err)
+{
+    reset();
+    err = LL_MSG_OK;
+
+    /* Header, client ID, command and length */
+    size_t i = 0;
+    while (i < size && m_read_state != PAYLOAD && m_read_state != FULL) {
+        err = append_byte(data[i++]);
+        if (err != LL_MSG_OK) {
+            return i;
+        }
+    }
+    if (m_read_state != PAYLOAD && m_read_state != FULL) {
+        reset();
+        return 0;
+    }
+
+    size_t body = i - 2;
+    size_t end = i;
+    if (m_read_state == PAYLOAD && m_read_until_eof) {
+        const void *eof = memchr(data + i, '\0', size - i);
+        if (eof == nullptr) {
+            reset();
+            return 0;
+        }
+        end = (const uint8_t *)eof - data + 1;
+    } else if (m_read_state == PAYLOAD) {
+        end = i + m_payload_length;
+        if (end > size) {
+            reset();
+            return 0;
+        }
+    }
+
+    m_frame.borrow(data + body, end - body);
+    m_read_state = FULL;
+    return end;
+}
+
+size_t LowLevelMessage::read_info_header(const uint8_t *data, size_t size)
+{
+    reset();
+    size_t i = 0;
+    while (i < size && m_read_state != PAYLOAD && m_read_state != FULL) {
+        if (append_byte(data[i++]) != LL_MSG_OK) {
+            return 0;
+        }
+    }
+    if (m_read_state != PAYLOAD || !m_read_until_eof) {
+        reset();
+        return 0;
+    }
+    return i;
+}
+
 bool LowLevelMessage::ready() const
 {
     return m_read_state == FULL;
 }
 
+bool LowLevelMessage::empty() const
+{
+    return m_read_state == HEADER;
+}
+
 void LowLevelMessage::reset()
 {
     if (m_read_client_id) {
         m_client_id = UNKNOWN_CLIENT_ID;
     }
+    m_timestamp_ns = 0;
     m_frame.clear();
     m_read_state = HEADER;
     m_payload_length = 0;
@@ -133,6 +259,16 @@ int LowLevelMessage::get_client_id() const
     return m_client_id;
 }
 
+void LowLevelMessage::set_timestamp(uint64_t timestamp_ns)
+{
+    m_timestamp_ns = timestamp_ns;
+}
+
+uint64_t LowLevelMessage::get_timestamp() const
+{
+    return m_timestamp_ns;
+}
+
 bool LowLevelMessage::is_broadcast() const
 {
     return m_client_id == BROADCAST_CLIENT_ID;
@@ -148,19 +284,91 @@ unsigned int LowLevelMessage::get_data_channel() const
     return m_data_channel;
 }
 
-int LowLevelMessage::is_subscription_msg(bool &subscribe) const
+uint8_t LowLevelMessage::get_command() const
 {
-    if (m_read_client_id || !m_data_channel_msg) {
-        return -1;
+    if (m_frame.empty()) {
+        return 0;
     }
-    if (m_frame.size() != 3) {
-        return -1;
+    return m_frame.front();
+}
+
+bool LowLevelMessage::is_info_frame() const
+{
+    return m_read_until_eof;
+}
+
+size_t LowLevelMessage::get_payload_size() const
+{
+    if (m_frame.size() < 2) {
+        return 0;
+    }
+    return m_frame.size() - 2;
+}
+
+const uint8_t *LowLevelMessage::get_payload() const
+{
+    if (m_frame.size() < 2) {
+        return nullptr;
+    }
+    return m_frame.data() + 2;
+}
+
+int LowLevelMessage::set_frame(uint8_t command, const uint8_t *payload,
+        size_t size)
+{
+    if (size >= INFO_FRAME_LENGTH) {
+        return -EMSGSIZE;
+    }
+    if (payload == nullptr && size > 0) {
+        return -EFAULT;
+    }
+
+    int client_id = m_client_id;
+    reset();
+    m_client_id = client_id;
+    if (command < DATA_CHANNEL_COUNT) {
+        m_data_channel_msg = true;
+        m_data_channel = command;
+    }
+    m_frame.reserve(size + 2);
+    m_frame.push_back(command);
+    m_frame.push_back((uint8_t)size);
+    m_frame.append(payload, payload + size);
+    m_payload_length = size;
+    m_read_state = FULL;
+    return 0;
+}
+
+int LowLevelMessage::set_info_frame(uint8_t command, const char *text)
+{
+    if (text == nullptr) {
+        return -EFAULT;
     }
 
-    subscribe = m_frame.at(2);
+    int client_id = m_client_id;
+    reset();
+    m_client_id = client_id;
+    if (command < DATA_CHANNEL_COUNT) {
+        m_data_channel_msg = true;
+        m_data_channel = command;
+    }
+    size_t length = strlen(text) + 1;
+    m_frame.reserve(length + 2);
+    m_frame.push_back(command);
+    m_frame.push_back(INFO_FRAME_LENGTH);
+    m_frame.append((const uint8_t *)text,
+            (const uint8_t *)text + length);
+    m_read_until_eof = true;
+    m_read_state = FULL;
     return 0;
 }
 
+bool LowLevelMessage::is_control_msg() const
+{
+    /* Data channels only go from the board to the clients */
+    return !m_read_client_id && m_data_channel_msg;
+}
+
 ssize_t LowLevelMessage::get_frame_with_cid(uint8_t *buf, size_t size) const
 {
     if (buf == nullptr) {
@@ -201,6 +409,29 @@ ssize_t LowLevelMessage::get_frame_without_cid(uint8_t *buf, size_t size) const
     }
 }
 
+ssize_t LowLevelMessage::get_received_bytes(uint8_t *buf, size_t size) const
+{
+    if (buf == nullptr) {
+        return -EFAULT;
+    }
+    if (m_read_state == HEADER) {
+        return 0;
+    }
+
+    bool with_cid = m_read_client_id && m_read_state != CLIENT;
+    size_t total = 1 + (with_cid ? 1 : 0) + m_frame.size();
+    if (size < total) {
+        return -ENOBUFS;
+    }
+    size_t i = 0;
+    buf[i++] = HEADER_BYTE;
+    if (with_cid) {
+        buf[i++] = m_client_id;
+    }
+    memcpy(buf + i, m_frame.data(), m_frame.size());
+    return total;
+}
+
 ssize_t LowLevelMessage::get_frame_body(uint8_t *buf, size_t size) const
 {
     if (!ready()) {
@@ -209,9 +440,7 @@ ssize_t LowLevelMessage::get_frame_body(uint8_t *buf, size_t size) const
     if (size < m_frame.size()) {
         return -EMSGSIZE;
     }
-    for (size_t i = 0; i < m_frame.size(); i++) {
-        buf[i] = m_frame.at(i);
-    }
+    memcpy(buf, m_frame.data(), m_frame.size());
 
     return m_frame.size();
 }
@@ -229,6 +458,8 @@ const char *LowLevelMessage::str_error(int err_code)
             return "LL_MSG Invalid client ID";
         case LL_MSG_SIZE_ERR:
             return "LL_MSG Invalid size";
+        case LL_MSG_COMMAND_ERR:
+            return "LL_MSG Invalid command";
         default:
             return "LL_MSG Unknown error";
     }
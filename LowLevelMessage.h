@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <utility>
 #include <vector>
 #include <sys/types.h>
 
@@ -13,6 +14,7 @@ enum LowLevelMessageErr {
     LL_MSG_HEADER_ERR = 2,
     LL_MSG_CLIENT_ID_ERR = 3,
     LL_MSG_SIZE_ERR = 4,
+    LL_MSG_COMMAND_ERR = 5,
 };
 
 enum LowLevelMessageSide {
@@ -20,6 +22,21 @@ enum LowLevelMessageSide {
     LL_MSG_SIDE_SERIAL, /* Client ID included in the input frame */
 };
 
+uint64_t ll_monotonic_ns();
+
+/* Piece of an info frame forwarded before its end is received (see
+ * SerialInterface.h): the payload bytes received meanwhile, the last piece
+ * ending with the '\0' terminator */
+struct LowLevelInfoFragment {
+    int client_id;
+    uint8_t command;
+    bool first;
+    bool last;
+    uint64_t timestamp_ns;  /* At which the start of the frame was read */
+    const uint8_t *data;
+    size_t size;
+};
+
 class LowLevelMessage
 {
 public:
@@ -27,20 +44,62 @@ public:
     ~LowLevelMessage();
 
     int append_byte(uint8_t byte);
+
+    /* Append bytes until the frame is complete or an error occurs. Returns
+     * the number of bytes consumed, err receives the result of the last one.
+     * Payloads are copied in bulk. */
+    size_t append_bytes(const uint8_t *data, size_t size, int &err);
+
+    /* Read a complete frame at the start of data without copying it: the
+     * message then borrows data, which must stay valid and unchanged while
+     * the message is in use. Copies of the message own their bytes.
+     * Returns the number of bytes consumed, 0 if data only holds the start
+     * of a frame (the message is then left reset), or the bytes to skip if
+     * err reports an invalid byte. */
+    size_t read_in_place(const uint8_t *data, size_t size, int &err);
+
+    /* Read the header (up to the 0xFF length byte) of an info frame at the
+     * start of data: get_client_id() and get_command() are then valid, but
+     * not ready(). Returns the header size, 0 if data does not start with a
+     * complete info frame header (the message is then left reset). */
+    size_t read_info_header(const uint8_t *data, size_t size);
     bool ready() const;
     void reset();
 
+    /* True if no byte was appended since the last reset */
+    bool empty() const;
+
     void set_client_id(int client_id);
     int get_client_id() const;
+
+    /* CLOCK_MONOTONIC time (ns) at which the last byte of the frame was
+     * read from its source, 0 if unknown */
+    void set_timestamp(uint64_t timestamp_ns);
+    uint64_t get_timestamp() const;
     bool is_broadcast() const;
 
     bool is_data_channel_msg() const;
     unsigned int get_data_channel() const;
-    int is_subscription_msg(bool &subscribe) const;
+    bool is_control_msg() const;
+
+    /* Frame content accessors, only meaningful when ready() is true */
+    uint8_t get_command() const;
+    bool is_info_frame() const;
+    size_t get_payload_size() const;
+    const uint8_t *get_payload() const;
+
+    /* Build a complete frame. Payloads of 0xFF bytes or more must be sent as
+     * info frames, whose payload is a '\0'-terminated string */
+    int set_frame(uint8_t command, const uint8_t *payload, size_t size);
+    int set_info_frame(uint8_t command, const char *text);
 
     ssize_t get_frame_with_cid(uint8_t *buf, size_t size) const;
     ssize_t get_frame_without_cid(uint8_t *buf, size_t size) const;
 
+    /* Bytes appended since the last reset, e.g. of an incomplete frame.
+     * Appending them to a reset message restores its reading state */
+    ssize_t get_received_bytes(uint8_t *buf, size_t size) const;
+
     static const char *str_error(int err_code);
 
 private:
@@ -48,9 +107,96 @@ private:
 
     bool m_read_client_id;
     int m_client_id;
+    uint64_t m_timestamp_ns;
+
+    /* Frame bytes, owned or borrowed (see read_in_place()). Copying a
+     * borrowed frame copies its bytes. */
+    class FrameBody
+    {
+    public:
+        FrameBody() : m_view(nullptr), m_view_size(0) {}
+        FrameBody(const FrameBody &other) :
+                m_bytes(other.data(), other.data() + other.size()),
+                m_view(nullptr), m_view_size(0) {}
+        FrameBody &operator=(const FrameBody &other)
+        {
+            if (this != &other) {
+                m_bytes.assign(other.data(), other.data() + other.size());
+                m_view = nullptr;
+                m_view_size = 0;
+            }
+            return *this;
+        }
+        FrameBody(FrameBody &&other) noexcept :
+                m_bytes(std::move(other.m_bytes)),
+                m_view(nullptr), m_view_size(0)
+        {
+            if (other.m_view != nullptr) {
+                m_bytes.assign(other.m_view, other.m_view + other.m_view_size);
+            }
+        }
+        FrameBody &operator=(FrameBody &&other) noexcept
+        {
+            if (other.m_view != nullptr) {
+                m_bytes.assign(other.m_view, other.m_view + other.m_view_size);
+            } else {
+                m_bytes = std::move(other.m_bytes);
+            }
+            m_view = nullptr;
+            m_view_size = 0;
+            return *this;
+        }
+
+        const uint8_t *data() const
+        {
+            return m_view != nullptr ? m_view : m_bytes.data();
+        }
+        size_t size() const
+        {
+            return m_view != nullptr ? m_view_size : m_bytes.size();
+        }
+        bool empty() const
+        {
+            return size() == 0;
+        }
+        uint8_t front() const
+        {
+            return data()[0];
+        }
+
+        void push_back(uint8_t byte)
+        {
+            m_bytes.push_back(byte);
+        }
+        void append(const uint8_t *first, const uint8_t *last)
+        {
+            m_bytes.insert(m_bytes.end(), first, last);
+        }
+        void reserve(size_t size)
+        {
+            m_bytes.reserve(size);
+        }
+        void clear()
+        {
+            m_bytes.clear();
+            m_view = nullptr;
+            m_view_size = 0;
+        }
+        void borrow(const uint8_t *data, size_t size)
+        {
+            m_bytes.clear();
+            m_view = data;
+            m_view_size = size;
+        }
+
+    private:
+        std::vector<uint8_t> m_bytes;
+        const uint8_t *m_view;
+        size_t m_view_size;
+    };
 
     /* Contains all transmitted bytes except the header and the client id */
-    std::vector<uint8_t> m_frame;
+    FrameBody m_frame;
 
     enum ReadState {
         HEADER, CLIENT, COMMAND, LENGTH, PAYLOAD, FULL
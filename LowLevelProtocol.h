@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+#ifndef LL_PROTOCOL_SPEC_FILE
+#define LL_PROTOCOL_SPEC_FILE "LowLevelProtocol.def"
+#endif
+
+#define LL_SIZE_VARIABLE (-1)
+#define LL_SIZE_INFO (-2)
+#define LL_NO_REPLY (-1)
+
+enum LowLevelDirection {
+    LL_DIR_TO_BOARD = 0x01,
+    LL_DIR_FROM_BOARD = 0x02,
+    LL_DIR_BOTH = LL_DIR_TO_BOARD | LL_DIR_FROM_BOARD,
+};
+
+/* LL_CMD_<name> constants */
+enum LowLevelCommandId {
+#define LL_COMMAND_RANGE(first, last, payload_size, direction, reply)
+#define LL_COMMAND(id, name, payload_size, direction, reply) \
+    LL_CMD_##name = (id),
+#include LL_PROTOCOL_SPEC_FILE
+#undef LL_COMMAND
+#undef LL_COMMAND_RANGE
+};
+
+struct LowLevelCommandSpec {
+    int16_t payload_size;
+    uint8_t direction;
+    int16_t reply;
+};
+
+struct LowLevelCommandTable {
+    LowLevelCommandSpec commands[256];
+};
+
+constexpr LowLevelCommandTable ll_make_command_table()
+{
+    LowLevelCommandTable table = {};
+    for (int i = 0; i < 256; i++) {
+        table.commands[i] = {LL_SIZE_VARIABLE, LL_DIR_BOTH, LL_NO_REPLY};
+    }
+#define LL_COMMAND_RANGE(first, last, payload_size, direction, reply) \
+    for (int i = (first); i <= (last); i++) { \
+        table.commands[i] = {(payload_size), (direction), (reply)}; \
+    }
+#define LL_COMMAND(id, name, payload_size, direction, reply) \
+    table.commands[(id)] = {(payload_size), (direction), (reply)};
+#include LL_PROTOCOL_SPEC_FILE
+#undef LL_COMMAND
+#undef LL_COMMAND_RANGE
+    return table;
+}
+
+constexpr LowLevelCommandTable LL_COMMAND_TABLE = ll_make_command_table();
+
+constexpr const LowLevelCommandSpec &ll_command_spec(uint8_t command)
+{
+    return LL_COMMAND_TABLE.commands[command];
+}
@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include "Capture.h"
+
+/* Parse a list of IDs or ranges of IDs, e.g. "5-7,9" */
+static int parse_ids(const char *list, uint32_t &mask)
+{
+    mask = 0;
+    const char *p = list;
+    for (;;) {
+        char *end;
+        long first = strtol(p, &end, 0);
+        if (end == p) {
+            return -EINVAL;
+        }
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 0);
+            if (end == p) {
+                return -EINVAL;
+            }
+        }
+        if (first < 0 || last >= 32 || first > last) {
+            return -EINVAL;
+        }
+        for (long i = first; i <= last; i++) {
+            mask |= 1u << i;
+        }
+        if (*end == '\0') {
+            return 0;
+        } else if (*end != ',') {
+            return -EINVAL;
+        }
+        p = end + 1;
+    }
+}
+
+static int parse_time(const char *arg, uint64_t start_us, uint64_t &time_us)
+{
+    char *end;
+    double seconds = strtod(arg, &end);
+    if (end == arg || *end != '\0' || seconds < 0) {
+        return -EINVAL;
+    }
+    time_us = start_us + (uint64_t)(seconds * 1e6);
+    return 0;
+}
+
+static void print_record(const LowLevelMessage &message, CaptureSource source,
+        uint64_t timestamp_us, uint64_t start_us)
+{
+    printf("%12.6f %-6s ", (double)(timestamp_us - start_us) / 1e6,
+            source == CAPTURE_SOURCE_SERIAL ? "serial" : "socket");
+    if (message.is_broadcast()) {
+        printf(" all ");
+    } else if (message.get_client_id() == UNKNOWN_CLIENT_ID) {
+        printf("   - ");
+    } else {
+        printf("#%3d ", message.get_client_id());
+    }
+    printf("0x%02X ", message.get_command());
+    if (message.is_info_frame()) {
+        printf("\"%s\"\n", (const char *)message.get_payload());
+        return;
+    }
+    for (size_t i = 0; i < message.get_payload_size(); i++) {
+        printf("%02x", message.get_payload()[i]);
+    }
+    printf("\n");
+}
+
+/* Extract the records of a capture file (see Capture.h) by time range, data
+ * channel and client, as text or into a new capture file */
+int main(int argc, char *argv[])
+{
+    const char *begin_arg = nullptr;
+    const char *end_arg = nullptr;
+    const char *channels_arg = nullptr;
+    const char *clients_arg = nullptr;
+    const char *output_file = nullptr;
+    bool usage = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:e:c:i:o:")) != -1) {
+        switch (opt) {
+            case 'b':
+                begin_arg = optarg;
+                break;
+            case 'e':
+                end_arg = optarg;
+                break;
+            case 'c':
+                channels_arg = optarg;
+                break;
+            case 'i':
+                clients_arg = optarg;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            default: /* '?' */
+                usage = true;
+                break;
+        }
+    }
+    if (usage || argc - optind != 1) {
+        printf("Usage: %s [-b begin] [-e end] [-c channels] [-i clients] "
+               "[-o output.llc] capture.llc\n"
+               "  begin, end: seconds since the start of the capture\n"
+               "  channels: data channels read from serial, e.g. 5-7,9\n"
+               "  clients: traffic of these client IDs, e.g. 0,2\n",
+               argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *capture_file = argv[optind];
+
+    CaptureQuery query;
+    int ret = query.open(capture_file);
+    if (ret < 0) {
+        printf("Failed to open capture file '%s': %d (%s)\n", capture_file,
+                ret, strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    /* Without -c nor -i, everything; with one of them, only what it says */
+    CaptureQuery::Filter filter;
+    uint64_t start_us = query.startMonotonicUs();
+    if ((begin_arg != nullptr &&
+            parse_time(begin_arg, start_us, filter.begin_us) < 0) ||
+            (end_arg != nullptr &&
+            parse_time(end_arg, start_us, filter.end_us) < 0)) {
+        printf("Invalid time range\n");
+        exit(EXIT_FAILURE);
+    }
+    if (channels_arg != nullptr || clients_arg != nullptr) {
+        filter.channels = 0;
+        filter.clients = 0;
+    }
+    if ((channels_arg != nullptr &&
+            parse_ids(channels_arg, filter.channels) < 0) ||
+            (clients_arg != nullptr &&
+            parse_ids(clients_arg, filter.clients) < 0)) {
+        printf("Invalid channel or client list\n");
+        exit(EXIT_FAILURE);
+    }
+
+    CaptureWriter writer;
+    if (output_file != nullptr && writer.create(output_file,
+            query.startWallClockUs(), start_us) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    long count = query.run(filter, [&](const LowLevelMessage &message,
+            CaptureSource source, uint64_t timestamp_us) {
+        if (output_file != nullptr) {
+            writer.write(message, source, timestamp_us);
+        } else {
+            print_record(message, source, timestamp_us, start_us);
+        }
+    });
+    if (count < 0) {
+        fprintf(stderr, "Capture file truncated or corrupted: %ld (%s)\n",
+                count, strerror(-count));
+    }
+    if (writer.close() < 0) {
+        printf("Failed to write '%s'\n", output_file);
+        exit(EXIT_FAILURE);
+    }
+    if (!query.indexed()) {
+        fprintf(stderr, "No index in '%s', scanned whole\n", capture_file);
+    }
+    return count < 0 ? EXIT_FAILURE : 0;
+}
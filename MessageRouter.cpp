@@ -2,20 +2,78 @@
 
 #include <cerrno>
 #include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <sys/mman.h>
 
-#define DEFAULT_SUBSCRIPTION 0x06
+#include "ControlMessage.h"
+#include "Log.h"
+#include "LowLevelProtocol.h"
+#include "Probes.h"
+
+static uint64_t monotonic_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Copy of a reply from the board addressed to another client */
+static LowLevelMessage reply_copy(const LowLevelMessage &reply, int client_id)
+{
+    LowLevelMessage copy(LL_MSG_SIDE_SOCKET);
+    copy.set_client_id(client_id);
+    if (reply.is_info_frame()) {
+        copy.set_info_frame(reply.get_command(),
+                (const char *)reply.get_payload());
+    } else {
+        copy.set_frame(reply.get_command(), reply.get_payload(),
+                reply.get_payload_size());
+    }
+    copy.set_timestamp(reply.get_timestamp());
+    return copy;
+}
 
 MessageRouter::MessageRouter()
 {
     m_opened = false;
     m_tcp_port = 0;
+    m_websocket_port = 0;
+    m_socket_workers = SOCK_INTERFACE_DEFAULT_WORKERS;
     m_serial_port = nullptr;
-    for (uint32_t &subscription : m_subscriptions) {
-        subscription = DEFAULT_SUBSCRIPTION;
+    m_serial_baud_rate = 0;
+    m_fragment_clients = 0;
+    m_fragment_truncated = false;
+    m_log_folder = ".";
+    m_capture_enabled = false;
+    m_realtime_applied = false;
+    m_last_loop_ns = 0;
+    m_last_report_ns = 0;
+    for (uint8_t &options : m_client_options) {
+        options = 0;
     }
 }
 
-MessageRouter::~MessageRouter() = default;
+MessageRouter::~MessageRouter()
+{
+    m_capture.close();
+    m_multicast.close();
+    if (m_response_cache.hits() > 0 || m_response_cache.merged() > 0) {
+        printf("Response cache: %lu requests answered from the cache, %lu "
+               "merged with a pending one\n", m_response_cache.hits(),
+               m_response_cache.merged());
+    }
+    if (m_serial_scheduler.coalesced() > 0) {
+        printf("%lu commands replaced by a newer one before being sent\n",
+                m_serial_scheduler.coalesced());
+    }
+    if (m_exporter.isOpen()) {
+        m_exporter.close();
+        if (m_exporter.skipped() > 0) {
+            printf("%lu samples not matching their channel_schema were not "
+                   "exported\n", m_exporter.skipped());
+        }
+    }
+}
 
 void MessageRouter::setSocketPort(uint16_t port)
 {
@@ -27,6 +85,97 @@ void MessageRouter::setSerialPort(const char *serial_port)
     m_serial_port = serial_port;
 }
 
+void MessageRouter::setSocketWorkerCount(unsigned int worker_count)
+{
+    m_socket_workers = worker_count;
+}
+
+void MessageRouter::setLogFolder(const char *log_folder)
+{
+    m_log_folder = log_folder;
+}
+
+int MessageRouter::configure(const Config &config)
+{
+    long baud_rate;
+    if (config.getInt("serial_baud_rate", 0, baud_rate) < 0) {
+        return -EINVAL;
+    }
+    if (baud_rate < 0) {
+        printf("Invalid serial_baud_rate: %ld\n", baud_rate);
+        return -EINVAL;
+    }
+    m_serial_baud_rate = baud_rate;
+
+    long cut_through;
+    if (config.getInt("serial_cut_through", SERIAL_DEFAULT_CUT_THROUGH,
+            cut_through) < 0) {
+        return -EINVAL;
+    }
+    if (cut_through < 0) {
+        printf("Invalid serial_cut_through: %ld\n", cut_through);
+        return -EINVAL;
+    }
+    m_serial_interface.setCutThrough(cut_through);
+
+    long websocket_port;
+    if (config.getInt("websocket_port", 0, websocket_port) < 0) {
+        return -EINVAL;
+    }
+    if (websocket_port < 0 || websocket_port > UINT16_MAX) {
+        printf("Invalid websocket_port: %ld\n", websocket_port);
+        return -EINVAL;
+    }
+    m_websocket_port = websocket_port;
+
+    int ret = m_realtime.configure(config);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = m_sessions.configure(config);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = m_pipeline.configure(config);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = m_response_cache.configure(config);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = m_virtual_channels.configure(config);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = m_multicast.configure(config);
+    if (ret < 0) {
+        return ret;
+    }
+
+    long capture;
+    if (config.getInt("capture", 0, capture) < 0) {
+        return -EINVAL;
+    }
+    m_capture_enabled = capture != 0;
+    m_export_file = config.get("export_file", "");
+    ret = m_exporter.configure(config);
+    if (ret < 0) {
+        return ret;
+    }
+    if (!m_export_file.empty() && !m_exporter.hasSchema()) {
+        printf("export_file requires at least one channel_schema\n");
+        return -EINVAL;
+    }
+
+    return m_serial_scheduler.configure(config);
+}
+
 int MessageRouter::open()
 {
     if (m_opened) {
@@ -39,17 +188,56 @@ int MessageRouter::open()
 
     int ret;
 
-    ret = m_socket_interface.open(m_tcp_port);
-    if (ret < 0) {
-        return ret;
+    if (!m_realtime_applied) {
+        applyRealtimeSettings();
+        m_realtime_applied = true;
     }
 
-    ret = m_serial_interface.open(m_serial_port);
+    m_socket_interface.setRealtimeSettings(m_realtime, &m_delivery_latency);
+    if (m_handover) {
+        /* Whatever happens, the state is used once */
+        std::unique_ptr<HandoverState> state = std::move(m_handover);
+        ret = adopt(*state);
+    } else {
+        ret = m_socket_interface.open(m_tcp_port, m_socket_workers,
+                m_websocket_port);
+        if (ret == 0) {
+            ret = m_serial_interface.open(m_serial_port, m_serial_baud_rate);
+            if (ret < 0) {
+                m_socket_interface.close();
+            }
+        }
+    }
+    LL_PROBE(router_open, -1, 0, ret);
     if (ret < 0) {
-        m_socket_interface.close();
         return ret;
     }
 
+    for (LocalClient *client : m_local_clients) {
+        ret = m_socket_interface.attachLocalClient(client);
+        if (ret < 0) {
+            printf("Failed to attach in-process client: %d (%s)\n", ret,
+                    strerror(-ret));
+        }
+    }
+
+    /* Failing to record the traffic does not prevent routing it */
+    if (m_capture_enabled && !m_capture.isOpen()) {
+        m_capture.open(m_log_folder);
+    }
+    if (!m_export_file.empty() && !m_exporter.isOpen()) {
+        using namespace std::chrono;
+        if (m_exporter.open(m_export_file.c_str(),
+                duration_cast<microseconds>(
+                        system_clock::now().time_since_epoch()).count(),
+                monotonic_us()) == 0) {
+            printf("Exporting telemetry to '%s'\n", m_export_file.c_str());
+        }
+    }
+    if (m_multicast.enabled() && !m_multicast.isOpen()) {
+        m_multicast.open();
+    }
+
     m_opened = true;
     return 0;
 }
@@ -63,15 +251,64 @@ int MessageRouter::close()
     int ret_a = m_socket_interface.close();
     int ret_b = m_serial_interface.close();
 
-    for (uint32_t &subscription : m_subscriptions) {
-        subscription = DEFAULT_SUBSCRIPTION;
+    /* Every client is disconnected, their sessions may be resumed */
+    uint64_t now_us = monotonic_us();
+    for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
+        SessionStore::Session *session = m_sessions.ofClient(i);
+        if (session != nullptr) {
+            m_sessions.detach(*session, m_subscriptions.save(i),
+                    m_client_options[i], now_us);
+        }
+        m_client_options[i] = 0;
     }
+    m_socket_interface.setReservedClients(m_sessions.detachedClients());
+
+    m_subscriptions.reset();
+    m_history.clear();
+    m_virtual_channels.reset();
+    m_serial_scheduler.clear();
+    m_response_cache.clear();
     m_opened = false;
+    m_last_loop_ns = 0;
+    m_pipeline.close();
+    if (m_realtime.jitter_report) {
+        printJitterReport();
+    }
 
-    if (ret_a < 0 || ret_b < 0) {
-        return -1;
-    } else {
-        return 0;
+    int ret = (ret_a < 0 || ret_b < 0) ? -1 : 0;
+    LL_PROBE(router_close, -1, 0, ret);
+    return ret;
+}
+
+int MessageRouter::attachLocalClient(LocalClient *client)
+{
+    if (client == nullptr) {
+        return -EINVAL;
+    }
+    for (LocalClient *attached : m_local_clients) {
+        if (attached == client) {
+            return -EEXIST;
+        }
+    }
+
+    if (m_opened) {
+        int ret = m_socket_interface.attachLocalClient(client);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    m_local_clients.push_back(client);
+    return m_opened ? client->clientId() : 0;
+}
+
+void MessageRouter::detachLocalClient(LocalClient *client)
+{
+    for (size_t i = 0; i < m_local_clients.size(); i++) {
+        if (m_local_clients[i] == client) {
+            m_local_clients.erase(m_local_clients.begin() + i);
+            m_socket_interface.detachLocalClient(client);
+            return;
+        }
     }
 }
 
@@ -80,6 +317,94 @@ bool MessageRouter::isOpen()
     return m_opened;
 }
 
+void MessageRouter::setHandoverState(std::unique_ptr<HandoverState> state)
+{
+    m_handover = std::move(state);
+}
+
+int MessageRouter::handOver(HandoverState &state)
+{
+    if (!m_opened) {
+        return -ENOTCONN;
+    }
+
+    int ret = m_socket_interface.handOver(state);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Commands read before the clients were detached still go to the
+     * board, through the scheduler queues handed over below */
+    while (m_socket_interface.available() > 0) {
+        LowLevelMessage msg = m_socket_interface.getLastMessage();
+        m_capture.write(msg, CAPTURE_SOURCE_SOCKET,
+                msg.get_timestamp() / 1000);
+        processMsgFromSocket(msg);
+    }
+    for (int client_id : m_socket_interface.closedClients()) {
+        processClientClosed(client_id);
+    }
+
+    for (HandoverClient &client : state.clients) {
+        client.subscriptions = m_subscriptions.save(client.client_id);
+        SessionStore::Session *session = m_sessions.ofClient(client.client_id);
+        if (session != nullptr) {
+            client.session_token = session->token;
+            client.session_replay = session->replay;
+        }
+    }
+    state.serial_frames = m_serial_scheduler.drain();
+    state.serial_fd = m_serial_interface.release(state.serial_message);
+
+    close();
+    return 0;
+}
+
+int MessageRouter::adopt(HandoverState &state)
+{
+    int ret = m_socket_interface.adopt(state, m_socket_workers,
+            m_websocket_port);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = m_serial_interface.adopt(state.serial_fd, state.serial_message);
+    if (ret < 0) {
+        m_socket_interface.close();
+        return ret;
+    }
+    state.serial_fd = -1;
+
+    for (const HandoverClient &client : state.clients) {
+        int id = client.client_id;
+        if (!m_socket_interface.isConnected(id)) {
+            continue;
+        }
+        m_subscriptions.restore(id, client.subscriptions);
+        m_client_options[id] = client.connection ?
+                client.connection->options : 0;
+        if (client.session_token == 0) {
+            continue;
+        }
+        SessionStore::Session *session = m_sessions.find(client.session_token);
+        if (session == nullptr) {
+            m_sessions.create(client.session_token, id, client.session_replay);
+        } else if (!session->attached) {
+            m_sessions.attach(*session, id, client.session_replay);
+        }
+    }
+    m_socket_interface.setReservedClients(m_sessions.detachedClients());
+
+    for (const LowLevelMessage &frame : state.serial_frames) {
+        m_serial_scheduler.enqueue(frame);
+    }
+    return 0;
+}
+
+bool MessageRouter::busyPoll() const
+{
+    return m_realtime.busy_poll;
+}
+
 int MessageRouter::communicate()
 {
     if (!m_opened) {
@@ -88,74 +413,469 @@ int MessageRouter::communicate()
 
     int ret;
 
+    uint64_t now_ns = ll_monotonic_ns();
+    if (m_last_loop_ns != 0) {
+        m_loop_period.add(now_ns - m_last_loop_ns);
+    }
+    m_last_loop_ns = now_ns;
+    if (m_realtime.jitter_report && m_realtime.jitter_report_period > 0 &&
+            now_ns - m_last_report_ns >=
+            m_realtime.jitter_report_period * 1000000000ULL) {
+        if (m_last_report_ns != 0) {
+            printJitterReport();
+        }
+        m_last_report_ns = now_ns;
+    }
+
     /* Receive on serial port */
     ret = m_serial_interface.receive();
     if (ret < 0) {
         close();
         return ret;
     }
-    while (m_serial_interface.available() > 0) {
-        processMsgFromSerial(m_serial_interface.getLastMessage());
+    for (;;) {
+        while (m_serial_interface.available() > 0) {
+            LowLevelMessage &msg = m_serial_interface.front();
+            m_capture.write(msg, CAPTURE_SOURCE_SERIAL,
+                    msg.get_timestamp() / 1000);
+            processMsgFromSerial(msg);
+            m_serial_interface.pop();
+        }
+
+        /* Info frame forwarded cut-through, after the frames before it */
+        const LowLevelInfoFragment *fragment =
+                m_serial_interface.fragment();
+        if (fragment == nullptr) {
+            break;
+        }
+        processInfoFragment(*fragment);
+        m_serial_interface.popFragment();
     }
+    m_multicast.flush();
 
     /* Receive on socket */
     m_socket_interface.receive();
     while (m_socket_interface.available() > 0) {
-        ret = processMsgFromSocket(m_socket_interface.getLastMessage());
+        LowLevelMessage msg = m_socket_interface.getLastMessage();
+        m_capture.write(msg, CAPTURE_SOURCE_SOCKET,
+                msg.get_timestamp() / 1000);
+        ret = processMsgFromSocket(msg);
         if (ret < 0) {
             close();
             return ret;
         }
     }
+    bool sessions_changed = !m_socket_interface.closedClients().empty();
+    for (int client_id : m_socket_interface.closedClients()) {
+        processClientClosed(client_id);
+    }
+    sessions_changed |= m_sessions.expire(now_ns / 1000);
+    if (sessions_changed) {
+        m_socket_interface.setReservedClients(m_sessions.detachedClients());
+    }
+
+    /* Send the client commands allowed by the scheduler */
+    ret = m_serial_scheduler.transmit(m_serial_interface);
+    if (ret < 0) {
+        close();
+        return ret;
+    }
+
+    /* Hand the queued frames over to the socket workers */
+    m_socket_interface.flush();
 
     return 0;
 }
 
-void MessageRouter::processMsgFromSerial(const LowLevelMessage &msg)
+constexpr MessageRouter::HandlerTable MessageRouter::makeHandlerTable()
+{
+    HandlerTable table = {};
+    for (int i = 0; i < 256; i++) {
+        uint8_t direction = ll_command_spec(i).direction;
+        if (i < DATA_CHANNEL_COUNT) {
+            table.serial[i] = &MessageRouter::processDataChannelMsg;
+            table.socket[i] = &MessageRouter::processControlMsg;
+        } else {
+            table.serial[i] = &MessageRouter::processReplyMsg;
+            table.socket[i] = &MessageRouter::processCommandMsg;
+        }
+        if (!(direction & LL_DIR_FROM_BOARD)) {
+            table.serial[i] = &MessageRouter::processInvalidSerialMsg;
+        }
+        if (!(direction & LL_DIR_TO_BOARD) && i >= DATA_CHANNEL_COUNT) {
+            table.socket[i] = &MessageRouter::processInvalidSocketMsg;
+        }
+    }
+    return table;
+}
+
+/* Constant-initialized: makeHandlerTable() is constexpr */
+const MessageRouter::HandlerTable MessageRouter::s_handlers =
+        MessageRouter::makeHandlerTable();
+
+void MessageRouter::processMsgFromSerial(LowLevelMessage &msg)
+{
+    if (m_pipeline.fromSerial(msg)) {
+        (this->*s_handlers.serial[msg.get_command()])(msg);
+    }
+}
+
+int MessageRouter::processMsgFromSocket(LowLevelMessage &msg)
+{
+    if (!m_pipeline.fromSocket(msg)) {
+        return 0;
+    }
+    return (this->*s_handlers.socket[msg.get_command()])(msg);
+}
+
+void MessageRouter::processDataChannelMsg(const LowLevelMessage &msg)
 {
-    if (msg.is_broadcast() != msg.is_data_channel_msg()) {
-        printf("Invalid message received on serial "
+    if (!msg.is_broadcast()) {
+        LL_LOG("Invalid message received on serial "
                "(broadcast <-> data_channel mismatch\n");
         return;
     }
+    if (m_virtual_channels.isVirtual(msg.get_data_channel())) {
+        LL_LOG("Frame received on virtual channel %u dropped\n",
+                msg.get_data_channel());
+        return;
+    }
 
-    if (msg.is_data_channel_msg()) {
-        for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
-            if (m_subscriptions[i] & (1 << msg.get_data_channel())) {
-                m_socket_interface.sendMessage(msg, i);
-            }
-        }
-        // todo : log message once
-    } else {
+    routeDataChannelMsg(msg);
+
+    /* Virtual channels computed from this sample */
+    size_t count = m_virtual_channels.process(msg);
+    for (size_t i = 0; i < count; i++) {
+        routeDataChannelMsg(m_virtual_channels.frame(i));
+    }
+}
+
+void MessageRouter::routeDataChannelMsg(const LowLevelMessage &msg)
+{
+    uint64_t now_us = monotonic_us();
+    m_history.push(msg, now_us);
+    uint32_t client_mask = m_subscriptions.recipients(
+            msg.get_data_channel(), now_us);
+    m_socket_interface.broadcastMessage(msg, client_mask);
+    m_multicast.publish(msg);
+    m_sessions.record(msg);
+    m_exporter.write(msg, msg.get_timestamp() / 1000);
+}
+
+void MessageRouter::processReplyMsg(const LowLevelMessage &msg)
+{
+    if (msg.is_broadcast()) {
+        LL_LOG("Invalid message received on serial "
+               "(broadcast <-> data_channel mismatch\n");
+        return;
+    }
+
+    deliverReply(msg);
+
+    /* Clients which sent the same cached request in the meantime */
+    uint32_t waiters = m_response_cache.reply(msg, monotonic_us());
+    while (waiters != 0) {
+        int client_id = __builtin_ctz(waiters);
+        waiters &= waiters - 1;
+        deliverReply(reply_copy(msg, client_id));
+    }
+}
+
+void MessageRouter::deliverReply(const LowLevelMessage &msg)
+{
+    if (m_socket_interface.isConnected(msg.get_client_id())) {
         m_socket_interface.sendMessage(msg);
-        // todo : log message
+    } else {
+        m_sessions.record(msg);
     }
 }
 
-int MessageRouter::processMsgFromSocket(const LowLevelMessage &msg)
+/* The pieces bypass the pipeline and are not cached, but the clients whose
+ * identical cached requests were merged with this one still receive them */
+void MessageRouter::processInfoFragment(const LowLevelInfoFragment &fragment)
 {
-    int ret;
-    bool sub_msg;
-    ret = msg.is_subscription_msg(sub_msg);
-    if (ret == 0) {
-        int client_id = msg.get_client_id();
-        if (client_id < 0 || client_id >= SOCK_INTERFACE_MAX_CLIENTS) {
-            printf("Invalid message received on socket: client_id==%d\n",
-                    client_id);
+    if (m_capture.isOpen()) {
+        captureInfoFragment(fragment);
+    }
+    if (fragment.first) {
+        /* Clients which sent the same cached request get it too */
+        m_fragment_clients = m_response_cache.forward(fragment.client_id,
+                fragment.command);
+        if (m_socket_interface.isConnected(fragment.client_id)) {
+            m_fragment_clients |= 1u << fragment.client_id;
+        }
+        if (m_fragment_clients == 0) {
+            LL_LOG("Info frame for client #%d dropped (command %u)\n",
+                    fragment.client_id, fragment.command);
+        }
+    }
+    m_socket_interface.sendInfoFragment(fragment, m_fragment_clients);
+}
+
+/* Captured once its last piece is forwarded, truncated to the largest
+ * record as a client whose output is full gets it */
+void MessageRouter::captureInfoFragment(const LowLevelInfoFragment &fragment)
+{
+    if (fragment.first) {
+        const uint8_t header[] = {0xFF, (uint8_t)fragment.client_id,
+                fragment.command, 0xFF};
+        m_fragment_capture.assign(header, header + sizeof(header));
+        m_fragment_truncated = false;
+    } else if (m_fragment_capture.empty()) {
+        return;
+    }
+    size_t room = CAPTURE_MAX_FRAME_SIZE - 1 - m_fragment_capture.size();
+    size_t size = fragment.size < room ? fragment.size : room;
+    m_fragment_capture.insert(m_fragment_capture.end(), fragment.data,
+            fragment.data + size);
+    m_fragment_truncated |= size < fragment.size;
+    if (!fragment.last) {
+        return;
+    }
+
+    if (m_fragment_truncated) {
+        LL_LOG("Info frame for client #%d truncated in the capture\n",
+                fragment.client_id);
+        m_fragment_capture.push_back('\0');
+    }
+
+    LowLevelMessage msg(LL_MSG_SIDE_SERIAL);
+    int err = LL_MSG_OK;
+    msg.read_in_place(m_fragment_capture.data(), m_fragment_capture.size(),
+            err);
+    if (msg.ready()) {
+        m_capture.write(msg, CAPTURE_SOURCE_SERIAL,
+                fragment.timestamp_ns / 1000);
+    }
+    m_fragment_capture.clear();
+}
+
+void MessageRouter::processInvalidSerialMsg(const LowLevelMessage &msg)
+{
+    LL_LOG("Invalid message received on serial (command %u)\n",
+            msg.get_command());
+}
+
+int MessageRouter::processCommandMsg(const LowLevelMessage &msg)
+{
+    bool cached = m_response_cache.cacheable(msg.get_command());
+    if (cached) {
+        const LowLevelMessage *reply = nullptr;
+        ResponseCache::Lookup lookup = m_response_cache.request(msg,
+                monotonic_us(), reply);
+        if (lookup == ResponseCache::HIT) {
+            deliverReply(reply_copy(*reply, msg.get_client_id()));
+            return 0;
+        } else if (lookup == ResponseCache::MERGED) {
             return 0;
         }
+    }
+
+    int ret = m_serial_scheduler.enqueue(msg);
+    if (ret < 0) {
+        LL_LOG("Serial queue full for client #%d, command %u dropped\n",
+                msg.get_client_id(), msg.get_command());
+        if (cached) {
+            m_response_cache.cancel(msg);
+        }
+    }
+    return 0;
+}
+
+int MessageRouter::processInvalidSocketMsg(const LowLevelMessage &msg)
+{
+    LL_LOG("Invalid message received from client #%d (command %u)\n",
+            msg.get_client_id(), msg.get_command());
+    return 0;
+}
+
+int MessageRouter::processControlMsg(const LowLevelMessage &msg)
+{
+    int client_id = msg.get_client_id();
+    if (client_id < 0 || client_id >= SOCK_INTERFACE_MAX_CLIENTS) {
+        LL_LOG("Invalid message received on socket: client_id==%d\n",
+                client_id);
+        return 0;
+    }
+
+    unsigned int channel = msg.get_data_channel();
+    size_t size = msg.get_payload_size();
+    const uint8_t *payload = msg.get_payload();
+    if (size == 0) {
+        LL_LOG("Empty control message received from client #%d\n",
+                client_id);
+        return 0;
+    }
 
-        unsigned int channel = msg.get_data_channel();
-        if (sub_msg) {
-            m_subscriptions[client_id] |= (1 << channel);
+    /* Subscription message of the original protocol, whatever the byte */
+    if (size == 1) {
+        if (payload[0] == LL_CTRL_UNSUBSCRIBE) {
+            m_subscriptions.unsubscribe(client_id, channel);
         } else {
-            m_subscriptions[client_id] &= ~(1 << channel);
+            m_subscriptions.subscribe(client_id, channel);
         }
-        // todo : log message
         return 0;
+    }
+
+    switch (payload[0]) {
+        case LL_CTRL_UNSUBSCRIBE:
+            m_subscriptions.unsubscribe(client_id, channel);
+            return 0;
+        case LL_CTRL_SUBSCRIBE:
+            m_subscriptions.subscribe(client_id, channel);
+            return 0;
+        case LL_CTRL_SUBSCRIBE_DECIMATED:
+            if (size != 3) {
+                break;
+            }
+            m_subscriptions.subscribeDecimated(client_id, channel,
+                    ll_ctrl_read_u16(payload + 1));
+            return 0;
+        case LL_CTRL_SUBSCRIBE_RATE:
+            if (size != 3) {
+                break;
+            }
+            m_subscriptions.subscribeRate(client_id, channel,
+                    ll_ctrl_read_u16(payload + 1));
+            return 0;
+        case LL_CTRL_SESSION_OPTIONS:
+            if (size != 2) {
+                break;
+            }
+            m_client_options[client_id] = payload[1];
+            m_socket_interface.setClientOptions(client_id, payload[1]);
+            return 0;
+        case LL_CTRL_SUBSCRIBE_HISTORY:
+        case LL_CTRL_HISTORY:
+            if (size != 4) {
+                break;
+            }
+            if (payload[0] == LL_CTRL_SUBSCRIBE_HISTORY) {
+                m_subscriptions.subscribe(client_id, channel);
+            }
+            sendHistory(client_id, channel, payload[1],
+                    ll_ctrl_read_u16(payload + 2) * 1000ULL);
+            return 0;
+        case LL_CTRL_RESUME_SESSION:
+            if (size != 10 || ll_ctrl_read_u64(payload + 1) == 0) {
+                break;
+            }
+            resumeSession(client_id, ll_ctrl_read_u64(payload + 1),
+                    payload[9]);
+            return 0;
+        default:
+            break;
+    }
+    LL_LOG("Invalid control message received from client #%d "
+           "(opcode %u, size %lu)\n", client_id, payload[0], size);
+    return 0;
+}
+
+void MessageRouter::sendHistory(int client_id, unsigned int channel,
+        size_t count, uint64_t max_age_us)
+{
+    uint64_t now_us = monotonic_us();
+    size_t available = m_history.size(channel);
+    if (count > available) {
+        count = available;
+    }
+    if (max_age_us > 0) {
+        while (count > 0 && now_us - m_history.timestampAt(channel, count - 1)
+                > max_age_us) {
+            count--;
+        }
+    }
+
+    /* Oldest first, before any newer sample of the channel */
+    for (size_t i = count; i > 0; i--) {
+        m_socket_interface.sendMessage(m_history.at(channel, i - 1),
+                client_id);
+    }
+}
+
+void MessageRouter::resumeSession(int client_id, uint64_t token,
+        uint8_t flags)
+{
+    uint64_t now_us = monotonic_us();
+    bool replay = flags & LL_RESUME_REPLAY;
+
+    /* A connection has at most one session */
+    SessionStore::Session *current = m_sessions.ofClient(client_id);
+    if (current != nullptr && current->token != token) {
+        m_sessions.detach(*current, m_subscriptions.save(client_id),
+                m_client_options[client_id], now_us);
+    }
+
+    uint8_t status = LL_RESUME_NEW_SESSION;
+    std::deque<LowLevelMessage> missed;
+    size_t lost = 0;
+    SessionStore::Session *session = m_sessions.find(token);
+    if (session == nullptr) {
+        if (m_sessions.create(token, client_id, replay) == nullptr) {
+            LL_LOG("Too many sessions, client #%d gets none\n", client_id);
+        }
+    } else if (session->attached && session->client_id == client_id) {
+        status = LL_RESUME_RESUMED;
+        session->replay = replay;
     } else {
-        ret = m_serial_interface.sendMessage(msg);
-        // todo : log message
-        return ret;
+        /* The previous connection may not be detected as closed yet */
+        if (session->attached) {
+            int previous_id = session->client_id;
+            m_sessions.detach(*session, m_subscriptions.save(previous_id),
+                    m_client_options[previous_id], now_us);
+        }
+
+        int target_id = session->client_id;
+        if (target_id != client_id &&
+                m_socket_interface.moveClient(client_id, target_id) == 0) {
+            m_subscriptions.resetClient(client_id);
+            m_client_options[client_id] = 0;
+            client_id = target_id;
+        }
+        m_subscriptions.restore(client_id, session->subscriptions);
+        m_client_options[client_id] = session->options;
+        m_socket_interface.setClientOptions(client_id, session->options);
+        missed.swap(session->missed);
+        lost = session->lost;
+        status = LL_RESUME_RESUMED;
+        m_sessions.attach(*session, client_id, replay);
+        m_socket_interface.setReservedClients(m_sessions.detachedClients());
+    }
+
+    uint8_t reply[6] = {status, (uint8_t)client_id};
+    ll_ctrl_write_u16(reply + 2, missed.size());
+    ll_ctrl_write_u16(reply + 4, lost > UINT16_MAX ? UINT16_MAX : lost);
+    m_socket_interface.sendControlReply(client_id, LL_CTRL_RESUME_SESSION,
+            reply, sizeof(reply));
+    for (const LowLevelMessage &msg : missed) {
+        m_socket_interface.sendMessage(msg, client_id);
+    }
+}
+
+void MessageRouter::processClientClosed(int client_id)
+{
+    SessionStore::Session *session = m_sessions.ofClient(client_id);
+    if (session != nullptr) {
+        m_sessions.detach(*session, m_subscriptions.save(client_id),
+                m_client_options[client_id], monotonic_us());
     }
+    m_subscriptions.resetClient(client_id);
+    m_client_options[client_id] = 0;
+}
+
+void MessageRouter::applyRealtimeSettings()
+{
+    if (m_realtime.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        printf("Failed to lock memory: %d (%s)\n", -errno, strerror(errno));
+    }
+    m_realtime.applyToThread(0);
+}
+
+void MessageRouter::printJitterReport()
+{
+    printf("Jitter report (%s mode):\n",
+            m_realtime.busy_poll ? "busy-poll" : "event-driven");
+    m_loop_period.print("loop period");
+    m_delivery_latency.print("serial to client latency");
+    fflush(stdout);
 }
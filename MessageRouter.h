@@ -2,9 +2,27 @@
 
 #include <cstdint>
 
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Capture.h"
+#include "ChannelHistory.h"
+#include "LatencyHistogram.h"
+#include "LocalClient.h"
 #include "LowLevelMessage.h"
+#include "MulticastPublisher.h"
+#include "PipelineStages.h"
 #include "SocketInterface.h"
+#include "Config.h"
+#include "Realtime.h"
+#include "ResponseCache.h"
 #include "SerialInterface.h"
+#include "SerialScheduler.h"
+#include "Sessions.h"
+#include "Subscriptions.h"
+#include "TelemetryExporter.h"
+#include "VirtualChannels.h"
 
 class MessageRouter
 {
@@ -14,26 +32,109 @@ public:
 
     void setSocketPort(uint16_t port);
     void setSerialPort(const char * serial_port);
+    void setSocketWorkerCount(unsigned int worker_count);
+    void setLogFolder(const char *log_folder);
+
+    /* Read the optional settings of the router and of its components */
+    int configure(const Config &config);
 
     int open();
     int close();
     bool isOpen();
 
+    /* The next open() resumes from the state of a previous instance
+     * instead of opening the ports (see Handover.h) */
+    void setHandoverState(std::unique_ptr<HandoverState> state);
+
+    /* Release the ports and the routing state into state, and close */
+    int handOver(HandoverState &state);
+
+    /* Attach an in-process client (see LocalClient.h): now if the router
+     * is open, then on each open() until detached. The client must outlive
+     * its attachment. Returns its client ID, or 0 if the router is closed */
+    int attachLocalClient(LocalClient *client);
+    void detachLocalClient(LocalClient *client);
+
+    /* True if communicate() must be called again without sleeping */
+    bool busyPoll() const;
+
     /* Returns 0 on normal operation, -1 in case of error.
      * In case of error, the object is always closed, so open()
      * must be called to re-enable communication */
     int communicate();
 
 private:
-    void processMsgFromSerial(const LowLevelMessage &msg);
-    int processMsgFromSocket(const LowLevelMessage &msg);
+    typedef void (MessageRouter::*SerialHandler)(const LowLevelMessage &msg);
+    typedef int (MessageRouter::*SocketHandler)(const LowLevelMessage &msg);
+
+    /* Handlers by command ID, built at compile time from the protocol
+     * specification (see LowLevelProtocol.def) */
+    struct HandlerTable {
+        SerialHandler serial[256];
+        SocketHandler socket[256];
+    };
+    static constexpr HandlerTable makeHandlerTable();
+    static const HandlerTable s_handlers;
+
+    /* Run the pipeline, then the handler of the command */
+    void processMsgFromSerial(LowLevelMessage &msg);
+    int processMsgFromSocket(LowLevelMessage &msg);
+    void processDataChannelMsg(const LowLevelMessage &msg);
+    void routeDataChannelMsg(const LowLevelMessage &msg);
+    void processReplyMsg(const LowLevelMessage &msg);
+    void deliverReply(const LowLevelMessage &msg);
+    void processInfoFragment(const LowLevelInfoFragment &fragment);
+    void captureInfoFragment(const LowLevelInfoFragment &fragment);
+    void processInvalidSerialMsg(const LowLevelMessage &msg);
+    int processCommandMsg(const LowLevelMessage &msg);
+    int processControlMsg(const LowLevelMessage &msg);
+    int processInvalidSocketMsg(const LowLevelMessage &msg);
+    void sendHistory(int client_id, unsigned int channel, size_t count,
+            uint64_t max_age_us);
+    void resumeSession(int client_id, uint64_t token, uint8_t flags);
+    void processClientClosed(int client_id);
+    int adopt(HandoverState &state);
+    void applyRealtimeSettings();
+    void printJitterReport();
 
     bool m_opened;
+    std::unique_ptr<HandoverState> m_handover;
     uint16_t m_tcp_port;
+    uint16_t m_websocket_port;
+    unsigned int m_socket_workers;
     const char *m_serial_port;
+    unsigned int m_serial_baud_rate;
 
     SocketInterface m_socket_interface;
     SerialInterface m_serial_interface;
+    SerialScheduler m_serial_scheduler;
+    RouterPipeline m_pipeline;
+    ResponseCache m_response_cache;
+    uint32_t m_fragment_clients; /* Of the info frame forwarded cut-through */
+
+    Subscriptions m_subscriptions;
+    ChannelHistory m_history;
+    VirtualChannels m_virtual_channels;
+    uint8_t m_client_options[SOCK_INTERFACE_MAX_CLIENTS];
+    std::vector<LocalClient *> m_local_clients;
+
+    /* Kept across close() / open(), for the clients to resume */
+    SessionStore m_sessions;
+
+    RealtimeSettings m_realtime;
+    bool m_realtime_applied;
+    LatencyHistogram m_loop_period;
+    LatencyHistogram m_delivery_latency;
+    uint64_t m_last_loop_ns;
+    uint64_t m_last_report_ns;
 
-    uint32_t m_subscriptions[SOCK_INTERFACE_MAX_CLIENTS];
+    /* Kept open across close() / open(): one file per server run */
+    const char *m_log_folder;
+    bool m_capture_enabled;
+    CaptureWriter m_capture;
+    std::vector<uint8_t> m_fragment_capture; /* Info frame forwarded so far */
+    bool m_fragment_truncated;
+    std::string m_export_file;
+    TelemetryExporter m_exporter;
+    MulticastPublisher m_multicast;
 };
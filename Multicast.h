@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+/* UDP multicast of data-channel frames. Each datagram packs the frames
+ * routed during one router loop, as sent to the TCP clients, after a header
+ * (little-endian):
+ *   "LM", u8 version, u8 frame count, u32 sequence number, u32 session ID,
+ *   u64 monotonic time (us) at which the first frame was read from serial
+ * The sequence number is incremented for every datagram, so that listeners
+ * detect the datagrams lost. It starts again from 0 with a new random
+ * session ID each time the publisher is opened (e.g. after a restart or an
+ * upgrade), listeners then synchronizing on the new sequence. */
+#define MULTICAST_MAGIC "LM"
+#define MULTICAST_VERSION 2
+#define MULTICAST_HEADER_SIZE 20
+#define MULTICAST_DEFAULT_DATAGRAM_SIZE 1400
+#define MULTICAST_MAX_DATAGRAM_SIZE 65507
+#define MULTICAST_MAX_FRAMES 255
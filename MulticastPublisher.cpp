@@ -0,0 +1,234 @@
+#include "MulticastPublisher.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+static void write_le(uint8_t *buf, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+MulticastPublisher::MulticastPublisher()
+{
+    memset(&m_group, 0, sizeof(m_group));
+    m_interface.s_addr = htonl(INADDR_ANY);
+    m_ttl = 1;
+    m_datagram_size = MULTICAST_DEFAULT_DATAGRAM_SIZE;
+    m_channel_mask = 0;
+    m_enabled = false;
+    m_fd = -1;
+    m_session = 0;
+    m_sequence = 0;
+    m_frame_count = 0;
+    m_size = MULTICAST_HEADER_SIZE;
+    m_sent = 0;
+    m_dropped = 0;
+}
+
+MulticastPublisher::~MulticastPublisher()
+{
+    close();
+}
+
+int MulticastPublisher::configure(const Config &config)
+{
+    m_enabled = config.has("multicast_group");
+    if (!m_enabled) {
+        return 0;
+    }
+
+    std::string group = config.get("multicast_group", "");
+    size_t colon = group.rfind(':');
+    char *end = nullptr;
+    long port = 0;
+    if (colon != std::string::npos) {
+        port = strtol(group.c_str() + colon + 1, &end, 10);
+    }
+    m_group.sin_family = AF_INET;
+    if (colon == std::string::npos || *end != '\0' || port <= 0 ||
+            port > UINT16_MAX || inet_pton(AF_INET,
+            group.substr(0, colon).c_str(), &m_group.sin_addr) != 1 ||
+            !IN_MULTICAST(ntohl(m_group.sin_addr.s_addr))) {
+        printf("Invalid multicast_group: '%s'\n", group.c_str());
+        return -EINVAL;
+    }
+    m_group.sin_port = htons(port);
+
+    const char *interface = config.get("multicast_interface", nullptr);
+    if (interface != nullptr &&
+            inet_pton(AF_INET, interface, &m_interface) != 1) {
+        printf("Invalid multicast_interface: '%s'\n", interface);
+        return -EINVAL;
+    }
+
+    long ttl;
+    if (config.getInt("multicast_ttl", 1, ttl) < 0) {
+        return -EINVAL;
+    }
+    if (ttl < 0 || ttl > 255) {
+        printf("Invalid multicast_ttl: %ld\n", ttl);
+        return -EINVAL;
+    }
+    m_ttl = ttl;
+
+    long size;
+    if (config.getInt("multicast_datagram_size",
+            MULTICAST_DEFAULT_DATAGRAM_SIZE, size) < 0) {
+        return -EINVAL;
+    }
+    /* Room for the header and the largest frame */
+    if (size < MULTICAST_HEADER_SIZE + 3 + 255 ||
+            size > MULTICAST_MAX_DATAGRAM_SIZE) {
+        printf("Invalid multicast_datagram_size: %ld\n", size);
+        return -EINVAL;
+    }
+    m_datagram_size = size;
+
+    m_channel_mask = 0;
+    std::vector<std::string> ranges = config.getAll("multicast_channels");
+    if (ranges.empty()) {
+        m_channel_mask = UINT32_MAX;
+    }
+    for (const std::string &entry : ranges) {
+        uint8_t first, last;
+        std::string arguments;
+        if (Config::parseCommandRange(entry, first, last, arguments) < 0 ||
+                !arguments.empty() || last >= DATA_CHANNEL_COUNT) {
+            printf("Invalid multicast_channels entry: '%s'\n", entry.c_str());
+            return -EINVAL;
+        }
+        for (unsigned int channel = first; channel <= last; channel++) {
+            m_channel_mask |= 1UL << channel;
+        }
+    }
+    return 0;
+}
+
+bool MulticastPublisher::enabled() const
+{
+    return m_enabled;
+}
+
+int MulticastPublisher::open()
+{
+    if (m_fd >= 0) {
+        return 0;
+    }
+
+    m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (m_fd < 0) {
+        printf("Failed to create multicast socket: %d (%s)\n", -errno,
+                strerror(errno));
+        return -errno;
+    }
+
+    unsigned char ttl = m_ttl;
+    if (setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+            sizeof(ttl)) < 0 ||
+            setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_IF, &m_interface,
+            sizeof(m_interface)) < 0) {
+        int ret = -errno;
+        printf("Failed to set multicast options: %d (%s)\n", ret,
+                strerror(-ret));
+        ::close(m_fd);
+        m_fd = -1;
+        return ret;
+    }
+
+    /* Tells the listeners that the sequence starts again */
+    if (getrandom(&m_session, sizeof(m_session), 0) != sizeof(m_session)) {
+        m_session = (uint32_t)(ll_monotonic_ns() ^ getpid());
+    }
+    m_sequence = 0;
+
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_group.sin_addr, address, sizeof(address));
+    printf("Publishing data channels to %s:%u\n", address,
+            ntohs(m_group.sin_port));
+    return 0;
+}
+
+int MulticastPublisher::close()
+{
+    if (m_fd < 0) {
+        return 0;
+    }
+
+    flush();
+    printf("Multicast: %lu datagrams sent, %lu dropped\n", m_sent, m_dropped);
+    int ret = ::close(m_fd);
+    m_fd = -1;
+    m_sent = 0;
+    m_dropped = 0;
+    if (ret < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+bool MulticastPublisher::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+void MulticastPublisher::publish(const LowLevelMessage &msg)
+{
+    if (m_fd < 0 || !(m_channel_mask & (1UL << msg.get_data_channel()))) {
+        return;
+    }
+
+    if (m_frame_count == MULTICAST_MAX_FRAMES) {
+        flush();
+    }
+    ssize_t size = msg.get_frame_without_cid(m_datagram + m_size,
+            m_datagram_size - m_size);
+    if (size < 0 && m_frame_count > 0) {
+        /* Does not fit after the frames queued */
+        flush();
+        size = msg.get_frame_without_cid(m_datagram + m_size,
+                m_datagram_size - m_size);
+    }
+    if (size < 0) {
+        return;
+    }
+    if (m_frame_count == 0) {
+        write_le(m_datagram + 12, msg.get_timestamp() / 1000, 8);
+    }
+    m_size += size;
+    m_frame_count++;
+}
+
+void MulticastPublisher::flush()
+{
+    if (m_fd < 0 || m_frame_count == 0) {
+        return;
+    }
+
+    memcpy(m_datagram, MULTICAST_MAGIC, 2);
+    m_datagram[2] = MULTICAST_VERSION;
+    m_datagram[3] = m_frame_count;
+    write_le(m_datagram + 4, m_sequence, 4);
+    write_le(m_datagram + 8, m_session, 4);
+
+    /* A datagram the kernel cannot take now is lost, as it could be on the
+     * network: its sequence number is used anyway */
+    ssize_t ret = sendto(m_fd, m_datagram, m_size, 0,
+            (const struct sockaddr *)&m_group, sizeof(m_group));
+    if (ret < 0) {
+        m_dropped++;
+    } else {
+        m_sent++;
+    }
+    m_sequence++;
+    m_frame_count = 0;
+    m_size = MULTICAST_HEADER_SIZE;
+}
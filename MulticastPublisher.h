@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <netinet/in.h>
+#include "Config.h"
+#include "LowLevelMessage.h"
+#include "Multicast.h"
+
+/* Sends the data-channel frames routed to a multicast group (see
+ * Multicast.h), for any number of listeners */
+class MulticastPublisher
+{
+public:
+    MulticastPublisher();
+    ~MulticastPublisher();
+
+    /* Keys: multicast_group = <address>:<port>,
+     * multicast_channels = <first>[-<last>] (one line per range, default:
+     * every data channel), multicast_interface = <local address>,
+     * multicast_ttl, multicast_datagram_size */
+    int configure(const Config &config);
+    bool enabled() const;
+
+    int open();
+    int close();
+    bool isOpen() const;
+
+    /* Queue a data-channel frame if its channel is published */
+    void publish(const LowLevelMessage &msg);
+
+    /* Send the frames queued */
+    void flush();
+
+private:
+    struct sockaddr_in m_group;
+    struct in_addr m_interface;
+    int m_ttl;
+    size_t m_datagram_size;
+    uint32_t m_channel_mask;
+    bool m_enabled;
+
+    int m_fd;
+    uint32_t m_session;
+    uint32_t m_sequence;
+    uint8_t m_frame_count;
+    size_t m_size;
+    uint64_t m_sent;
+    uint64_t m_dropped;
+    uint8_t m_datagram[MULTICAST_MAX_DATAGRAM_SIZE];
+};
@@ -0,0 +1,159 @@
+#include "MulticastReceiver.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+static uint64_t read_le(const uint8_t *buf, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)buf[i] << (8 * i);
+    }
+    return value;
+}
+
+MulticastReceiver::MulticastReceiver() :
+        m_message(LL_MSG_SIDE_SOCKET)
+{
+    m_fd = -1;
+    m_synchronized = false;
+    m_session = 0;
+    m_next_sequence = 0;
+    m_lost = 0;
+}
+
+MulticastReceiver::~MulticastReceiver()
+{
+    close();
+}
+
+int MulticastReceiver::open(const char *group, uint16_t port,
+        const char *interface)
+{
+    if (m_fd >= 0) {
+        return -EISCONN;
+    }
+    if (group == nullptr) {
+        return -EFAULT;
+    }
+
+    struct ip_mreq membership;
+    memset(&membership, 0, sizeof(membership));
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (inet_pton(AF_INET, group, &membership.imr_multiaddr) != 1 ||
+            (interface != nullptr && inet_pton(AF_INET, interface,
+            &membership.imr_interface) != 1)) {
+        return -EINVAL;
+    }
+
+    m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (m_fd < 0) {
+        return -errno;
+    }
+
+    /* Several listeners may run on the same host */
+    int enable = 1;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr = membership.imr_multiaddr;
+    address.sin_port = htons(port);
+    if (setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &enable,
+            sizeof(enable)) < 0 ||
+            bind(m_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+            setsockopt(m_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+            sizeof(membership)) < 0) {
+        int ret = -errno;
+        ::close(m_fd);
+        m_fd = -1;
+        return ret;
+    }
+
+    m_synchronized = false;
+    m_lost = 0;
+    return 0;
+}
+
+int MulticastReceiver::close()
+{
+    if (m_fd < 0) {
+        return 0;
+    }
+    int ret = ::close(m_fd);
+    m_fd = -1;
+    if (ret < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int MulticastReceiver::fd() const
+{
+    return m_fd;
+}
+
+int MulticastReceiver::poll(const FrameCallback &callback)
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+
+    int nb_frames = 0;
+    for (;;) {
+        ssize_t size = recv(m_fd, m_datagram, sizeof(m_datagram), 0);
+        if (size < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return nb_frames;
+            }
+            return -errno;
+        }
+        if (size < MULTICAST_HEADER_SIZE ||
+                memcmp(m_datagram, MULTICAST_MAGIC, 2) != 0 ||
+                m_datagram[2] != MULTICAST_VERSION) {
+            continue;
+        }
+
+        /* A new session restarts the sequence */
+        uint32_t sequence = read_le(m_datagram + 4, 4);
+        uint32_t session = read_le(m_datagram + 8, 4);
+        if (m_synchronized && session != m_session) {
+            m_synchronized = false;
+        }
+        m_session = session;
+
+        /* Late datagrams (sequence before the expected one) are dropped */
+        uint32_t gap = sequence - m_next_sequence;
+        if (m_synchronized && gap >= 0x80000000U) {
+            continue;
+        }
+        if (m_synchronized) {
+            m_lost += gap;
+        }
+        m_synchronized = true;
+        m_next_sequence = sequence + 1;
+
+        uint64_t timestamp_us = read_le(m_datagram + 12, 8);
+        size_t i = MULTICAST_HEADER_SIZE;
+        for (unsigned int n = 0; n < m_datagram[3] && i < (size_t)size; n++) {
+            int err;
+            m_message.reset();
+            i += m_message.append_bytes(m_datagram + i, size - i, err);
+            if (err != LL_MSG_OK && err != LL_MSG_FULL) {
+                break;
+            }
+            if (m_message.ready()) {
+                callback(m_message, timestamp_us);
+                nb_frames++;
+            }
+        }
+    }
+}
+
+uint64_t MulticastReceiver::lost() const
+{
+    return m_lost;
+}
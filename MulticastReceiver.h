@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include "LowLevelMessage.h"
+#include "Multicast.h"
+
+/* Listener of the datagrams sent by MulticastPublisher, part of the client
+ * library */
+class MulticastReceiver
+{
+public:
+    typedef std::function<void(const LowLevelMessage &msg,
+            uint64_t timestamp_us)> FrameCallback;
+
+    MulticastReceiver();
+    ~MulticastReceiver();
+
+    /* interface: local address of the network interface to join the group
+     * on, nullptr for the default one */
+    int open(const char *group, uint16_t port, const char *interface = nullptr);
+    int close();
+    int fd() const;
+
+    /* Read the pending datagrams without blocking, calling callback on each
+     * frame. Returns the number of frames read, or a negative error code */
+    int poll(const FrameCallback &callback);
+
+    /* Datagrams missed, from the gaps in the sequence numbers. Those lost
+     * while the publisher restarted are not counted */
+    uint64_t lost() const;
+
+private:
+    int m_fd;
+    bool m_synchronized;
+    uint32_t m_session;
+    uint32_t m_next_sequence;
+    uint64_t m_lost;
+    LowLevelMessage m_message;
+    uint8_t m_datagram[MULTICAST_MAX_DATAGRAM_SIZE];
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include "Config.h"
+#include "LowLevelMessage.h"
+
+/* Base of the pipeline stages, with no-op defaults: a stage only redefines
+ * the functions it needs. Stages are called directly, not through virtual
+ * functions, so that the compiler can inline the whole pipeline. */
+struct PipelineStage {
+    int configure(const Config &)
+    {
+        return 0;
+    }
+
+    /* Called for every frame before it is routed, which may be modified.
+     * Returning false drops the frame and skips the next stages */
+    bool fromSerial(LowLevelMessage &)
+    {
+        return true;
+    }
+
+    bool fromSocket(LowLevelMessage &)
+    {
+        return true;
+    }
+
+    /* Called when the router closes */
+    void close()
+    {
+    }
+};
+
+/* Stages run in order, composed at compile time. A pipeline is itself a
+ * stage, so pipelines may be nested. */
+template <typename... Stages>
+class Pipeline
+{
+public:
+    int configure(const Config &config)
+    {
+        int ret = 0;
+        all([&](auto &stage) {
+            return (ret = stage.configure(config)) >= 0;
+        });
+        return ret;
+    }
+
+    bool fromSerial(LowLevelMessage &msg)
+    {
+        return all([&](auto &stage) {
+            return stage.fromSerial(msg);
+        });
+    }
+
+    bool fromSocket(LowLevelMessage &msg)
+    {
+        return all([&](auto &stage) {
+            return stage.fromSocket(msg);
+        });
+    }
+
+    void close()
+    {
+        all([](auto &stage) {
+            stage.close();
+            return true;
+        });
+    }
+
+    template <size_t I>
+    typename std::tuple_element<I, std::tuple<Stages...>>::type &stage()
+    {
+        return std::get<I>(m_stages);
+    }
+
+private:
+    /* Call f on each stage until it returns false */
+    template <size_t I = 0, typename F>
+    typename std::enable_if<(I < sizeof...(Stages)), bool>::type all(F &&f)
+    {
+        return f(std::get<I>(m_stages)) && all<I + 1>(f);
+    }
+
+    template <size_t I = 0, typename F>
+    typename std::enable_if<(I == sizeof...(Stages)), bool>::type all(F &&)
+    {
+        return true;
+    }
+
+    std::tuple<Stages...> m_stages;
+};
@@ -0,0 +1,89 @@
+#include "PipelineStages.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+MetricsStage::MetricsStage()
+{
+    m_enabled = false;
+    memset(m_serial, 0, sizeof(m_serial));
+    memset(m_socket, 0, sizeof(m_socket));
+}
+
+int MetricsStage::configure(const Config &config)
+{
+    long enabled;
+    if (config.getInt("pipeline_metrics", 0, enabled) < 0) {
+        return -EINVAL;
+    }
+    m_enabled = enabled != 0;
+    return 0;
+}
+
+void MetricsStage::close()
+{
+    if (!m_enabled) {
+        return;
+    }
+
+    printf("Frames routed per command (from serial / from clients):\n");
+    for (int i = 0; i < 256; i++) {
+        if (m_serial[i].frames == 0 && m_socket[i].frames == 0) {
+            continue;
+        }
+        printf("  0x%02X: %lu frames, %lu bytes / %lu frames, %lu bytes\n",
+                i, m_serial[i].frames, m_serial[i].bytes,
+                m_socket[i].frames, m_socket[i].bytes);
+    }
+    memset(m_serial, 0, sizeof(m_serial));
+    memset(m_socket, 0, sizeof(m_socket));
+}
+
+TraceStage::TraceStage()
+{
+    m_enabled = false;
+}
+
+int TraceStage::configure(const Config &config)
+{
+    long enabled;
+    if (config.getInt("trace_frames", 0, enabled) < 0) {
+        return -EINVAL;
+    }
+    m_enabled = enabled != 0;
+    return 0;
+}
+
+FilterStage::FilterStage()
+{
+    memset(m_drop_serial, 0, sizeof(m_drop_serial));
+    memset(m_drop_socket, 0, sizeof(m_drop_socket));
+}
+
+int FilterStage::configure(const Config &config)
+{
+    int ret = parse(config, "drop_serial", m_drop_serial);
+    if (ret < 0) {
+        return ret;
+    }
+    return parse(config, "drop_socket", m_drop_socket);
+}
+
+int FilterStage::parse(const Config &config, const char *key,
+        uint64_t *mask)
+{
+    for (const std::string &entry : config.getAll(key)) {
+        uint8_t first, last;
+        std::string arguments;
+        if (Config::parseCommandRange(entry, first, last, arguments) < 0 ||
+                !arguments.empty()) {
+            printf("Invalid %s entry: '%s'\n", key, entry.c_str());
+            return -EINVAL;
+        }
+        for (unsigned int command = first; command <= last; command++) {
+            mask[command >> 6] |= 1ULL << (command & 63);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include "Config.h"
+#include "Log.h"
+#include "LowLevelMessage.h"
+#include "Pipeline.h"
+
+/* Frame and payload byte counts per command ID and direction, printed when
+ * the router closes. Key: pipeline_metrics = 1 */
+class MetricsStage : public PipelineStage
+{
+public:
+    MetricsStage();
+
+    int configure(const Config &config);
+
+    bool fromSerial(LowLevelMessage &msg)
+    {
+        if (m_enabled) {
+            count(m_serial[msg.get_command()], msg);
+        }
+        return true;
+    }
+
+    bool fromSocket(LowLevelMessage &msg)
+    {
+        if (m_enabled) {
+            count(m_socket[msg.get_command()], msg);
+        }
+        return true;
+    }
+
+    void close();
+
+private:
+    struct Counter {
+        uint64_t frames;
+        uint64_t bytes;
+    };
+
+    static void count(Counter &counter, const LowLevelMessage &msg)
+    {
+        counter.frames++;
+        counter.bytes += msg.get_payload_size();
+    }
+
+    bool m_enabled;
+    Counter m_serial[256];
+    Counter m_socket[256];
+};
+
+/* Log every frame routed (rate limited, see Log.h). Key: trace_frames = 1 */
+class TraceStage : public PipelineStage
+{
+public:
+    TraceStage();
+
+    int configure(const Config &config);
+
+    bool fromSerial(LowLevelMessage &msg)
+    {
+        if (m_enabled) {
+            LL_LOG("Serial -> client %d: command %u, %lu bytes\n",
+                    msg.get_client_id(), msg.get_command(),
+                    msg.get_payload_size());
+        }
+        return true;
+    }
+
+    bool fromSocket(LowLevelMessage &msg)
+    {
+        if (m_enabled) {
+            LL_LOG("Client %d -> serial: command %u, %lu bytes\n",
+                    msg.get_client_id(), msg.get_command(),
+                    msg.get_payload_size());
+        }
+        return true;
+    }
+
+private:
+    bool m_enabled;
+};
+
+/* Drop the frames of some command IDs.
+ * Keys: drop_serial = <first>[-<last>] (frames from the board)
+ *       drop_socket = <first>[-<last>] (frames from the clients) */
+class FilterStage : public PipelineStage
+{
+public:
+    FilterStage();
+
+    int configure(const Config &config);
+
+    bool fromSerial(LowLevelMessage &msg)
+    {
+        return !isSet(m_drop_serial, msg.get_command());
+    }
+
+    bool fromSocket(LowLevelMessage &msg)
+    {
+        return !isSet(m_drop_socket, msg.get_command());
+    }
+
+private:
+    static bool isSet(const uint64_t *mask, uint8_t command)
+    {
+        return (mask[command >> 6] >> (command & 63)) & 1;
+    }
+
+    static int parse(const Config &config, const char *key, uint64_t *mask);
+
+    uint64_t m_drop_serial[4];
+    uint64_t m_drop_socket[4];
+};
+
+/* Stages added without modifying the router: the header given to CMake with
+ * -DLL_PIPELINE_STAGES=<path> defines UserPipeline, e.g.
+ *     struct MyStage : PipelineStage {
+ *         bool fromSerial(LowLevelMessage &msg) { ... }
+ *     };
+ *     typedef Pipeline<MyStage> UserPipeline; */
+#ifdef LL_PIPELINE_STAGES_FILE
+#include LL_PIPELINE_STAGES_FILE
+#else
+typedef Pipeline<> UserPipeline;
+#endif
+
+typedef Pipeline<MetricsStage, TraceStage, FilterStage, UserPipeline>
+        RouterPipeline;
@@ -0,0 +1,75 @@
+#pragma once
+
+/* USDT (SystemTap-style) static tracepoints, for tracers such as bpftrace,
+ * perf or SystemTap to attach to the running server (see
+ * tools/lowlevel_latency.bt). A probe is a single nop instruction plus an
+ * ELF note describing where its arguments live: while no tracer is attached,
+ * it costs nothing but the argument values being at hand in registers.
+ *
+ * Every probe of the "lowlevel" provider takes three integer arguments:
+ * client ID (-1 if none), command ID and length.
+ *   serial_frame      Frame parsed from serial (length: payload size)
+ *   socket_frame      Frame parsed from a client, in a socket worker
+ *   parse_error       Invalid byte (command: byte, length: LowLevelMessageErr)
+ *   subscription      Subscription change (command: channel, length: 1 to
+ *                     subscribe, 0 to unsubscribe)
+ *   enqueue, dequeue  Command entering and leaving the serial scheduler
+ *   coalesce          Pending command replaced by a newer one
+ *   serial_send_start, serial_send_end
+ *                     Frame written to serial
+ *   client_send_start, client_send_end
+ *                     Output buffer of a client written to its socket
+ *                     (command: -1, length: bytes)
+ *   router_open, router_close
+ *                     (client ID: -1, command: 0, length: result)
+ *
+ * With <sys/sdt.h> (systemtap-sdt-dev) the probes are defined by it.
+ * Without it, they are emitted directly on x86-64, and compiled out
+ * elsewhere or when built with -DLL_USDT=OFF. */
+
+#if defined(LL_NO_USDT)
+#define LL_PROBE(name, client_id, command, length) \
+    do { (void)(client_id); (void)(command); (void)(length); } while (0)
+
+#elif defined(__has_include) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LL_PROBE(name, client_id, command, length) \
+    STAP_PROBE3(lowlevel, name, (int)(client_id), (int)(command), \
+            (int)(length))
+
+#elif defined(__x86_64__)
+/* Same note layout as <sys/sdt.h> (version 3): the address of the nop, of
+ * the .stapsdt.base section to relocate it, no semaphore, then provider,
+ * name and argument locations ("-4@" for signed 32-bit values) */
+#define LL_PROBE(name, client_id, command, length) \
+    __asm__ __volatile__( \
+        "990: nop\n" \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+        ".balign 4\n" \
+        ".4byte 992f-991f, 994f-993f, 3\n" \
+        "991: .asciz \"stapsdt\"\n" \
+        "992: .balign 4\n" \
+        "993: .8byte 990b\n" \
+        ".8byte _.stapsdt.base\n" \
+        ".8byte 0\n" \
+        ".asciz \"lowlevel\"\n" \
+        ".asciz \"" #name "\"\n" \
+        ".asciz \"-4@%0 -4@%1 -4@%2\"\n" \
+        "994: .balign 4\n" \
+        ".popsection\n" \
+        ".ifndef _.stapsdt.base\n" \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base," \
+                "comdat\n" \
+        ".weak _.stapsdt.base\n" \
+        ".hidden _.stapsdt.base\n" \
+        "_.stapsdt.base: .space 1\n" \
+        ".size _.stapsdt.base, 1\n" \
+        ".popsection\n" \
+        ".endif\n" \
+        : : "nor"((int)(client_id)), "nor"((int)(command)), \
+            "nor"((int)(length)))
+
+#else
+#define LL_PROBE(name, client_id, command, length) \
+    do { (void)(client_id); (void)(command); (void)(length); } while (0)
+#endif
@@ -0,0 +1,105 @@
+#include "Realtime.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+
+RealtimeSettings::RealtimeSettings()
+{
+    busy_poll = false;
+    busy_poll_us = REALTIME_DEFAULT_BUSY_POLL_US;
+    lock_memory = false;
+    priority = 0;
+    jitter_report = false;
+    jitter_report_period = 0;
+}
+
+int RealtimeSettings::configure(const Config &config)
+{
+    long enabled;
+    if (config.getInt("busy_poll", 0, enabled) < 0) {
+        return -EINVAL;
+    }
+    busy_poll = enabled != 0;
+    if (config.getInt("lock_memory", 0, enabled) < 0) {
+        return -EINVAL;
+    }
+    lock_memory = enabled != 0;
+
+    long us;
+    if (config.getInt("busy_poll_us", REALTIME_DEFAULT_BUSY_POLL_US,
+            us) < 0) {
+        return -EINVAL;
+    }
+    if (us < 0 || us > 1000000) {
+        printf("Invalid busy_poll_us: %ld\n", us);
+        return -EINVAL;
+    }
+    busy_poll_us = us;
+
+    long prio;
+    if (config.getInt("realtime_priority", 0, prio) < 0) {
+        return -EINVAL;
+    }
+    if (prio != 0 && (prio < sched_get_priority_min(SCHED_FIFO) ||
+            prio > sched_get_priority_max(SCHED_FIFO))) {
+        printf("Invalid realtime_priority: %ld\n", prio);
+        return -EINVAL;
+    }
+    priority = prio;
+
+    cpus.clear();
+    std::istringstream stream(config.get("cpu_affinity", ""));
+    int cpu;
+    while (stream >> cpu) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            printf("Invalid cpu_affinity CPU: %d\n", cpu);
+            return -EINVAL;
+        }
+        cpus.push_back(cpu);
+    }
+    if (!stream.eof()) {
+        printf("Invalid cpu_affinity: '%s'\n",
+                config.get("cpu_affinity", ""));
+        return -EINVAL;
+    }
+
+    jitter_report = config.has("jitter_report_period");
+    if (config.getInt("jitter_report_period", 0, jitter_report_period) < 0) {
+        return -EINVAL;
+    }
+    if (jitter_report_period < 0) {
+        printf("Invalid jitter_report_period: %ld\n", jitter_report_period);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void RealtimeSettings::applyToThread(unsigned int thread_index) const
+{
+    int ret;
+
+    if (thread_index < cpus.size()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[thread_index], &set);
+        ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0) {
+            printf("Failed to pin thread #%u to CPU %d: %d (%s)\n",
+                    thread_index, cpus[thread_index], -ret, strerror(ret));
+        }
+    }
+
+    if (priority > 0) {
+        sched_param param = {};
+        param.sched_priority = priority;
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0) {
+            printf("Failed to set SCHED_FIFO priority of thread #%u: "
+                   "%d (%s)\n", thread_index, -ret, strerror(ret));
+        }
+    }
+}
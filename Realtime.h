@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include "Config.h"
+
+#define REALTIME_DEFAULT_BUSY_POLL_US 50
+
+/* Low-latency run mode settings, all disabled by default:
+ *   busy_poll = 1            never sleep nor block: the router loop and the
+ *                            socket workers spin on non-blocking polls
+ *   busy_poll_us = 50        SO_BUSY_POLL time of client sockets
+ *   lock_memory = 1          mlockall() at startup
+ *   realtime_priority = 50   SCHED_FIFO priority of the routing threads
+ *   cpu_affinity = 2 3       CPU of the router thread, then of each socket
+ *                            worker (left unpinned when not listed)
+ *   jitter_report_period = 10  print the loop period and serial-to-client
+ *                            latency distributions every N seconds (0: only
+ *                            when the router closes) */
+struct RealtimeSettings {
+    RealtimeSettings();
+
+    int configure(const Config &config);
+
+    /* Apply the scheduling settings to the calling thread. thread_index is 0
+     * for the router thread, 1 + n for socket worker n. */
+    void applyToThread(unsigned int thread_index) const;
+
+    bool busy_poll;
+    int busy_poll_us;
+    bool lock_memory;
+    int priority;
+    std::vector<int> cpus;
+    bool jitter_report;
+    long jitter_report_period;
+};
@@ -0,0 +1,201 @@
+#include "ResponseCache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "LowLevelProtocol.h"
+
+ResponseCache::ResponseCache()
+{
+    memset(m_ttl_us, 0, sizeof(m_ttl_us));
+    m_entries.reserve(RESPONSE_CACHE_MAX_ENTRIES);
+    m_hits = 0;
+    m_merged = 0;
+}
+
+ResponseCache::~ResponseCache() = default;
+
+int ResponseCache::configure(const Config &config)
+{
+    for (const std::string &entry : config.getAll("response_cache")) {
+        uint8_t first, last;
+        std::string ttl;
+        char *end = nullptr;
+        long ttl_ms = -1;
+        if (Config::parseCommandRange(entry, first, last, ttl) == 0 &&
+                !ttl.empty()) {
+            ttl_ms = strtol(ttl.c_str(), &end, 10);
+        }
+        if (ttl_ms <= 0 || ttl_ms > UINT32_MAX / 1000 || *end != '\0') {
+            printf("Invalid response_cache entry: '%s'\n", entry.c_str());
+            return -EINVAL;
+        }
+        for (unsigned int command = first; command <= last; command++) {
+            if (ll_command_spec(command).reply == LL_NO_REPLY) {
+                printf("response_cache: command 0x%02X has no reply\n",
+                        command);
+                return -EINVAL;
+            }
+            m_ttl_us[command] = ttl_ms * 1000;
+        }
+    }
+    return 0;
+}
+
+bool ResponseCache::cacheable(uint8_t command) const
+{
+    return m_ttl_us[command] != 0;
+}
+
+ResponseCache::Lookup ResponseCache::request(const LowLevelMessage &msg,
+        uint64_t now_us, const LowLevelMessage *&reply)
+{
+    int client_id = msg.get_client_id();
+    Entry *entry = find(msg);
+
+    if (entry != nullptr && entry->state == FRESH &&
+            now_us - entry->time_us < m_ttl_us[entry->command]) {
+        reply = &entry->reply;
+        m_hits++;
+        return HIT;
+    }
+    if (entry != nullptr && entry->state == PENDING &&
+            now_us - entry->time_us < RESPONSE_CACHE_PENDING_TIMEOUT_US) {
+        /* A client sending the same request twice expects two replies */
+        if (entry->client_id == client_id) {
+            return MISS;
+        }
+        entry->waiters |= 1u << client_id;
+        m_merged++;
+        return MERGED;
+    }
+
+    if (entry == nullptr) {
+        if (m_entries.size() < RESPONSE_CACHE_MAX_ENTRIES) {
+            m_entries.emplace_back();
+            entry = &m_entries.back();
+        } else {
+            /* Replace the oldest reply, unless every entry is pending */
+            for (Entry &candidate : m_entries) {
+                if (candidate.state == FRESH && (entry == nullptr ||
+                        candidate.time_us < entry->time_us)) {
+                    entry = &candidate;
+                }
+            }
+            if (entry == nullptr) {
+                return MISS;
+            }
+            entry->waiters = 0;
+        }
+        entry->command = msg.get_command();
+        entry->payload.assign(msg.get_payload(),
+                msg.get_payload() + msg.get_payload_size());
+    } else if (entry->state == FRESH) {
+        entry->waiters = 0;
+    }
+
+    /* The clients waiting for a request which timed out wait for this one */
+    entry->state = PENDING;
+    entry->client_id = client_id;
+    entry->time_us = now_us;
+    return MISS;
+}
+
+void ResponseCache::cancel(const LowLevelMessage &msg)
+{
+    Entry *entry = find(msg);
+    if (entry != nullptr && entry->state == PENDING &&
+            entry->client_id == msg.get_client_id() && entry->waiters == 0) {
+        erase(entry);
+    }
+}
+
+uint32_t ResponseCache::reply(const LowLevelMessage &msg, uint64_t now_us)
+{
+    Entry *entry = findPending(msg.get_client_id(), msg.get_command());
+    if (entry == nullptr) {
+        return 0;
+    }
+
+    entry->reply = msg;
+    entry->state = FRESH;
+    entry->time_us = now_us;
+    uint32_t waiters = entry->waiters;
+    entry->waiters = 0;
+    return waiters;
+}
+
+uint32_t ResponseCache::forward(int client_id, uint8_t command)
+{
+    Entry *entry = findPending(client_id, command);
+    if (entry == nullptr) {
+        return 0;
+    }
+
+    uint32_t waiters = entry->waiters;
+    erase(entry);
+    return waiters;
+}
+
+void ResponseCache::clear()
+{
+    m_entries.clear();
+}
+
+uint64_t ResponseCache::hits() const
+{
+    return m_hits;
+}
+
+uint64_t ResponseCache::merged() const
+{
+    return m_merged;
+}
+
+ResponseCache::Entry *ResponseCache::find(const LowLevelMessage &msg)
+{
+    size_t size = msg.get_payload_size();
+    for (Entry &entry : m_entries) {
+        if (entry.command == msg.get_command() &&
+                entry.payload.size() == size && (size == 0 ||
+                memcmp(entry.payload.data(), msg.get_payload(), size) == 0)) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+/* Oldest request of the client expecting this reply */
+ResponseCache::Entry *ResponseCache::findPending(int client_id,
+        uint8_t reply_command)
+{
+    Entry *entry = nullptr;
+    for (Entry &candidate : m_entries) {
+        if (candidate.state == PENDING && candidate.client_id == client_id &&
+                ll_command_spec(candidate.command).reply == reply_command &&
+                (entry == nullptr || candidate.time_us < entry->time_us)) {
+            entry = &candidate;
+        }
+    }
+    return entry;
+}
+
+void ResponseCache::erase(Entry *entry)
+{
+    if (entry != &m_entries.back()) {
+        *entry = std::move(m_entries.back());
+    }
+    m_entries.pop_back();
+}
+
+ResponseCache::Entry::Entry() :
+        reply(LL_MSG_SIDE_SERIAL)
+{
+    state = PENDING;
+    command = 0;
+    client_id = UNKNOWN_CLIENT_ID;
+    waiters = 0;
+    time_us = 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Config.h"
+#include "LowLevelMessage.h"
+
+#define RESPONSE_CACHE_MAX_ENTRIES 64
+#define RESPONSE_CACHE_PENDING_TIMEOUT_US 1000000
+
+/* Replies of read-only query commands (version, configuration, status...),
+ * kept for a time to live per command. Requests are identified by command ID
+ * and payload. While a request is pending on the serial link, identical
+ * requests of other clients wait for its reply instead of being sent too.
+ *
+ * Only commands with a reply in the protocol specification can be cached:
+ * the reply is matched to the oldest pending request of the same client
+ * expecting this reply command ID. */
+class ResponseCache
+{
+public:
+    enum Lookup {
+        MISS,   /* Send the request, its reply will be cached */
+        HIT,    /* reply holds a fresh reply */
+        MERGED, /* An identical request is pending, the client will get its
+                 * reply */
+    };
+
+    ResponseCache();
+    ~ResponseCache();
+
+    /* Key: response_cache = <first>[-<last>] <time to live (ms)> */
+    int configure(const Config &config);
+
+    bool cacheable(uint8_t command) const;
+
+    /* Request of a client for a cacheable command */
+    Lookup request(const LowLevelMessage &msg, uint64_t now_us,
+            const LowLevelMessage *&reply);
+
+    /* The request returned MISS could not be sent */
+    void cancel(const LowLevelMessage &msg);
+
+    /* Reply received from the board. Returns the clients to send a copy to
+     * (the client which sent the request excepted) */
+    uint32_t reply(const LowLevelMessage &msg, uint64_t now_us);
+
+    /* Info frame reply forwarded cut-through (see SerialInterface.h), which
+     * is not cached. Returns the clients waiting for it, as reply() */
+    uint32_t forward(int client_id, uint8_t command);
+
+    void clear();
+
+    uint64_t hits() const;
+    uint64_t merged() const;
+
+private:
+    enum EntryState {
+        PENDING, /* Request sent, waiting for the reply */
+        FRESH,   /* Reply received */
+    };
+
+    struct Entry {
+        Entry();
+        EntryState state;
+        uint8_t command;
+        std::vector<uint8_t> payload;
+        int client_id;          /* Of the request sent */
+        uint32_t waiters;       /* Other clients waiting for the reply */
+        uint64_t time_us;       /* Of the request sent, or of the reply */
+        LowLevelMessage reply;
+    };
+
+    Entry *find(const LowLevelMessage &msg);
+    Entry *findPending(int client_id, uint8_t reply_command);
+    void erase(Entry *entry);
+
+    uint32_t m_ttl_us[256]; /* 0: not cached */
+    std::vector<Entry> m_entries;
+    uint64_t m_hits;
+    uint64_t m_merged;
+};
@@ -0,0 +1,84 @@
+#include "RingBuffer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+RingBuffer::RingBuffer()
+{
+    m_data = nullptr;
+    m_size = 0;
+}
+
+RingBuffer::~RingBuffer()
+{
+    deallocate();
+}
+
+int RingBuffer::allocate(size_t size)
+{
+    if (m_data != nullptr) {
+        return -EEXIST;
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (size == 0 || (size & (size - 1)) != 0 ||
+            (page_size > 0 && size % page_size != 0)) {
+        return -EINVAL;
+    }
+
+    int fd = memfd_create("LowLevelServer ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        printf("Failed to create ring buffer memory: %d (%s)\n", -errno,
+                strerror(errno));
+        return -errno;
+    }
+    int ret = 0;
+    if (ftruncate(fd, size) < 0) {
+        ret = -errno;
+    }
+
+    /* Reserve both halves at once, then map the memory in each of them */
+    void *area = MAP_FAILED;
+    if (ret == 0) {
+        area = mmap(nullptr, 2 * size, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area == MAP_FAILED) {
+            ret = -errno;
+        }
+    }
+    for (size_t half = 0; ret == 0 && half < 2; half++) {
+        if (mmap((uint8_t *)area + half * size, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            ret = -errno;
+        }
+    }
+    ::close(fd);
+
+    if (ret < 0) {
+        printf("Failed to map ring buffer: %d (%s)\n", ret, strerror(-ret));
+        if (area != MAP_FAILED) {
+            munmap(area, 2 * size);
+        }
+        return ret;
+    }
+
+    m_data = (uint8_t *)area;
+    m_size = size;
+    return 0;
+}
+
+void RingBuffer::deallocate()
+{
+    if (m_data != nullptr) {
+        munmap(m_data, 2 * m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
+
+bool RingBuffer::allocated() const
+{
+    return m_data != nullptr;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/* Byte ring buffer mapped twice in a row in virtual memory: any span of up to
+ * size() bytes starting in the ring is contiguous, even when it wraps around,
+ * so that it can be passed as is to read() or parsed in place.
+ * Positions are free-running byte counters. */
+class RingBuffer
+{
+public:
+    RingBuffer();
+    ~RingBuffer();
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    /* size must be a power of two and a multiple of the page size */
+    int allocate(size_t size);
+    void deallocate();
+    bool allocated() const;
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    uint8_t *at(uint64_t position) const
+    {
+        return m_data + (position & (m_size - 1));
+    }
+
+private:
+    uint8_t *m_data;
+    size_t m_size;
+};
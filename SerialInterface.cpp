@@ -4,22 +4,55 @@
 #include <cerrno>
 #include <cstdio>
 #include <termios.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <cstring>
 
+#include "Log.h"
+#include "Probes.h"
+
 SerialInterface::SerialInterface() :
-    m_ll_msg(LL_MSG_SIDE_SERIAL)
+    m_frames(SERIAL_MAX_FRAMES, LowLevelMessage(LL_MSG_SIDE_SERIAL)),
+    m_info(LL_MSG_SIDE_SERIAL)
 {
     m_fd = -1;
+    m_cut_through = SERIAL_DEFAULT_CUT_THROUGH;
+    m_fragment = {};
+    resetRing();
 }
 
 SerialInterface::~SerialInterface() = default;
 
-int SerialInterface::open(const char *port)
+static speed_t baud_rate_to_speed(unsigned int baud_rate)
+{
+    switch (baud_rate) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 500000: return B500000;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        case 2000000: return B2000000;
+        case 3000000: return B3000000;
+        case 4000000: return B4000000;
+        default: return B0;
+    }
+}
+
+int SerialInterface::open(const char *port, unsigned int baud_rate)
 {
     int ret;
     struct termios serial_settings;
 
+    ret = allocateRing();
+    if (ret < 0) {
+        return ret;
+    }
+
     /* Open serial port */
     m_fd = ::open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (m_fd < 0) {
@@ -48,6 +81,18 @@ int SerialInterface::open(const char *port)
     serial_settings.c_cc[VTIME]  =  1;                  // timeout in deciseconds for non-canonical read
     serial_settings.c_cflag     |=  CREAD | CLOCAL;     // turn on READ & ignore ctrl lines
 
+    /* Set speed, unless left to the driver (e.g. USB CDC ports) */
+    if (baud_rate != 0) {
+        speed_t speed = baud_rate_to_speed(baud_rate);
+        if (speed == B0) {
+            printf("Unsupported serial baud rate: %u\n", baud_rate);
+            close();
+            return -EINVAL;
+        }
+        cfsetispeed(&serial_settings, speed);
+        cfsetospeed(&serial_settings, speed);
+    }
+
     /* Flush port */
     ret = tcflush(m_fd, TCIFLUSH);
     if (ret < 0) {
@@ -73,9 +118,15 @@ int SerialInterface::open(const char *port)
 
 int SerialInterface::close()
 {
+    resetRing();
+
+    /* Released by release() */
+    if (m_fd < 0) {
+        return 0;
+    }
+
     int ret = ::close(m_fd);
     m_fd = -1;
-    m_ll_msg.reset();
     if (ret < 0) {
         printf("Failed to close serial port: %d (%s)\n", -errno,
                 strerror(errno));
@@ -85,13 +136,60 @@ int SerialInterface::close()
     return 0;
 }
 
+int SerialInterface::release(LowLevelMessage &partial)
+{
+    int err;
+    partial.reset();
+
+    /* The rest of an info frame forwarded cut-through is not handed over:
+     * the next instance skips it as invalid bytes */
+    if (m_ring_head > m_ring_scan && !m_info_open) {
+        partial.append_bytes(m_ring.at(m_ring_scan), m_ring_head - m_ring_scan,
+                err);
+    }
+    resetRing();
+
+    int fd = m_fd;
+    m_fd = -1;
+    return fd;
+}
+
+int SerialInterface::adopt(int fd, const LowLevelMessage &partial)
+{
+    int ret = allocateRing();
+    if (ret < 0) {
+        return ret;
+    }
+
+    m_fd = fd;
+    ssize_t size = partial.get_received_bytes(m_ring.at(m_ring_head),
+            m_ring.size());
+    if (size > 0) {
+        m_ring_head += size;
+    }
+    return 0;
+}
+
+void SerialInterface::setCutThrough(size_t cut_through)
+{
+    m_cut_through = cut_through;
+}
+
 int SerialInterface::receive()
 {
     if (m_fd < 0) {
         return -ENOTCONN;
     }
 
-    ssize_t size = read(m_fd, m_buffer, sizeof(m_buffer));
+    /* The ring may be full of frames not popped yet */
+    size_t free_space = m_ring.size() - (m_ring_head - m_ring_tail);
+    if (free_space == 0) {
+        m_read_timestamp_ns = ll_monotonic_ns();
+        parseFrames(m_read_timestamp_ns);
+        return 0;
+    }
+
+    ssize_t size = read(m_fd, m_ring.at(m_ring_head), free_space);
     if (size < 0) {
         if (errno == EAGAIN) {
             return 0;
@@ -104,33 +202,178 @@ int SerialInterface::receive()
         printf("Reached EOF on serial port\n");
         return -ENOTCONN;
     }
+    m_ring_head += size;
+
+    /* Frames completed by this read are stamped with its time */
+    m_read_timestamp_ns = ll_monotonic_ns();
+    parseFrames(m_read_timestamp_ns);
 
-    int ll_ret;
-    for (ssize_t i = 0; i < size; i++) {
-        ll_ret = m_ll_msg.append_byte(m_buffer[i]);
-        if (ll_ret != LL_MSG_OK) {
-            printf("Invalid byte received from serial (%u): %s\n",
-                    m_buffer[i], LowLevelMessage::str_error(ll_ret));
+    return 0;
+}
+
+void SerialInterface::parseFrames(uint64_t timestamp_ns)
+{
+    while (m_ring_scan < m_ring_head && m_frame_count < SERIAL_MAX_FRAMES &&
+            !m_fragment_pending) {
+        size_t slot = (m_frame_first + m_frame_count) % SERIAL_MAX_FRAMES;
+        LowLevelMessage &msg = m_frames[slot];
+        const uint8_t *data = m_ring.at(m_ring_scan);
+        size_t size = m_ring_head - m_ring_scan;
+
+        /* Next piece of the info frame forwarded cut-through */
+        if (m_info_open) {
+            const void *eof = memchr(data, '\0', size);
+            size_t n = eof == nullptr ? size :
+                    (const uint8_t *)eof - data + 1;
+            m_fragment.first = false;
+            m_fragment.last = eof != nullptr;
+            m_fragment.data = data;
+            m_fragment.size = n;
+            m_fragment_end = m_ring_scan + n;
+            m_fragment_pending = true;
+            break;
         }
-        if (m_ll_msg.ready()) {
-            m_msg_queue.push(m_ll_msg);
-            m_ll_msg.reset();
+
+        int err;
+        size_t consumed = msg.read_in_place(data, size, err);
+        if (err != LL_MSG_OK) {
+            LL_PROBE(parse_error, -1, data[consumed - 1], err);
+            LL_LOG("Invalid byte received from serial (%u): %s\n",
+                    data[consumed - 1], LowLevelMessage::str_error(err));
+        } else if (m_cut_through > 0 &&
+                (consumed == 0 || msg.is_info_frame()) &&
+                startInfoFrame(data, size, consumed, timestamp_ns)) {
+            msg.reset();
+            break;
+        } else if (consumed == 0) {
+            /* Start of a frame: wait for the rest, unless it cannot fit */
+            if (m_ring_head - m_ring_tail < m_ring.size()) {
+                break;
+            }
+            LL_LOG("Serial frame larger than %u bytes dropped\n",
+                    SERIAL_RING_SIZE);
+            consumed = 1;
+        } else {
+            msg.set_timestamp(timestamp_ns);
+            LL_PROBE(serial_frame, msg.get_client_id(), msg.get_command(),
+                    msg.get_payload_size());
+            m_frame_end[slot] = m_ring_scan + consumed;
+            m_frame_count++;
         }
+        m_ring_scan += consumed;
     }
 
-    return 0;
+    /* Bytes of invalid frames are released at once */
+    if (m_frame_count == 0) {
+        m_ring_tail = m_ring_scan;
+    }
+}
+
+bool SerialInterface::startInfoFrame(const uint8_t *data, size_t size,
+        size_t consumed, uint64_t timestamp_ns)
+{
+    size_t header_size = m_info.read_info_header(data, size);
+    if (header_size == 0 || m_info.is_broadcast()) {
+        return false;
+    }
+
+    /* A frame which cannot fit in the ring is forwarded whatever its size */
+    size_t end = consumed > 0 ? consumed : size;
+    bool ring_full = m_ring_head - m_ring_tail >= m_ring.size();
+    if (end - header_size < m_cut_through && (consumed > 0 || !ring_full)) {
+        m_info.reset();
+        return false;
+    }
+
+    LL_PROBE(serial_frame, m_info.get_client_id(), m_info.get_command(),
+            end - header_size);
+    m_fragment.client_id = m_info.get_client_id();
+    m_fragment.command = m_info.get_command();
+    m_fragment.first = true;
+    m_fragment.last = consumed > 0;
+    m_fragment.timestamp_ns = timestamp_ns;
+    m_fragment.data = data + header_size;
+    m_fragment.size = end - header_size;
+    m_fragment_end = m_ring_scan + end;
+    m_fragment_pending = true;
+    m_info_open = consumed == 0;
+    return true;
 }
 
 int SerialInterface::available() const
 {
-    return m_msg_queue.size();
+    return m_frame_count;
+}
+
+LowLevelMessage &SerialInterface::front()
+{
+    return m_frames[m_frame_first];
+}
+
+void SerialInterface::pop()
+{
+    if (m_frame_count == 0) {
+        return;
+    }
+    m_frames[m_frame_first].reset();
+    m_ring_tail = m_frame_end[m_frame_first];
+    m_frame_first = (m_frame_first + 1) % SERIAL_MAX_FRAMES;
+    m_frame_count--;
+    if (m_frame_count == 0) {
+        m_ring_tail = m_ring_scan;
+    }
+}
+
+const LowLevelInfoFragment *SerialInterface::fragment() const
+{
+    if (!m_fragment_pending || m_frame_count > 0) {
+        return nullptr;
+    }
+    return &m_fragment;
+}
+
+void SerialInterface::popFragment()
+{
+    if (!m_fragment_pending) {
+        return;
+    }
+    m_fragment_pending = false;
+    if (m_fragment.last) {
+        m_info_open = false;
+        m_info.reset();
+    }
+    m_ring_scan = m_fragment_end;
+    if (m_frame_count == 0) {
+        m_ring_tail = m_ring_scan;
+    }
+
+    /* The bytes following the piece are parsed now */
+    parseFrames(m_read_timestamp_ns);
 }
 
-LowLevelMessage SerialInterface::getLastMessage()
+int SerialInterface::allocateRing()
 {
-    LowLevelMessage ret = m_msg_queue.front();
-    m_msg_queue.pop();
-    return ret;
+    if (m_ring.allocated()) {
+        return 0;
+    }
+    return m_ring.allocate(SERIAL_RING_SIZE);
+}
+
+void SerialInterface::resetRing()
+{
+    for (size_t i = 0; i < m_frame_count; i++) {
+        m_frames[(m_frame_first + i) % SERIAL_MAX_FRAMES].reset();
+    }
+    m_ring_head = 0;
+    m_ring_scan = 0;
+    m_ring_tail = 0;
+    m_frame_first = 0;
+    m_frame_count = 0;
+    m_read_timestamp_ns = 0;
+    m_info.reset();
+    m_info_open = false;
+    m_fragment_pending = false;
+    m_fragment_end = 0;
 }
 
 int SerialInterface::sendMessage(const LowLevelMessage &message)
@@ -142,17 +385,19 @@ int SerialInterface::sendMessage(const LowLevelMessage &message)
     ssize_t size = message.get_frame_with_cid(m_buffer,
             SERIAL_INTERFACE_BUFFER_SIZE);
     if (size < 0) {
-        printf("LowLevelMessage::get_frame_with_cid: "
+        LL_LOG("LowLevelMessage::get_frame_with_cid: "
                "invalid message: %ld (%s)\n", size, strerror(-size));
         return 0;
     }
 
+    LL_PROBE(serial_send_start, message.get_client_id(),
+            message.get_command(), message.get_payload_size());
     ssize_t nb_bytes_sent = 0;
     while (nb_bytes_sent < size) {
         ssize_t ret = write(m_fd, m_buffer + nb_bytes_sent,
                 size - nb_bytes_sent);
         if (ret < 0) {
-            if (ret != EAGAIN) {
+            if (errno != EAGAIN) {
                 printf("Failed to send message on serial: %d (%s)\n", -errno,
                         strerror(errno));
                 return -errno;
@@ -164,6 +409,23 @@ int SerialInterface::sendMessage(const LowLevelMessage &message)
             nb_bytes_sent += ret;
         }
     }
+    LL_PROBE(serial_send_end, message.get_client_id(), message.get_command(),
+            message.get_payload_size());
 
     return 0;
 }
+
+int SerialInterface::pendingOutput() const
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+
+    int size = 0;
+    if (ioctl(m_fd, TIOCOUTQ, &size) < 0) {
+        printf("Failed to read serial output queue size: %d (%s)\n", -errno,
+                strerror(errno));
+        return -errno;
+    }
+    return size;
+}
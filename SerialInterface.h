@@ -1,27 +1,90 @@
 #pragma once
 
 #include <cstdint>
-#include <queue>
+#include <vector>
 #include "LowLevelMessage.h"
+#include "RingBuffer.h"
 
 #define SERIAL_INTERFACE_BUFFER_SIZE 1024
+#define SERIAL_RING_SIZE (64 * 1024)
+#define SERIAL_MAX_FRAMES 1024
+#define SERIAL_DEFAULT_CUT_THROUGH 512
 
+/* Serial input is read straight into a ring buffer, and the frames are
+ * parsed in place: front() is a message borrowing its bytes from the ring,
+ * which are released by pop() once the frame is routed.
+ *
+ * Info frames addressed to a client are forwarded cut-through once
+ * cut_through payload bytes are received (or the ring is full): instead of
+ * a frame, fragment() then gives the payload bytes received so far, and
+ * the following ones as they arrive, until the '\0' terminator. Such frames
+ * are unbounded and never buffered whole. */
 class SerialInterface
 {
 public:
     SerialInterface();
     ~SerialInterface();
 
-    int open(const char *port);
+    int open(const char *port, unsigned int baud_rate = 0);
     int close();
+
+    /* Hand the port over to another process, with the incomplete frame
+     * read so far. Returns the file descriptor, no longer owned */
+    int release(LowLevelMessage &partial);
+    int adopt(int fd, const LowLevelMessage &partial);
+
+    /* Minimum payload size of the info frames forwarded cut-through,
+     * 0 to disable */
+    void setCutThrough(size_t cut_through);
+
     int receive();
     int available() const;
-    LowLevelMessage getLastMessage();
+
+    /* Oldest frame received, valid until pop() */
+    LowLevelMessage &front();
+    void pop();
+
+    /* Next piece of the info frame being received, once every frame before
+     * it is popped; nullptr if none. Valid until popFragment() */
+    const LowLevelInfoFragment *fragment() const;
+    void popFragment();
+
     int sendMessage(const LowLevelMessage &message);
 
+    /* Number of bytes waiting in the kernel output buffer */
+    int pendingOutput() const;
+
 private:
+    int allocateRing();
+    void resetRing();
+    void parseFrames(uint64_t timestamp_ns);
+    bool startInfoFrame(const uint8_t *data, size_t size, size_t consumed,
+            uint64_t timestamp_ns);
+
     int m_fd;
-    LowLevelMessage m_ll_msg;
-    std::queue<LowLevelMessage> m_msg_queue;
+
+    /* Bytes [tail, scan) hold the frames not popped yet, [scan, head) the
+     * start of the next frame */
+    RingBuffer m_ring;
+    uint64_t m_ring_head;
+    uint64_t m_ring_scan;
+    uint64_t m_ring_tail;
+
+    /* Circular queue of the frames read, and of their end in the ring */
+    std::vector<LowLevelMessage> m_frames;
+    uint64_t m_frame_end[SERIAL_MAX_FRAMES];
+    size_t m_frame_first;
+    size_t m_frame_count;
+    uint64_t m_read_timestamp_ns;
+
+    /* Info frame forwarded cut-through, and its piece not popped yet,
+     * which ends at fragment_end in the ring */
+    size_t m_cut_through;
+    LowLevelMessage m_info;
+    bool m_info_open;
+    LowLevelInfoFragment m_fragment;
+    bool m_fragment_pending;
+    uint64_t m_fragment_end;
+
     uint8_t m_buffer[SERIAL_INTERFACE_BUFFER_SIZE];
 };
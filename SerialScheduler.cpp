@@ -0,0 +1,253 @@
+#include "SerialScheduler.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "LowLevelProtocol.h"
+#include "Probes.h"
+
+SerialScheduler::SerialScheduler()
+{
+    for (uint8_t &priority : m_priority) {
+        priority = SERIAL_DEFAULT_PRIORITY;
+    }
+    for (bool &coalesce : m_coalesce) {
+        coalesce = false;
+    }
+    m_pending = 0;
+    m_coalesced = 0;
+    m_quantum = SERIAL_DEFAULT_QUANTUM;
+    m_max_in_flight = 0;
+}
+
+SerialScheduler::~SerialScheduler() = default;
+
+int SerialScheduler::configure(const Config &config)
+{
+    for (const std::string &entry : config.getAll("serial_priority")) {
+        uint8_t first, last;
+        std::string priority;
+        if (Config::parseCommandRange(entry, first, last, priority) < 0 ||
+                priority.size() != 1 || priority[0] < '0' ||
+                priority[0] >= '0' + SERIAL_PRIORITY_CLASSES) {
+            printf("Invalid serial_priority entry: '%s'\n", entry.c_str());
+            return -EINVAL;
+        }
+        setPriority(first, last, priority[0] - '0');
+    }
+
+    for (const std::string &entry : config.getAll("serial_coalesce")) {
+        uint8_t first, last;
+        std::string arguments;
+        if (Config::parseCommandRange(entry, first, last, arguments) < 0 ||
+                !arguments.empty()) {
+            printf("Invalid serial_coalesce entry: '%s'\n", entry.c_str());
+            return -EINVAL;
+        }
+        /* The client would wait forever for the reply of a replaced frame */
+        for (unsigned int command = first; command <= last; command++) {
+            if (ll_command_spec(command).reply != LL_NO_REPLY) {
+                printf("serial_coalesce: command 0x%02X has a reply\n",
+                        command);
+                return -EINVAL;
+            }
+        }
+        setCoalesced(first, last, true);
+    }
+
+    long quantum;
+    if (config.getInt("serial_quantum", SERIAL_DEFAULT_QUANTUM,
+            quantum) < 0) {
+        return -EINVAL;
+    }
+    if (quantum <= 0) {
+        printf("Invalid serial_quantum: %ld\n", quantum);
+        return -EINVAL;
+    }
+    m_quantum = quantum;
+
+    long baud_rate;
+    long max_latency;
+    if (config.getInt("serial_baud_rate", 0, baud_rate) < 0 ||
+            config.getInt("serial_max_latency_ms",
+            SERIAL_DEFAULT_MAX_LATENCY_MS, max_latency) < 0) {
+        return -EINVAL;
+    }
+    if (baud_rate < 0 || max_latency <= 0) {
+        printf("Invalid serial pacing settings\n");
+        return -EINVAL;
+    }
+    setLinkRate(baud_rate, max_latency);
+
+    return 0;
+}
+
+void SerialScheduler::setPriority(uint8_t first, uint8_t last,
+        unsigned int priority)
+{
+    for (unsigned int command = first; command <= last; command++) {
+        m_priority[command] = priority;
+    }
+}
+
+void SerialScheduler::setCoalesced(uint8_t first, uint8_t last,
+        bool coalesced)
+{
+    for (unsigned int command = first; command <= last; command++) {
+        m_coalesce[command] = coalesced;
+    }
+}
+
+void SerialScheduler::setLinkRate(unsigned int baud_rate,
+        unsigned int max_latency_ms)
+{
+    /* 10 bits per byte: start bit, 8 data bits, stop bit */
+    m_max_in_flight = (uint64_t)baud_rate * max_latency_ms / 10000;
+}
+
+int SerialScheduler::enqueue(const LowLevelMessage &message)
+{
+    int client_id = message.get_client_id();
+    if (client_id < 0 || client_id >= SOCK_INTERFACE_MAX_CLIENTS) {
+        return -EINVAL;
+    }
+
+    PriorityClass &priority_class =
+            m_classes[m_priority[message.get_command()]];
+    ClientQueue &queue = priority_class.clients[client_id];
+
+    /* Only into the last frame, so that no other command of the client
+     * moves after the new value */
+    uint8_t command = message.get_command();
+    if (m_coalesce[command] && !queue.frames.empty() &&
+            queue.frames.back().get_command() == command) {
+        LL_PROBE(coalesce, client_id, command, message.get_payload_size());
+        queue.frames.back() = message;
+        m_coalesced++;
+        return 0;
+    }
+
+    if (queue.frames.size() >= SERIAL_MAX_PENDING_FRAMES) {
+        return -ENOBUFS;
+    }
+
+    queue.frames.push_back(message);
+    LL_PROBE(enqueue, client_id, message.get_command(),
+            message.get_payload_size());
+    if (!queue.active) {
+        queue.active = true;
+        queue.deficit = 0;
+        priority_class.active_clients.push_back(client_id);
+    }
+    m_pending++;
+    return 0;
+}
+
+void SerialScheduler::clear()
+{
+    for (PriorityClass &priority_class : m_classes) {
+        for (ClientQueue &queue : priority_class.clients) {
+            queue.frames.clear();
+            queue.deficit = 0;
+            queue.active = false;
+        }
+        priority_class.active_clients.clear();
+    }
+    m_pending = 0;
+}
+
+size_t SerialScheduler::coalesced() const
+{
+    return m_coalesced;
+}
+
+bool SerialScheduler::empty() const
+{
+    return m_pending == 0;
+}
+
+std::vector<LowLevelMessage> SerialScheduler::drain()
+{
+    std::vector<LowLevelMessage> frames;
+    for (PriorityClass &priority_class : m_classes) {
+        for (int client_id : priority_class.active_clients) {
+            ClientQueue &queue = priority_class.clients[client_id];
+            frames.insert(frames.end(), queue.frames.begin(),
+                    queue.frames.end());
+        }
+    }
+    clear();
+    return frames;
+}
+
+int SerialScheduler::transmit(SerialInterface &serial)
+{
+    if (m_pending == 0) {
+        return 0;
+    }
+
+    size_t budget = SIZE_MAX;
+    bool idle = false;
+    if (m_max_in_flight > 0) {
+        int in_flight = serial.pendingOutput();
+        if (in_flight < 0) {
+            return in_flight;
+        }
+        budget = (size_t)in_flight < m_max_in_flight ?
+                m_max_in_flight - in_flight : 0;
+        idle = (in_flight == 0);
+    }
+
+    for (PriorityClass &priority_class : m_classes) {
+        while (!priority_class.active_clients.empty()) {
+            int client_id = priority_class.active_clients.front();
+            ClientQueue &queue = priority_class.clients[client_id];
+            size_t size = frameSize(queue.frames.front());
+
+            if (queue.deficit < size) {
+                /* End of the turn of this client */
+                queue.deficit += m_quantum;
+                priority_class.active_clients.pop_front();
+                priority_class.active_clients.push_back(client_id);
+                continue;
+            }
+            /* A frame larger than the budget only goes on an idle link */
+            if (size > budget && !idle) {
+                return 0;
+            }
+
+            LL_PROBE(dequeue, client_id, queue.frames.front().get_command(),
+                    queue.frames.front().get_payload_size());
+            int ret = serial.sendMessage(queue.frames.front());
+            if (ret < 0) {
+                return ret;
+            }
+            queue.frames.pop_front();
+            queue.deficit -= size;
+            m_pending--;
+            budget = size < budget ? budget - size : 0;
+            idle = false;
+
+            if (queue.frames.empty()) {
+                queue.active = false;
+                queue.deficit = 0;
+                priority_class.active_clients.pop_front();
+            }
+        }
+    }
+
+    return 0;
+}
+
+size_t SerialScheduler::frameSize(const LowLevelMessage &message)
+{
+    /* Header, client ID, command, length and payload */
+    return message.get_payload_size() + 4;
+}
+
+SerialScheduler::ClientQueue::ClientQueue()
+{
+    deficit = 0;
+    active = false;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "Config.h"
+#include "LowLevelMessage.h"
+#include "SerialInterface.h"
+#include "SocketLimits.h"
+
+#define SERIAL_PRIORITY_CLASSES 4
+#define SERIAL_DEFAULT_PRIORITY 1
+#define SERIAL_DEFAULT_QUANTUM 64
+#define SERIAL_DEFAULT_MAX_LATENCY_MS 5
+#define SERIAL_MAX_PENDING_FRAMES 256
+
+/* Transmit scheduler placed in front of the serial port.
+ *
+ * Commands are sorted in priority classes (0 being the highest) according to
+ * their command ID. Classes are served in strict priority order, and within a
+ * class the clients are served with deficit round robin, so that a chatty
+ * client cannot starve the others.
+ * When the link rate is known, output is paced so that the kernel tty buffer
+ * never holds more than max latency worth of bytes.
+ * Commands declared idempotent (e.g. setpoints, the latest value wins) are
+ * coalesced: a newer frame replaces the last pending frame of the same client
+ * if it has the same command ID, so that a saturated link only carries fresh
+ * values. A frame queued after another command is never coalesced into an
+ * earlier one, the board receiving the commands of a client in order. */
+class SerialScheduler
+{
+public:
+    SerialScheduler();
+    ~SerialScheduler();
+
+    /* Keys: serial_priority = <first>[-<last>] <class>
+     *       serial_quantum = <bytes per client and per round>
+     *       serial_baud_rate = <bits per second, 0 for no pacing>
+     *       serial_max_latency_ms = <ms>
+     *       serial_coalesce = <first>[-<last>] */
+    int configure(const Config &config);
+
+    void setPriority(uint8_t first, uint8_t last, unsigned int priority);
+    void setCoalesced(uint8_t first, uint8_t last, bool coalesced);
+    void setLinkRate(unsigned int baud_rate, unsigned int max_latency_ms);
+
+    /* Returns -ENOBUFS if the queue of the client is full */
+    int enqueue(const LowLevelMessage &message);
+    void clear();
+
+    /* Frames replaced by a newer one before being sent */
+    size_t coalesced() const;
+    bool empty() const;
+
+    /* Remove every pending frame, in priority then arrival order */
+    std::vector<LowLevelMessage> drain();
+
+    /* Send the frames allowed by the pacing budget */
+    int transmit(SerialInterface &serial);
+
+private:
+    struct ClientQueue {
+        ClientQueue();
+        std::deque<LowLevelMessage> frames;
+        size_t deficit;
+        bool active;
+    };
+
+    struct PriorityClass {
+        ClientQueue clients[SOCK_INTERFACE_MAX_CLIENTS];
+        std::deque<int> active_clients;
+    };
+
+    static size_t frameSize(const LowLevelMessage &message);
+
+    uint8_t m_priority[256];
+    bool m_coalesce[256];
+    PriorityClass m_classes[SERIAL_PRIORITY_CLASSES];
+    size_t m_pending;
+    size_t m_coalesced;
+    size_t m_quantum;
+    size_t m_max_in_flight; /* 0: no pacing */
+};
@@ -0,0 +1,183 @@
+#include "Sessions.h"
+
+#include <cerrno>
+#include <cstdio>
+
+#define SESSION_EXPIRE_PERIOD_US 100000
+
+SessionStore::SessionStore()
+{
+    m_timeout_us = SESSION_DEFAULT_TIMEOUT_MS * 1000ULL;
+    m_buffer_size = SESSION_DEFAULT_BUFFER_SIZE;
+    m_last_expire_us = 0;
+    for (uint64_t &token : m_client_tokens) {
+        token = 0;
+    }
+}
+
+SessionStore::~SessionStore() = default;
+
+int SessionStore::configure(const Config &config)
+{
+    long timeout_ms;
+    if (config.getInt("session_timeout_ms", SESSION_DEFAULT_TIMEOUT_MS,
+            timeout_ms) < 0) {
+        return -EINVAL;
+    }
+    if (timeout_ms < 0) {
+        printf("Invalid session_timeout_ms: %ld\n", timeout_ms);
+        return -EINVAL;
+    }
+    long buffer_size;
+    if (config.getInt("session_buffer_size", SESSION_DEFAULT_BUFFER_SIZE,
+            buffer_size) < 0) {
+        return -EINVAL;
+    }
+    if (buffer_size < 0 || buffer_size > UINT16_MAX) {
+        printf("Invalid session_buffer_size: %ld\n", buffer_size);
+        return -EINVAL;
+    }
+    m_timeout_us = timeout_ms * 1000ULL;
+    m_buffer_size = buffer_size;
+    return 0;
+}
+
+SessionStore::Session *SessionStore::find(uint64_t token)
+{
+    auto it = m_sessions.find(token);
+    return it == m_sessions.end() ? nullptr : &it->second;
+}
+
+SessionStore::Session *SessionStore::ofClient(int client_id)
+{
+    uint64_t token = m_client_tokens[client_id];
+    return token == 0 ? nullptr : find(token);
+}
+
+SessionStore::Session *SessionStore::create(uint64_t token, int client_id,
+        bool replay)
+{
+    if (m_sessions.size() >= SESSION_MAX_COUNT) {
+        auto oldest = m_sessions.end();
+        for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+            if (!it->second.attached && (oldest == m_sessions.end() ||
+                    it->second.detached_us < oldest->second.detached_us)) {
+                oldest = it;
+            }
+        }
+        if (oldest == m_sessions.end()) {
+            return nullptr;
+        }
+        m_sessions.erase(oldest);
+    }
+
+    Session &session = m_sessions[token];
+    session.token = token;
+    attach(session, client_id, replay);
+    return &session;
+}
+
+void SessionStore::attach(Session &session, int client_id, bool replay)
+{
+    if (session.attached) {
+        m_client_tokens[session.client_id] = 0;
+    }
+    session.client_id = client_id;
+    session.attached = true;
+    session.replay = replay;
+    session.missed.clear();
+    session.lost = 0;
+    m_client_tokens[client_id] = session.token;
+}
+
+void SessionStore::detach(Session &session,
+        const Subscriptions::ClientState &state, uint8_t options,
+        uint64_t now_us)
+{
+    if (session.attached) {
+        m_client_tokens[session.client_id] = 0;
+    }
+    session.attached = false;
+    session.detached_us = now_us;
+    session.subscriptions = state;
+    session.options = options;
+}
+
+void SessionStore::record(const LowLevelMessage &msg)
+{
+    for (auto &entry : m_sessions) {
+        Session &session = entry.second;
+        if (session.attached || !session.replay) {
+            continue;
+        }
+        if (msg.is_data_channel_msg() ? (session.subscriptions.subscribed &
+                (1u << msg.get_data_channel())) != 0 :
+                msg.get_client_id() == session.client_id) {
+            push(session, msg);
+        }
+    }
+}
+
+bool SessionStore::expire(uint64_t now_us)
+{
+    if (now_us - m_last_expire_us < SESSION_EXPIRE_PERIOD_US) {
+        return false;
+    }
+    m_last_expire_us = now_us;
+
+    bool expired = false;
+    for (auto it = m_sessions.begin(); it != m_sessions.end();) {
+        if (!it->second.attached &&
+                now_us - it->second.detached_us > m_timeout_us) {
+            it = m_sessions.erase(it);
+            expired = true;
+        } else {
+            ++it;
+        }
+    }
+    return expired;
+}
+
+uint32_t SessionStore::detachedClients() const
+{
+    uint32_t mask = 0;
+    for (const auto &entry : m_sessions) {
+        if (!entry.second.attached) {
+            mask |= 1u << entry.second.client_id;
+        }
+    }
+    return mask;
+}
+
+void SessionStore::clear()
+{
+    m_sessions.clear();
+    for (uint64_t &token : m_client_tokens) {
+        token = 0;
+    }
+}
+
+void SessionStore::push(Session &session, const LowLevelMessage &msg)
+{
+    if (m_buffer_size == 0) {
+        session.lost++;
+        return;
+    }
+    if (session.missed.size() >= m_buffer_size) {
+        session.missed.pop_front();
+        session.lost++;
+    }
+    session.missed.push_back(msg);
+}
+
+SessionStore::Session::Session() :
+        subscriptions()
+{
+    token = 0;
+    client_id = UNKNOWN_CLIENT_ID;
+    attached = false;
+    replay = false;
+    detached_us = 0;
+    options = 0;
+    lost = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include "Config.h"
+#include "LowLevelMessage.h"
+#include "SocketLimits.h"
+#include "Subscriptions.h"
+
+#define SESSION_MAX_COUNT 64
+#define SESSION_DEFAULT_TIMEOUT_MS 10000
+#define SESSION_DEFAULT_BUFFER_SIZE 256
+
+/* Resumable client sessions (see LL_CTRL_RESUME_SESSION), by token */
+class SessionStore
+{
+public:
+    struct Session {
+        Session();
+        uint64_t token;
+        int client_id;      /* Current or last client ID */
+        bool attached;
+        bool replay;
+        uint64_t detached_us;
+        Subscriptions::ClientState subscriptions;
+        uint8_t options;
+        std::deque<LowLevelMessage> missed;
+        size_t lost;        /* Missed frames dropped from the buffer */
+    };
+
+    SessionStore();
+    ~SessionStore();
+
+    /* Keys: session_timeout_ms, session_buffer_size */
+    int configure(const Config &config);
+
+    Session *find(uint64_t token);
+    Session *ofClient(int client_id);
+
+    /* Create a session attached to the client, evicting the oldest detached
+     * session when full. Returns nullptr if every session is attached. */
+    Session *create(uint64_t token, int client_id, bool replay);
+    void attach(Session &session, int client_id, bool replay);
+    void detach(Session &session, const Subscriptions::ClientState &state,
+            uint8_t options, uint64_t now_us);
+
+    /* Buffer a frame for the detached sessions which would have received
+     * it: data-channel samples by subscription, replies by client ID */
+    void record(const LowLevelMessage &msg);
+
+    /* Remove the sessions detached for too long. Returns true if any */
+    bool expire(uint64_t now_us);
+
+    /* Client IDs of the detached sessions, to keep them free if possible */
+    uint32_t detachedClients() const;
+
+    void clear();
+
+private:
+    void push(Session &session, const LowLevelMessage &msg);
+
+    uint64_t m_timeout_us;
+    size_t m_buffer_size;
+    uint64_t m_last_expire_us;
+    std::unordered_map<uint64_t, Session> m_sessions;
+    uint64_t m_client_tokens[SOCK_INTERFACE_MAX_CLIENTS]; /* 0: none */
+};
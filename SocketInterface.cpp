@@ -4,75 +4,139 @@
 #include <cerrno>
 #include <cstring>
 #include <unistd.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
+#include "Log.h"
+
 SocketInterface::SocketInterface()
 {
     m_fd = -1;
-    for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
-        m_clients[i].message.set_client_id(i);
+    m_websocket_fd = -1;
+    m_delivery_latency = nullptr;
+    m_reserved_clients = 0;
+    m_moving_clients = 0;
+    m_local_mask = 0;
+    m_detached_local = 0;
+    for (bool &used : m_client_used) {
+        used = false;
+    }
+    for (LocalClient *&local : m_local_clients) {
+        local = nullptr;
     }
 }
 
 SocketInterface::~SocketInterface() = default;
 
-int SocketInterface::open(uint16_t server_port)
+void SocketInterface::setRealtimeSettings(const RealtimeSettings &settings,
+        LatencyHistogram *delivery_latency)
 {
-    int ret;
+    m_realtime = settings;
+    m_delivery_latency = delivery_latency;
+}
 
+int SocketInterface::open(uint16_t server_port, unsigned int worker_count,
+        uint16_t websocket_port)
+{
     // If socket already created, return error
     if (m_fd >= 0) {
         printf("Socket interface already opened\n");
         return -EEXIST;
     }
 
-    // Create the socket (non blocking)
-    m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
-    if (m_fd < 0) {
-        printf("Failed to create socket: %d (%s)\n", -errno, strerror(errno));
-        return -errno;
+    if (worker_count == 0 || worker_count > SOCK_INTERFACE_MAX_CLIENTS) {
+        printf("Invalid socket worker count (%u)\n", worker_count);
+        return -EINVAL;
     }
 
-    // Address and port conversion (string to binary data)
-    sockaddr_in server_address = {};
-    memset(&server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(server_port);
-    server_address.sin_addr.s_addr = INADDR_ANY;
-
-    // Set option: reusable addresses and ports
-    int option_value = 1;
-    ret = setsockopt(m_fd, SOL_SOCKET, (SO_REUSEADDR | SO_REUSEPORT),
-            (const char *)(&option_value), sizeof(option_value));
+    int ret = openListener(server_port);
     if (ret < 0) {
-        printf("Failed to set socket options: %d (%s)\n", -errno,
-                strerror(errno));
-        ret = -errno;
-        close();
         return ret;
     }
+    m_fd = ret;
 
-    // Bind socket to address
-    ret = bind(m_fd, (sockaddr*)(&server_address), sizeof(server_address));
-    if (ret < 0) {
-        printf("Failed to perform socket binding: %d (%s)\n", -errno,
-                strerror(errno));
-        ret = -errno;
-        close();
-        return ret;
+    if (websocket_port != 0) {
+        ret = openListener(websocket_port);
+        if (ret < 0) {
+            close();
+            return ret;
+        }
+        m_websocket_fd = ret;
     }
 
-    // Start listening
-    ret = listen(m_fd, SOCK_INTERFACE_MAX_CLIENTS);
+    return startWorkers(worker_count);
+}
+
+int SocketInterface::adopt(HandoverState &state, unsigned int worker_count,
+        uint16_t websocket_port)
+{
+    if (m_fd >= 0) {
+        printf("Socket interface already opened\n");
+        return -EEXIST;
+    }
+
+    if (worker_count == 0 || worker_count > SOCK_INTERFACE_MAX_CLIENTS) {
+        printf("Invalid socket worker count (%u)\n", worker_count);
+        return -EINVAL;
+    }
+
+    m_fd = state.listen_fd;
+    state.listen_fd = -1;
+
+    /* The WebSocket listener follows the configuration of this instance */
+    if (state.websocket_fd >= 0 && websocket_port != 0) {
+        m_websocket_fd = state.websocket_fd;
+        state.websocket_fd = -1;
+    } else if (websocket_port != 0) {
+        int ret = openListener(websocket_port);
+        if (ret < 0) {
+            close();
+            return ret;
+        }
+        m_websocket_fd = ret;
+    }
+
+    int ret = startWorkers(worker_count);
     if (ret < 0) {
-        printf("Failed to start listening on the socket: %d (%s)\n", -errno,
-                strerror(errno));
-        ret = -errno;
-        close();
         return ret;
     }
 
+    for (HandoverClient &client : state.clients) {
+        int id = client.client_id;
+        if (id < 0 || id >= SOCK_INTERFACE_MAX_CLIENTS || m_client_used[id]) {
+            continue;
+        }
+        SocketWorker::Job job(SocketWorker::Job::ATTACH, client.fd, id);
+        job.websocket = client.websocket;
+        job.snapshot = std::move(client.connection);
+        client.fd = -1;
+        m_client_used[id] = true;
+        post(id, std::move(job));
+    }
+
+    return 0;
+}
+
+int SocketInterface::startWorkers(unsigned int worker_count)
+{
+    // Start the socket workers, client i is owned by worker i % worker_count
+    m_worker_masks.assign(worker_count, 0);
+    for (size_t i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
+        m_worker_masks[i % worker_count] |= 1u << i;
+    }
+    for (unsigned int i = 0; i < worker_count; i++) {
+        m_workers.emplace_back(new SocketWorker());
+        int ret = m_workers.back()->start(i, m_realtime,
+                m_delivery_latency);
+        if (ret < 0) {
+            printf("Failed to start socket worker #%u: %d (%s)\n", i, ret,
+                    strerror(-ret));
+            close();
+            return ret;
+        }
+    }
+
     return 0;
 }
 
@@ -81,18 +145,32 @@ int SocketInterface::close()
     int ret;
     int errcode = 0;
 
-    for (size_t i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
-        if (m_clients[i].fd < 0) {
-            continue;
-        }
-        ret = ::close(m_clients[i].fd);
-        if (ret < 0) {
-            printf("Failed to close client socket: %d (%s)\n", -errno,
-                    strerror(errno));
-            errcode = -errno;
+    /* Workers close their own client sockets */
+    m_workers.clear();
+    m_worker_masks.clear();
+    for (bool &used : m_client_used) {
+        used = false;
+    }
+    m_moving_clients = 0;
+    for (LocalClient *&local : m_local_clients) {
+        if (local != nullptr) {
+            local->setClientId(UNKNOWN_CLIENT_ID);
+            local = nullptr;
         }
-        m_clients[i].fd = -1;
-        m_clients[i].message.reset();
+    }
+    m_local_mask = 0;
+    m_detached_local = 0;
+    for (std::vector<SocketWorker::Job> &jobs : m_moving_jobs) {
+        jobs.clear();
+    }
+    m_closed_clients.clear();
+    while (!m_msg_queue.empty()) {
+        m_msg_queue.pop();
+    }
+
+    /* Released by handOver() */
+    if (m_fd < 0) {
+        return 0;
     }
 
     ret = ::close(m_fd);
@@ -103,6 +181,16 @@ int SocketInterface::close()
     }
     m_fd = -1;
 
+    if (m_websocket_fd >= 0) {
+        ret = ::close(m_websocket_fd);
+        if (ret < 0) {
+            printf("Failed to close WebSocket server socket: %d (%s)\n",
+                    -errno, strerror(errno));
+            errcode = -errno;
+        }
+        m_websocket_fd = -1;
+    }
+
     return errcode;
 }
 
@@ -112,50 +200,97 @@ void SocketInterface::receive()
         return;
     }
 
+    m_closed_clients.clear();
+
     /* New clients connection */
-    int new_client = accept(m_fd, NULL, 0);
-    if (new_client < 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            printf("Failed to accept connection: %d (%s)\n", -errno,
-                    strerror(errno));
+    acceptClients(m_fd, SocketWorker::WS_NONE);
+    if (m_websocket_fd >= 0) {
+        acceptClients(m_websocket_fd, SocketWorker::WS_HANDSHAKE);
+    }
+
+    collectEvents(nullptr);
+    receiveLocal();
+}
+
+int SocketInterface::handOver(HandoverState &state)
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+
+    m_closed_clients.clear();
+
+    /* Complete the moves in progress first */
+    while (m_moving_clients != 0) {
+        flush();
+        collectEvents(nullptr);
+        sched_yield();
+    }
+
+    /* Without target, the workers answer DETACH with the whole state of
+     * the client. In-process clients stay with this instance. */
+    size_t detaching = 0;
+    for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
+        if (m_client_used[i] && !(m_local_mask & (1u << i))) {
+            post(i, SocketWorker::Job(SocketWorker::Job::DETACH, -1, i));
+            detaching++;
         }
-    } else {
-        int client_id = registerClient(new_client);
-        if (client_id < 0) {
-            printf("Failed to register new client: %d (%s)\n", client_id,
-                    strerror(-client_id));
+    }
+    flush();
+    while (detaching > 0) {
+        size_t detached = collectEvents(&state);
+        if (detached == 0) {
+            sched_yield();
         }
+        detaching -= detached;
     }
 
-    /* Read from connected clients */
-    for (size_t i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
-        if (m_clients[i].fd < 0) {
-            continue;
-        }
-        ssize_t size = recv(m_clients[i].fd, m_buffer, sizeof(m_buffer),
-                MSG_DONTWAIT);
-        if (size == 0) {
-            freeClient(i);
-        } else if (size < 0) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                printf("Failed to read from client: %d (%s)\n", -errno,
-                        strerror(errno));
-                freeClient(i);
-            }
-        } else {
-            for (ssize_t k = 0; k < size; k++) {
-                int ll_ret = m_clients[i].message.append_byte(m_buffer[k]);
-                if (ll_ret != LL_MSG_OK) {
-                    printf("Invalid byte received from client #%lu (%u): %s\n",
-                            i, m_buffer[k], LowLevelMessage::str_error(ll_ret));
-                }
-                if (m_clients[i].message.ready()) {
-                    m_msg_queue.push(m_clients[i].message);
-                    m_clients[i].message.reset();
-                }
+    state.listen_fd = m_fd;
+    state.websocket_fd = m_websocket_fd;
+    m_fd = -1;
+    m_websocket_fd = -1;
+    return 0;
+}
+
+/* Returns the number of clients detached for a handover */
+size_t SocketInterface::collectEvents(HandoverState *state)
+{
+    size_t detached = 0;
+    for (std::unique_ptr<SocketWorker> &worker : m_workers) {
+        while (SocketWorker::Event *event = worker->frontEvent()) {
+            switch (event->type) {
+                case SocketWorker::Event::MESSAGE:
+                    m_msg_queue.push(event->message);
+                    break;
+                case SocketWorker::Event::CLIENT_CLOSED:
+                    freeClient(event->client_id);
+                    m_closed_clients.push_back(event->client_id);
+                    break;
+                case SocketWorker::Event::DETACHED:
+                    if (event->target_id != UNKNOWN_CLIENT_ID) {
+                        clientMoved(*event);
+                        break;
+                    }
+                    detached++;
+                    freeClient(event->client_id);
+                    if (state != nullptr && event->fd >= 0) {
+                        state->clients.emplace_back();
+                        HandoverClient &client = state->clients.back();
+                        client.client_id = event->client_id;
+                        client.fd = event->fd;
+                        client.websocket = event->websocket;
+                        client.connection = std::move(event->snapshot);
+                    } else if (event->fd >= 0) {
+                        ::close(event->fd);
+                    }
+                    break;
+                default:
+                    break;
             }
+            worker->popEvent();
         }
     }
+    return detached;
 }
 
 int SocketInterface::available() const
@@ -183,51 +318,299 @@ void SocketInterface::sendMessage(const LowLevelMessage &message, int cid)
         client_id = message.get_client_id();
     }
     if (client_id < 0 || client_id >= SOCK_INTERFACE_MAX_CLIENTS) {
-        printf("Invalid client ID (%d)\n", client_id);
+        LL_LOG("Invalid client ID (%d)\n", client_id);
+        return;
+    }
+    if (!m_client_used[client_id]) {
+        return;
+    }
+    if (m_local_mask & (1u << client_id)) {
+        m_local_clients[client_id]->deliver(message);
         return;
     }
-    if (m_clients[client_id].fd < 0) {
+    if (m_moving_clients & (1u << client_id)) {
+        m_moving_jobs[client_id].emplace_back(message, 1u << client_id);
         return;
     }
 
-    ssize_t size = message.get_frame_without_cid(m_buffer,
-            SOCK_INTERFACE_BUFFER_SIZE);
-    if (size < 0) {
-        printf("LowLevelMessage::get_frame_without_cid: "
-               "invalid message: %ld (%s)\n", size, strerror(-size));
+    if (!workerOf(client_id).post(
+            SocketWorker::Job(message, 1u << client_id))) {
+        LL_LOG("Socket worker queue full, message to client #%d dropped\n",
+                client_id);
+    }
+}
+
+void SocketInterface::broadcastMessage(const LowLevelMessage &message,
+        uint32_t client_mask)
+{
+    if (m_fd < 0) {
         return;
     }
 
-    ssize_t nb_bytes_sent = 0;
-    while (nb_bytes_sent < size) {
-        ssize_t ret = send(m_clients[client_id].fd, m_buffer + nb_bytes_sent,
-                size - nb_bytes_sent, MSG_NOSIGNAL);
-        if (ret < 0) {
+    uint32_t local = client_mask & m_local_mask;
+    while (local != 0) {
+        int id = __builtin_ctz(local);
+        local &= local - 1;
+        m_local_clients[id]->deliver(message);
+    }
+    client_mask &= ~m_local_mask;
+    if (client_mask == 0) {
+        return;
+    }
+
+    /* Copied once out of the serial ring, shared by the workers */
+    std::shared_ptr<const LowLevelMessage> frame =
+            std::make_shared<const LowLevelMessage>(message);
+
+    uint32_t moving = client_mask & m_moving_clients;
+    while (moving != 0) {
+        int id = __builtin_ctz(moving);
+        moving &= moving - 1;
+        m_moving_jobs[id].emplace_back(frame, 1u << id);
+    }
+    client_mask &= ~m_moving_clients;
+
+    /* One job per worker, the worker performs the fan-out */
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        uint32_t mask = client_mask & m_worker_masks[i];
+        if (mask == 0) {
+            continue;
+        }
+        if (!m_workers[i]->post(SocketWorker::Job(frame, mask))) {
+            LL_LOG("Socket worker #%lu queue full, broadcast dropped\n", i);
+        }
+    }
+}
+
+void SocketInterface::sendInfoFragment(
+        const LowLevelInfoFragment &fragment, uint32_t client_mask)
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    /* Never dropped: the frame would not end */
+    while (client_mask != 0) {
+        int id = __builtin_ctz(client_mask);
+        client_mask &= client_mask - 1;
+        if (m_local_mask & (1u << id)) {
+            m_local_clients[id]->deliverFragment(fragment);
+        } else if (m_client_used[id]) {
+            post(id, SocketWorker::Job(fragment, 1u << id));
+        }
+    }
+}
+
+void SocketInterface::setClientOptions(int client_id, uint8_t options)
+{
+    if (client_id < 0 || client_id >= SOCK_INTERFACE_MAX_CLIENTS ||
+            !m_client_used[client_id] ||
+            (m_local_mask & (1u << client_id))) {
+        return;
+    }
+
+    /* Goes through the job queue to stay ordered with the frames */
+    SocketWorker::Job job(SocketWorker::Job::SET_OPTIONS, -1, client_id);
+    job.options = options;
+    post(client_id, std::move(job));
+}
+
+void SocketInterface::sendControlReply(int client_id, uint8_t opcode,
+        const uint8_t *payload, size_t size)
+{
+    if (client_id < 0 || client_id >= SOCK_INTERFACE_MAX_CLIENTS ||
+            !m_client_used[client_id] ||
+            (m_local_mask & (1u << client_id))) {
+        return;
+    }
+
+    SocketWorker::Job job(SocketWorker::Job::CONTROL_REPLY, -1, client_id);
+    if (job.message.set_frame(opcode, payload, size) < 0) {
+        return;
+    }
+    post(client_id, std::move(job));
+}
+
+bool SocketInterface::isConnected(int client_id) const
+{
+    return client_id >= 0 && client_id < SOCK_INTERFACE_MAX_CLIENTS &&
+            m_client_used[client_id];
+}
+
+int SocketInterface::moveClient(int client_id, int target_id)
+{
+    if (!isConnected(client_id) || target_id < 0 ||
+            target_id >= SOCK_INTERFACE_MAX_CLIENTS ||
+            m_client_used[target_id] ||
+            ((m_moving_clients | m_local_mask) & (1u << client_id))) {
+        return -EINVAL;
+    }
+
+    /* The worker of client_id answers with a DETACHED event, then the
+     * socket is attached to the worker of target_id */
+    m_client_used[target_id] = true;
+    m_moving_clients |= 1u << target_id;
+    SocketWorker::Job job(SocketWorker::Job::DETACH, -1, client_id);
+    job.target_id = target_id;
+    post(client_id, std::move(job));
+    return 0;
+}
+
+int SocketInterface::attachLocalClient(LocalClient *client)
+{
+    if (m_fd < 0) {
+        return -ENOTCONN;
+    }
+    if (client == nullptr) {
+        return -EINVAL;
+    }
+
+    int client_id = freeSlot();
+    if (client_id < 0) {
+        return client_id;
+    }
+    m_client_used[client_id] = true;
+    m_local_clients[client_id] = client;
+    m_local_mask |= 1u << client_id;
+    client->setClientId(client_id);
+    return client_id;
+}
+
+void SocketInterface::detachLocalClient(LocalClient *client)
+{
+    int client_id = client->clientId();
+    if (client_id < 0 || client_id >= SOCK_INTERFACE_MAX_CLIENTS ||
+            m_local_clients[client_id] != client) {
+        return;
+    }
+
+    /* The slot stays used until reported as closed */
+    m_local_clients[client_id] = nullptr;
+    m_local_mask &= ~(1u << client_id);
+    m_detached_local |= 1u << client_id;
+    client->setClientId(UNKNOWN_CLIENT_ID);
+}
+
+void SocketInterface::setReservedClients(uint32_t client_mask)
+{
+    m_reserved_clients = client_mask;
+}
+
+const std::vector<int> &SocketInterface::closedClients() const
+{
+    return m_closed_clients;
+}
+
+void SocketInterface::flush()
+{
+    for (std::unique_ptr<SocketWorker> &worker : m_workers) {
+        worker->wake();
+    }
+}
+
+int SocketInterface::openListener(uint16_t port)
+{
+    int ret;
+
+    // Create the socket (non blocking)
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+    if (fd < 0) {
+        printf("Failed to create socket: %d (%s)\n", -errno, strerror(errno));
+        return -errno;
+    }
+
+    // Address and port conversion (string to binary data)
+    sockaddr_in server_address = {};
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    server_address.sin_addr.s_addr = INADDR_ANY;
+
+    // Set option: reusable addresses and ports
+    int option_value = 1;
+    ret = setsockopt(fd, SOL_SOCKET, (SO_REUSEADDR | SO_REUSEPORT),
+            (const char *)(&option_value), sizeof(option_value));
+    if (ret < 0) {
+        printf("Failed to set socket options: %d (%s)\n", -errno,
+                strerror(errno));
+        ret = -errno;
+        ::close(fd);
+        return ret;
+    }
+
+    // Bind socket to address
+    ret = bind(fd, (sockaddr*)(&server_address), sizeof(server_address));
+    if (ret < 0) {
+        printf("Failed to perform socket binding: %d (%s)\n", -errno,
+                strerror(errno));
+        ret = -errno;
+        ::close(fd);
+        return ret;
+    }
+
+    // Start listening
+    ret = listen(fd, SOCK_INTERFACE_MAX_CLIENTS);
+    if (ret < 0) {
+        printf("Failed to start listening on the socket: %d (%s)\n", -errno,
+                strerror(errno));
+        ret = -errno;
+        ::close(fd);
+        return ret;
+    }
+
+    return fd;
+}
+
+void SocketInterface::acceptClients(int listen_fd,
+        SocketWorker::WebSocketState websocket)
+{
+    while (true) {
+        int new_client = accept4(listen_fd, NULL, 0, SOCK_NONBLOCK);
+        if (new_client < 0) {
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                printf("Failed to send message on socket: %d (%s)\n", -errno,
+                LL_LOG("Failed to accept connection: %d (%s)\n", -errno,
                         strerror(errno));
-                freeClient(client_id);
-                return;
             }
-        } else if (ret == 0) {
-            printf("Failed to send message on socket (zero bytes written)\n");
-            freeClient(client_id);
-            return;
-        } else {
-            nb_bytes_sent += ret;
+            break;
+        }
+        int client_id = registerClient(new_client, websocket);
+        if (client_id < 0) {
+            LL_LOG("Failed to register new client: %d (%s)\n", client_id,
+                    strerror(-client_id));
+            ::close(new_client);
         }
     }
 }
 
-int SocketInterface::registerClient(int fd)
+int SocketInterface::registerClient(int fd,
+        SocketWorker::WebSocketState websocket)
 {
     if (fd < 0) {
         return -EINVAL;
     }
 
-    for (size_t i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
-        if (m_clients[i].fd < 0) {
-            m_clients[i].fd = fd;
+    int client_id = freeSlot();
+    if (client_id < 0) {
+        return client_id;
+    }
+    SocketWorker::Job job(SocketWorker::Job::ATTACH, fd, client_id);
+    job.websocket = websocket;
+    if (!workerOf(client_id).post(std::move(job))) {
+        return -EAGAIN;
+    }
+    m_client_used[client_id] = true;
+    return client_id;
+}
+
+int SocketInterface::freeSlot() const
+{
+    /* Slots of the clients which may resume their session come last */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
+            if (m_client_used[i] ||
+                    (pass == 0 && (m_reserved_clients & (1u << i)))) {
+                continue;
+            }
             return i;
         }
     }
@@ -235,26 +618,77 @@ int SocketInterface::registerClient(int fd)
     return -ENOMEM;
 }
 
-int SocketInterface::freeClient(size_t id)
+/* Frames sent by the in-process clients, and those which detached */
+void SocketInterface::receiveLocal()
 {
-    if (id >= SOCK_INTERFACE_MAX_CLIENTS) {
-        return -EINVAL;
+    while (m_detached_local != 0) {
+        int id = __builtin_ctz(m_detached_local);
+        m_detached_local &= m_detached_local - 1;
+        freeClient(id);
+        m_closed_clients.push_back(id);
     }
 
-    int fd = m_clients[id].fd;
+    uint32_t local = m_local_mask;
+    while (local != 0) {
+        int id = __builtin_ctz(local);
+        local &= local - 1;
+        LocalClient *client = m_local_clients[id];
+        while (LowLevelMessage *message = client->frontSent()) {
+            m_msg_queue.push(std::move(*message));
+            m_msg_queue.back().set_client_id(id);
+            client->popSent();
+        }
+    }
+}
 
-    if (fd < 0) {
-        return 0;
+void SocketInterface::clientMoved(SocketWorker::Event &event)
+{
+    int target_id = event.target_id;
+    if (target_id < 0 || target_id >= SOCK_INTERFACE_MAX_CLIENTS) {
+        return;
+    }
+    m_moving_clients &= ~(1u << target_id);
+    std::vector<SocketWorker::Job> jobs;
+    jobs.swap(m_moving_jobs[target_id]);
+
+    if (event.fd < 0) {
+        /* The client disconnected before moving */
+        freeClient(target_id);
+        m_closed_clients.push_back(target_id);
+        return;
+    }
+
+    freeClient(event.client_id);
+    SocketWorker::Job job(SocketWorker::Job::ATTACH, event.fd, target_id);
+    job.websocket = event.websocket;
+    job.snapshot = std::move(event.snapshot);
+    post(target_id, std::move(job));
+    for (SocketWorker::Job &pending : jobs) {
+        post(target_id, std::move(pending));
     }
+}
 
-    m_clients[id].fd = -1;
-    m_clients[id].message.reset();
+/* For the jobs which must not be dropped */
+void SocketInterface::post(int client_id, SocketWorker::Job &&job)
+{
+    if (m_moving_clients & (1u << client_id)) {
+        m_moving_jobs[client_id].push_back(std::move(job));
+        return;
+    }
+    while (!workerOf(client_id).post(std::move(job))) {
+        workerOf(client_id).wake();
+        sched_yield();
+    }
+}
 
-    return ::close(fd);
+void SocketInterface::freeClient(size_t id)
+{
+    if (id < SOCK_INTERFACE_MAX_CLIENTS) {
+        m_client_used[id] = false;
+    }
 }
 
-SocketInterface::Client::Client() :
-        message(LL_MSG_SIDE_SOCKET)
+SocketWorker &SocketInterface::workerOf(int client_id)
 {
-    fd = -1;
+    return *m_workers[client_id % m_workers.size()];
 }
@@ -1,11 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <queue>
+#include <vector>
+#include "Handover.h"
+#include "LocalClient.h"
 #include "LowLevelMessage.h"
+#include "SocketWorker.h"
 
-#define SOCK_INTERFACE_MAX_CLIENTS 32
-#define SOCK_INTERFACE_BUFFER_SIZE 1024
+#define SOCK_INTERFACE_DEFAULT_WORKERS 1
 
 class SocketInterface
 {
@@ -13,25 +17,90 @@ public:
     SocketInterface();
     ~SocketInterface();
 
-    int open(uint16_t server_port);
+    /* Settings of the socket workers started by the next open() */
+    void setRealtimeSettings(const RealtimeSettings &settings,
+            LatencyHistogram *delivery_latency);
+
+    /* Clients connecting to websocket_port (0: disabled) exchange the same
+     * frames as binary WebSocket messages */
+    int open(uint16_t server_port,
+            unsigned int worker_count = SOCK_INTERFACE_DEFAULT_WORKERS,
+            uint16_t websocket_port = 0);
     int close();
+
+    /* Detach every client and release the listening sockets into state.
+     * The messages read meanwhile stay available, close() must follow */
+    int handOver(HandoverState &state);
+
+    /* Open with the listening and client sockets of state, which are then
+     * owned by the interface */
+    int adopt(HandoverState &state,
+            unsigned int worker_count = SOCK_INTERFACE_DEFAULT_WORKERS,
+            uint16_t websocket_port = 0);
     void receive();
     int available() const;
     LowLevelMessage getLastMessage();
     void sendMessage(const LowLevelMessage &message, int cid = UNKNOWN_CLIENT_ID);
+    void broadcastMessage(const LowLevelMessage &message, uint32_t client_mask);
+    void setClientOptions(int client_id, uint8_t options);
 
-private:
-    int registerClient(int fd);
-    int freeClient(size_t id);
+    /* Stream a piece of an info frame to clients, which get no other frame
+     * until the last piece (see SerialInterface.h) */
+    void sendInfoFragment(const LowLevelInfoFragment &fragment,
+            uint32_t client_mask);
+
+    /* Send a control reply record (see ControlMessage.h) to a client */
+    void sendControlReply(int client_id, uint8_t opcode,
+            const uint8_t *payload, size_t size);
+
+    bool isConnected(int client_id) const;
+
+    /* Move a client to the free slot target_id, e.g. to restore its client
+     * ID. Frames sent to target_id meanwhile are delivered once it moved. */
+    int moveClient(int client_id, int target_id);
 
-    struct Client {
-        Client();
-        int fd;
-        LowLevelMessage message;
-    };
+    /* Give an in-process client (see LocalClient.h) a client slot, until
+     * detachLocalClient() or close(). Returns its client ID */
+    int attachLocalClient(LocalClient *client);
+
+    /* Its slot is reported by closedClients() after the next receive() */
+    void detachLocalClient(LocalClient *client);
+
+    /* New clients get these slots only when no other slot is free */
+    void setReservedClients(uint32_t client_mask);
+
+    /* Clients which disconnected during the last receive() */
+    const std::vector<int> &closedClients() const;
+
+    /* Wake up the workers which received messages since the last call */
+    void flush();
+
+private:
+    static int openListener(uint16_t port);
+    int startWorkers(unsigned int worker_count);
+    size_t collectEvents(HandoverState *state);
+    void acceptClients(int listen_fd, SocketWorker::WebSocketState websocket);
+    int registerClient(int fd, SocketWorker::WebSocketState websocket);
+    int freeSlot() const;
+    void receiveLocal();
+    void clientMoved(SocketWorker::Event &event);
+    void post(int client_id, SocketWorker::Job &&job);
+    void freeClient(size_t id);
+    SocketWorker &workerOf(int client_id);
 
     int m_fd;
-    Client m_clients[SOCK_INTERFACE_MAX_CLIENTS];
+    int m_websocket_fd;
+    RealtimeSettings m_realtime;
+    LatencyHistogram *m_delivery_latency;
+    bool m_client_used[SOCK_INTERFACE_MAX_CLIENTS];
+    std::vector<std::unique_ptr<SocketWorker>> m_workers;
+    std::vector<uint32_t> m_worker_masks;
+    uint32_t m_reserved_clients;
+    uint32_t m_moving_clients;  /* Target slots of moveClient() */
+    std::vector<SocketWorker::Job> m_moving_jobs[SOCK_INTERFACE_MAX_CLIENTS];
+    std::vector<int> m_closed_clients;
+    LocalClient *m_local_clients[SOCK_INTERFACE_MAX_CLIENTS];
+    uint32_t m_local_mask;
+    uint32_t m_detached_local;  /* Not reported as closed yet */
     std::queue<LowLevelMessage> m_msg_queue;
-    uint8_t m_buffer[SOCK_INTERFACE_BUFFER_SIZE];
 };
@@ -0,0 +1,6 @@
+#pragma once
+
+/* Client slots of the socket interface, shared by the routing state indexed
+ * by client ID */
+#define SOCK_INTERFACE_MAX_CLIENTS 32
+#define SOCK_INTERFACE_BUFFER_SIZE 1024
@@ -0,0 +1,985 @@
+#include "SocketWorker.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "ControlMessage.h"
+#include "Log.h"
+#include "Probes.h"
+
+#define WAKE_EVENT_ID UINT32_MAX
+#define MAX_EPOLL_EVENTS 64
+
+/* Events one read may push: a frame completed by its first bytes, frames of
+ * 3 bytes at least, and CLIENT_CLOSED. A WebSocket read may push more, from
+ * the input buffered before it: pushEvent() then waits for room */
+#define READ_MAX_EVENTS (SOCK_INTERFACE_BUFFER_SIZE / 3 + 2)
+
+/* Prepend a binary message header to the frame, in the headroom before it */
+static size_t websocket_wrap(uint8_t *&frame, size_t size)
+{
+    uint8_t header[WEBSOCKET_MAX_HEADER_SIZE];
+    size_t header_size = websocket_frame_header(header, WS_OPCODE_BINARY,
+            size);
+    frame -= header_size;
+    memcpy(frame, header, header_size);
+    return header_size + size;
+}
+
+SocketWorker::ClientSnapshot::ClientSnapshot() :
+        message(LL_MSG_SIDE_SOCKET)
+{
+    options = 0;
+    batch_skip = 0;
+}
+
+SocketWorker::Job::Job(Type job_type, int job_fd, int job_client_id) :
+        message(LL_MSG_SIDE_SOCKET)
+{
+    type = job_type;
+    fd = job_fd;
+    client_id = job_client_id;
+    client_mask = 0;
+    options = 0;
+    target_id = UNKNOWN_CLIENT_ID;
+    websocket = WS_NONE;
+    command = 0;
+    first = false;
+    last = false;
+}
+
+SocketWorker::Job::Job(const LowLevelMessage &msg, uint32_t mask) :
+        Job(std::make_shared<const LowLevelMessage>(msg), mask)
+{
+}
+
+SocketWorker::Job::Job(const std::shared_ptr<const LowLevelMessage> &msg,
+        uint32_t mask) :
+        message(LL_MSG_SIDE_SOCKET),
+        frame(msg)
+{
+    type = SEND;
+    fd = -1;
+    client_id = UNKNOWN_CLIENT_ID;
+    client_mask = mask;
+    options = 0;
+    target_id = UNKNOWN_CLIENT_ID;
+    websocket = WS_NONE;
+    command = 0;
+    first = false;
+    last = false;
+}
+
+SocketWorker::Job::Job(const LowLevelInfoFragment &info, uint32_t mask) :
+        message(LL_MSG_SIDE_SOCKET),
+        fragment(info.data, info.data + info.size)
+{
+    type = STREAM;
+    fd = -1;
+    client_id = UNKNOWN_CLIENT_ID;
+    client_mask = mask;
+    options = 0;
+    target_id = UNKNOWN_CLIENT_ID;
+    websocket = WS_NONE;
+    command = info.command;
+    first = info.first;
+    last = info.last;
+    message.set_timestamp(info.timestamp_ns);
+}
+
+SocketWorker::Event::Event(Type event_type, int event_client_id) :
+        message(LL_MSG_SIDE_SOCKET)
+{
+    type = event_type;
+    client_id = event_client_id;
+    fd = -1;
+    target_id = UNKNOWN_CLIENT_ID;
+    websocket = WS_NONE;
+}
+
+SocketWorker::Event::Event(const LowLevelMessage &msg) :
+        message(msg)
+{
+    type = MESSAGE;
+    client_id = msg.get_client_id();
+    fd = -1;
+    target_id = UNKNOWN_CLIENT_ID;
+    websocket = WS_NONE;
+}
+
+SocketWorker::SocketWorker() :
+        m_jobs(SOCK_WORKER_QUEUE_SIZE),
+        m_events(SOCK_WORKER_QUEUE_SIZE)
+{
+    m_index = 0;
+    m_delivery_latency = nullptr;
+    m_epoll_fd = -1;
+    m_wake_fd = -1;
+    m_running = false;
+    m_wake_pending = false;
+    m_paused_clients = 0;
+    for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
+        m_clients[i].message.set_client_id(i);
+    }
+}
+
+SocketWorker::~SocketWorker()
+{
+    stop();
+}
+
+int SocketWorker::start(unsigned int index, const RealtimeSettings &settings,
+        LatencyHistogram *delivery_latency)
+{
+    if (m_running) {
+        return -EEXIST;
+    }
+
+    m_index = index;
+    m_settings = settings;
+    m_delivery_latency = delivery_latency;
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd < 0) {
+        printf("Failed to create epoll instance: %d (%s)\n", -errno,
+                strerror(errno));
+        return -errno;
+    }
+
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd < 0) {
+        printf("Failed to create eventfd: %d (%s)\n", -errno,
+                strerror(errno));
+        int ret = -errno;
+        ::close(m_epoll_fd);
+        m_epoll_fd = -1;
+        return ret;
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = WAKE_EVENT_ID;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev) < 0) {
+        printf("Failed to register eventfd: %d (%s)\n", -errno,
+                strerror(errno));
+        int ret = -errno;
+        ::close(m_wake_fd);
+        ::close(m_epoll_fd);
+        m_wake_fd = -1;
+        m_epoll_fd = -1;
+        return ret;
+    }
+
+    m_running = true;
+    m_thread = std::thread(&SocketWorker::run, this);
+    return 0;
+}
+
+void SocketWorker::stop()
+{
+    if (m_thread.joinable()) {
+        m_running = false;
+        m_wake_pending = true;
+        wake();
+        m_thread.join();
+    }
+    m_running = false;
+
+    /* Drop the jobs the worker did not process */
+    while (Job *job = m_jobs.front()) {
+        if (job->type == Job::ATTACH && job->fd >= 0) {
+            ::close(job->fd);
+        }
+        m_jobs.pop();
+    }
+    while (m_events.front() != nullptr) {
+        m_events.pop();
+    }
+
+    for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
+        if (m_clients[i].fd >= 0) {
+            if (::close(m_clients[i].fd) < 0) {
+                LL_LOG("Failed to close client socket: %d (%s)\n", -errno,
+                        strerror(errno));
+            }
+            m_clients[i].fd = -1;
+        }
+        resetClient(i);
+        m_clients[i].dirty = false;
+    }
+    m_dirty_clients.clear();
+
+    if (m_wake_fd >= 0) {
+        ::close(m_wake_fd);
+        m_wake_fd = -1;
+    }
+    if (m_epoll_fd >= 0) {
+        ::close(m_epoll_fd);
+        m_epoll_fd = -1;
+    }
+}
+
+bool SocketWorker::post(Job &&job)
+{
+    if (!m_jobs.emplace(std::move(job))) {
+        return false;
+    }
+    m_wake_pending = true;
+    return true;
+}
+
+void SocketWorker::wake()
+{
+    if (!m_wake_pending || m_wake_fd < 0) {
+        return;
+    }
+    m_wake_pending = false;
+    uint64_t value = 1;
+    if (write(m_wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        LL_LOG("Failed to wake socket worker #%u: %d (%s)\n", m_index,
+                -errno, strerror(errno));
+    }
+}
+
+SocketWorker::Event *SocketWorker::frontEvent()
+{
+    return m_events.front();
+}
+
+void SocketWorker::popEvent()
+{
+    m_events.pop();
+}
+
+void SocketWorker::run()
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+    m_settings.applyToThread(1 + m_index);
+    int timeout_ms = m_settings.busy_poll ? 0 : -1;
+
+    while (m_running) {
+        /* The router does not wake the worker up when it drains the
+         * events: check again shortly while clients are paused */
+        int n = epoll_wait(m_epoll_fd, events, MAX_EPOLL_EVENTS,
+                (m_paused_clients != 0 && timeout_ms < 0) ? 1 : timeout_ms);
+        if (n < 0) {
+            if (errno != EINTR) {
+                LL_LOG("Socket worker #%u: epoll_wait failed: %d (%s)\n",
+                        m_index, -errno, strerror(errno));
+            }
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint32_t id = events[i].data.u32;
+            if (id == WAKE_EVENT_ID) {
+                uint64_t value;
+                if (read(m_wake_fd, &value, sizeof(value)) < 0 &&
+                        errno != EAGAIN) {
+                    LL_LOG("Socket worker #%u: failed to read eventfd: "
+                           "%d (%s)\n", m_index, -errno, strerror(errno));
+                }
+                continue;
+            }
+            if (id >= SOCK_INTERFACE_MAX_CLIENTS || m_clients[id].fd < 0) {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flushClient(id);
+            }
+            if (m_clients[id].fd >= 0 &&
+                    (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                readClient(id);
+            }
+        }
+
+        resumeReading();
+
+        while (Job *job = m_jobs.front()) {
+            handleJob(*job);
+            m_jobs.pop();
+        }
+
+        /* One send() per client and per loop iteration. Still dirty while
+         * flushed, as closing a batch queues it */
+        for (int client_id : m_dirty_clients) {
+            flushClient(client_id);
+            m_clients[client_id].dirty = false;
+        }
+        m_dirty_clients.clear();
+
+        if (!m_sent_timestamps.empty()) {
+            uint64_t now_ns = ll_monotonic_ns();
+            for (uint64_t timestamp_ns : m_sent_timestamps) {
+                m_delivery_latency->add(now_ns - timestamp_ns);
+            }
+            m_sent_timestamps.clear();
+        }
+    }
+}
+
+void SocketWorker::handleJob(Job &job)
+{
+    switch (job.type) {
+        case Job::ATTACH: {
+            int id = job.client_id;
+            if (id < 0 || id >= SOCK_INTERFACE_MAX_CLIENTS ||
+                    m_clients[id].fd >= 0) {
+                LL_LOG("Socket worker #%u: cannot attach client #%d\n",
+                        m_index, id);
+                ::close(job.fd);
+                pushEvent(Event(Event::CLIENT_CLOSED, id));
+                return;
+            }
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.u32 = id;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, job.fd, &ev) < 0) {
+                LL_LOG("Socket worker #%u: failed to register client: "
+                       "%d (%s)\n", m_index, -errno, strerror(errno));
+                ::close(job.fd);
+                pushEvent(Event(Event::CLIENT_CLOSED, id));
+                return;
+            }
+            if (m_settings.busy_poll && setsockopt(job.fd, SOL_SOCKET,
+                    SO_BUSY_POLL, &m_settings.busy_poll_us,
+                    sizeof(m_settings.busy_poll_us)) < 0) {
+                LL_LOG("Socket worker #%u: failed to set SO_BUSY_POLL: "
+                       "%d (%s)\n", m_index, -errno, strerror(errno));
+            }
+            Client &client = m_clients[id];
+            client.fd = job.fd;
+            client.registered = true;
+            client.websocket = job.websocket;
+            if (job.snapshot) {
+                ClientSnapshot &snapshot = *job.snapshot;
+                client.options = snapshot.options;
+                client.batch_skip = snapshot.batch_skip;
+                client.encoder = std::move(snapshot.encoder);
+                client.message = snapshot.message;
+                client.message.set_client_id(id);
+                client.input = std::move(snapshot.input);
+                client.output = std::move(snapshot.output);
+                if (!client.output.empty() && !client.dirty) {
+                    client.dirty = true;
+                    m_dirty_clients.push_back(id);
+                }
+            }
+            break;
+        }
+        case Job::SET_OPTIONS: {
+            int id = job.client_id;
+            if (id < 0 || id >= SOCK_INTERFACE_MAX_CLIENTS ||
+                    m_clients[id].fd < 0) {
+                return;
+            }
+            /* The records queued so far follow the previous options */
+            closeBatch(id);
+            if ((job.options ^ m_clients[id].options) &
+                    LL_SESSION_COMPRESSION) {
+                m_clients[id].encoder.reset();
+            }
+            m_clients[id].options = job.options;
+            break;
+        }
+        case Job::DETACH: {
+            int id = job.client_id;
+            Event event(Event::DETACHED, id);
+            event.target_id = job.target_id;
+            if (id >= 0 && id < SOCK_INTERFACE_MAX_CLIENTS &&
+                    m_clients[id].fd >= 0) {
+                /* Best effort for the frames already queued */
+                if (m_clients[id].streaming) {
+                    endStream(id, true);
+                }
+                flushClient(id);
+            }
+            if (id >= 0 && id < SOCK_INTERFACE_MAX_CLIENTS &&
+                    m_clients[id].fd >= 0) {
+                Client &client = m_clients[id];
+                epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, client.fd, nullptr);
+                event.fd = client.fd;
+                event.websocket = client.websocket;
+                event.snapshot.reset(new ClientSnapshot());
+                event.snapshot->options = client.options;
+                event.snapshot->batch_skip = client.batch_skip;
+                event.snapshot->encoder = std::move(client.encoder);
+                event.snapshot->message = client.message;
+                event.snapshot->input = std::move(client.input);
+                event.snapshot->output = std::move(client.output);
+                client.fd = -1;
+                resetClient(id);
+            }
+            pushEvent(std::move(event));
+            break;
+        }
+        case Job::CONTROL_REPLY: {
+            int id = job.client_id;
+            uint8_t *frame = m_send_buffer + WEBSOCKET_MAX_HEADER_SIZE;
+            ssize_t size = job.message.get_frame_without_cid(frame,
+                    SOCK_INTERFACE_BUFFER_SIZE);
+            if (id < 0 || id >= SOCK_INTERFACE_MAX_CLIENTS || size < 0 ||
+                    m_clients[id].websocket == WS_HANDSHAKE) {
+                return;
+            }
+            frame[0] = LL_CTRL_REPLY_HEADER_BYTE;
+            if (m_clients[id].websocket == WS_OPEN &&
+                    !(m_clients[id].options & LL_SESSION_BATCH)) {
+                size = websocket_wrap(frame, size);
+            }
+            queueRecord(id, frame, size);
+            break;
+        }
+        case Job::SEND: {
+            const LowLevelMessage &message = *job.frame;
+            uint8_t *frame = m_send_buffer + WEBSOCKET_MAX_HEADER_SIZE;
+            ssize_t size = message.get_frame_without_cid(frame,
+                    SOCK_INTERFACE_BUFFER_SIZE);
+            if (size < 0) {
+                LL_LOG("LowLevelMessage::get_frame_without_cid: "
+                       "invalid message: %ld (%s)\n", size, strerror(-size));
+                return;
+            }
+
+            if (m_delivery_latency != nullptr &&
+                    message.get_timestamp() != 0) {
+                m_sent_timestamps.push_back(message.get_timestamp());
+            }
+
+            /* Framed once for all the WebSocket recipients */
+            uint8_t *websocket_frame = nullptr;
+            size_t websocket_size = 0;
+
+            uint32_t mask = job.client_mask;
+            while (mask != 0) {
+                int id = __builtin_ctz(mask);
+                mask &= mask - 1;
+                Client &client = m_clients[id];
+                if (client.websocket == WS_HANDSHAKE) {
+                    continue;
+                }
+                bool batch = client.options & LL_SESSION_BATCH;
+                bool websocket = client.websocket == WS_OPEN && !batch;
+                const uint8_t *body = frame;
+                size_t body_size = size;
+                if (client.options & LL_SESSION_COMPRESSION) {
+                    ssize_t encoded = client.encoder.encode(message,
+                            m_encode_buffer, sizeof(m_encode_buffer));
+                    if (encoded > 0) {
+                        body = m_encode_buffer;
+                        body_size = encoded;
+                    }
+                }
+
+                if (!(client.options & LL_SESSION_TIMESTAMPS)) {
+                    if (!websocket) {
+                        queueRecord(id, body, body_size);
+                        continue;
+                    } else if (body == frame) {
+                        if (websocket_frame == nullptr) {
+                            websocket_frame = frame;
+                            websocket_size = websocket_wrap(websocket_frame,
+                                    size);
+                        }
+                        queueFrame(id, websocket_frame, websocket_size);
+                        continue;
+                    }
+                }
+
+                /* Per-client prefix: WebSocket header, timestamp record */
+                uint8_t prefix[WEBSOCKET_MAX_HEADER_SIZE +
+                        LL_TIMESTAMP_RECORD_SIZE];
+                size_t record_size = (client.options & LL_SESSION_TIMESTAMPS)
+                        ? LL_TIMESTAMP_RECORD_SIZE : 0;
+                size_t prefix_size = 0;
+                if (websocket) {
+                    prefix_size = websocket_frame_header(prefix,
+                            WS_OPCODE_BINARY, record_size + body_size);
+                }
+                if (record_size > 0) {
+                    ll_write_timestamp_record(prefix + prefix_size,
+                            message.get_timestamp());
+                    prefix_size += record_size;
+                }
+                queueRecord(id, body, body_size, prefix, prefix_size);
+            }
+            break;
+        }
+        case Job::STREAM: {
+            uint32_t mask = job.client_mask;
+            while (mask != 0) {
+                int id = __builtin_ctz(mask);
+                mask &= mask - 1;
+                streamFragment(id, job);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void SocketWorker::readClient(int client_id)
+{
+    Client &client = m_clients[client_id];
+
+    /* Leave the bytes in the kernel while the router is lagging behind */
+    if (m_events.capacity() - m_events.size() < READ_MAX_EVENTS) {
+        client.paused = true;
+        m_paused_clients |= 1u << client_id;
+        updateEvents(client_id);
+        return;
+    }
+
+    ssize_t size = recv(client.fd, m_buffer, sizeof(m_buffer), MSG_DONTWAIT);
+    if (size == 0) {
+        closeClient(client_id);
+        return;
+    } else if (size < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LL_LOG("Failed to read from client: %d (%s)\n", -errno,
+                    strerror(errno));
+            closeClient(client_id);
+        }
+        return;
+    }
+
+    /* Frames completed by this read are stamped with its time */
+    uint64_t timestamp_ns = ll_monotonic_ns();
+    if (client.websocket == WS_NONE) {
+        parseFrames(client_id, m_buffer, size, timestamp_ns);
+    } else {
+        readWebSocket(client_id, m_buffer, size, timestamp_ns);
+    }
+}
+
+void SocketWorker::parseFrames(int client_id, const uint8_t *data,
+        size_t size, uint64_t timestamp_ns)
+{
+    Client &client = m_clients[client_id];
+    size_t k = 0;
+    while (k < size) {
+        /* Batch records are transparent: their frames are parsed as usual */
+        if (client.batch_skip > 0) {
+            client.batch_skip--;
+            k++;
+            continue;
+        }
+        if (data[k] == LL_BATCH_HEADER_BYTE && client.message.empty()) {
+            client.batch_skip = LL_BATCH_HEADER_SIZE - 1;
+            k++;
+            continue;
+        }
+
+        int ll_ret;
+        k += client.message.append_bytes(data + k, size - k, ll_ret);
+        if (ll_ret != LL_MSG_OK) {
+            LL_PROBE(parse_error, client_id, data[k - 1], ll_ret);
+            LL_LOG("Invalid byte received from client #%d (%u): %s\n",
+                    client_id, data[k - 1],
+                    LowLevelMessage::str_error(ll_ret));
+        }
+        if (client.message.ready()) {
+            client.message.set_timestamp(timestamp_ns);
+            LL_PROBE(socket_frame, client_id, client.message.get_command(),
+                    client.message.get_payload_size());
+            pushEvent(Event(client.message));
+            client.message.reset();
+        }
+    }
+}
+
+void SocketWorker::readWebSocket(int client_id, const uint8_t *data,
+        size_t size, uint64_t timestamp_ns)
+{
+    Client &client = m_clients[client_id];
+    client.input.insert(client.input.end(), data, data + size);
+
+    if (client.websocket == WS_HANDSHAKE) {
+        std::string request(client.input.begin(), client.input.end());
+        size_t end = request.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (request.size() > WEBSOCKET_MAX_HANDSHAKE_SIZE) {
+                LL_LOG("WebSocket handshake too long from client #%d\n",
+                        client_id);
+                closeClient(client_id);
+            }
+            return;
+        }
+        end += 4;
+
+        std::string response;
+        int ret = websocket_handshake(request.substr(0, end), response);
+        queueFrame(client_id, (const uint8_t *)response.data(),
+                response.size());
+        if (ret < 0) {
+            LL_LOG("Invalid WebSocket handshake from client #%d\n",
+                    client_id);
+            flushClient(client_id);
+            closeClient(client_id);
+            return;
+        }
+        client.websocket = WS_OPEN;
+        client.input.erase(client.input.begin(), client.input.begin() + end);
+    }
+
+    /* Message boundaries are irrelevant: the payloads form a byte stream */
+    size_t k = 0;
+    while (k < client.input.size()) {
+        WebSocketFrame frame;
+        ssize_t ret = websocket_parse_frame(client.input.data() + k,
+                client.input.size() - k, frame);
+        if (ret == 0) {
+            break;
+        } else if (ret < 0) {
+            LL_LOG("Invalid WebSocket frame from client #%d\n", client_id);
+            closeClient(client_id);
+            return;
+        }
+        k += ret;
+
+        switch (frame.opcode) {
+            case WS_OPCODE_CONTINUATION:
+            case WS_OPCODE_BINARY:
+                parseFrames(client_id, frame.payload, frame.payload_size,
+                        timestamp_ns);
+                break;
+            case WS_OPCODE_PING:
+                queueWebSocketControl(client_id, WS_OPCODE_PONG,
+                        frame.payload, frame.payload_size);
+                break;
+            case WS_OPCODE_CLOSE:
+                queueWebSocketControl(client_id, WS_OPCODE_CLOSE,
+                        frame.payload, frame.payload_size < 2 ? 0 : 2);
+                flushClient(client_id);
+                closeClient(client_id);
+                return;
+            default:
+                break;
+        }
+    }
+    client.input.erase(client.input.begin(), client.input.begin() + k);
+}
+
+void SocketWorker::queueFrame(int client_id, const uint8_t *frame,
+        size_t size, const uint8_t *prefix, size_t prefix_size)
+{
+    Client &client = m_clients[client_id];
+    if (!appendOutput(client_id, client.streaming ? client.held :
+            client.output, frame, size, prefix, prefix_size)) {
+        LL_LOG("Output buffer full for client #%d, frame dropped\n",
+                client_id);
+    }
+}
+
+bool SocketWorker::appendOutput(int client_id, std::vector<uint8_t> &output,
+        const uint8_t *frame, size_t size, const uint8_t *prefix,
+        size_t prefix_size)
+{
+    Client &client = m_clients[client_id];
+    if (client.fd < 0) {
+        return true;
+    }
+    if (output.size() + prefix_size + size > SOCK_WORKER_MAX_OUTPUT) {
+        /* The compressed frames refer to the frames dropped */
+        client.encoder.resync();
+        return false;
+    }
+    if (prefix_size > 0) {
+        output.insert(output.end(), prefix, prefix + prefix_size);
+    }
+    output.insert(output.end(), frame, frame + size);
+    if (!client.dirty && !client.want_write) {
+        client.dirty = true;
+        m_dirty_clients.push_back(client_id);
+    }
+    return true;
+}
+
+void SocketWorker::queueRecord(int client_id, const uint8_t *record,
+        size_t size, const uint8_t *prefix, size_t prefix_size)
+{
+    Client &client = m_clients[client_id];
+    if (!(client.options & LL_SESSION_BATCH)) {
+        queueFrame(client_id, record, size, prefix, prefix_size);
+        return;
+    }
+    if (client.fd < 0) {
+        return;
+    }
+
+    if (client.batch.size() + prefix_size + size > LL_BATCH_MAX_SIZE) {
+        if (client.streaming) {
+            LL_LOG("Batch full for client #%d, frame dropped\n", client_id);
+            client.encoder.resync();
+            return;
+        }
+        closeBatch(client_id);
+    }
+    if (prefix_size > 0) {
+        client.batch.insert(client.batch.end(), prefix, prefix + prefix_size);
+    }
+    client.batch.insert(client.batch.end(), record, record + size);
+    if (!client.dirty && !client.want_write) {
+        client.dirty = true;
+        m_dirty_clients.push_back(client_id);
+    }
+}
+
+void SocketWorker::closeBatch(int client_id)
+{
+    Client &client = m_clients[client_id];
+    if (client.batch.empty() || client.streaming) {
+        return;
+    }
+
+    uint8_t header[WEBSOCKET_MAX_HEADER_SIZE + LL_BATCH_HEADER_SIZE];
+    size_t header_size = 0;
+    if (client.websocket == WS_OPEN) {
+        header_size = websocket_frame_header(header, WS_OPCODE_BINARY,
+                LL_BATCH_HEADER_SIZE + client.batch.size());
+    }
+    ll_write_batch_header(header + header_size, client.batch.size());
+    header_size += LL_BATCH_HEADER_SIZE;
+    queueFrame(client_id, client.batch.data(), client.batch.size(), header,
+            header_size);
+    client.batch.clear();
+}
+
+void SocketWorker::queueWebSocketControl(int client_id,
+        WebSocketOpcode opcode, const uint8_t *payload, size_t size)
+{
+    uint8_t frame[WEBSOCKET_MAX_HEADER_SIZE + 125];
+    size_t header_size = websocket_frame_header(frame, opcode, size);
+    memcpy(frame + header_size, payload, size);
+
+    /* Control frames may come between the fragments of a message */
+    Client &client = m_clients[client_id];
+    if (!appendOutput(client_id, client.output, frame, header_size + size)) {
+        LL_LOG("Output buffer full for client #%d, frame dropped\n",
+                client_id);
+    }
+}
+
+/* The pieces of an info frame are sent as they come, as fragments of a
+ * single message to WebSocket clients and outside of any batch record */
+void SocketWorker::streamFragment(int client_id, const Job &job)
+{
+    Client &client = m_clients[client_id];
+    if (client.fd < 0 || client.websocket == WS_HANDSHAKE) {
+        return;
+    }
+    if (job.first) {
+        if (client.streaming) {
+            endStream(client_id, true);
+        }
+        closeBatch(client_id);
+        client.streaming = true;
+    } else if (!client.streaming) {
+        /* Truncated, or the client was not there at the first piece */
+        return;
+    }
+
+    /* Prefix: WebSocket header, timestamp record, frame header */
+    uint8_t head[LL_TIMESTAMP_RECORD_SIZE + 3];
+    size_t head_size = 0;
+    if (job.first) {
+        if (client.options & LL_SESSION_TIMESTAMPS) {
+            ll_write_timestamp_record(head, job.message.get_timestamp());
+            head_size += LL_TIMESTAMP_RECORD_SIZE;
+        }
+        head[head_size++] = 0xFF;
+        head[head_size++] = job.command;
+        head[head_size++] = 0xFF;
+    }
+    uint8_t prefix[WEBSOCKET_MAX_HEADER_SIZE + sizeof(head)];
+    size_t prefix_size = 0;
+    if (client.websocket == WS_OPEN) {
+        prefix_size = websocket_frame_header(prefix, job.first ?
+                WS_OPCODE_BINARY : WS_OPCODE_CONTINUATION,
+                head_size + job.fragment.size(), job.last);
+    }
+    memcpy(prefix + prefix_size, head, head_size);
+    prefix_size += head_size;
+
+    if (!appendOutput(client_id, client.output, job.fragment.data(),
+            job.fragment.size(), prefix, prefix_size)) {
+        LL_LOG("Output buffer full for client #%d, info frame truncated\n",
+                client_id);
+        endStream(client_id, !job.first);
+    } else if (job.last) {
+        endStream(client_id, false);
+    }
+}
+
+/* Send the frames held during the stream, after terminating the info frame
+ * if it is truncated */
+void SocketWorker::endStream(int client_id, bool truncate)
+{
+    Client &client = m_clients[client_id];
+    if (truncate) {
+        uint8_t end[WEBSOCKET_MAX_HEADER_SIZE + 1];
+        size_t size = 0;
+        if (client.websocket == WS_OPEN) {
+            size = websocket_frame_header(end, WS_OPCODE_CONTINUATION, 1);
+        }
+        end[size++] = '\0';
+        client.output.insert(client.output.end(), end, end + size);
+    }
+    client.streaming = false;
+    if (!appendOutput(client_id, client.output, client.held.data(),
+            client.held.size())) {
+        LL_LOG("Output buffer full for client #%d, frames dropped\n",
+                client_id);
+    }
+    client.held.clear();
+}
+
+void SocketWorker::flushClient(int client_id)
+{
+    Client &client = m_clients[client_id];
+    if (client.fd < 0) {
+        return;
+    }
+
+    closeBatch(client_id);
+    LL_PROBE(client_send_start, client_id, -1, client.output.size());
+    size_t nb_bytes_sent = 0;
+    while (nb_bytes_sent < client.output.size()) {
+        ssize_t ret = send(client.fd, client.output.data() + nb_bytes_sent,
+                client.output.size() - nb_bytes_sent,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            LL_LOG("Failed to send message on socket: %d (%s)\n", -errno,
+                    strerror(errno));
+            closeClient(client_id);
+            return;
+        } else if (ret == 0) {
+            LL_LOG("Failed to send message on socket (zero bytes written)\n");
+            closeClient(client_id);
+            return;
+        }
+        nb_bytes_sent += ret;
+    }
+    LL_PROBE(client_send_end, client_id, -1, nb_bytes_sent);
+    client.output.erase(client.output.begin(),
+            client.output.begin() + nb_bytes_sent);
+
+    /* Wait for the socket to be writable again if the kernel is full */
+    bool want_write = !client.output.empty();
+    if (want_write != client.want_write) {
+        client.want_write = want_write;
+        updateEvents(client_id);
+    }
+}
+
+void SocketWorker::updateEvents(int client_id)
+{
+    Client &client = m_clients[client_id];
+    epoll_event ev = {};
+    ev.events = (client.paused ? 0u : (uint32_t)EPOLLIN) |
+            (client.want_write ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.u32 = client_id;
+
+    /* Without any event, out of the interest list: EPOLLHUP would still be
+     * reported, at once and each time */
+    int op = client.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (ev.events == 0) {
+        op = EPOLL_CTL_DEL;
+    }
+    if (op == EPOLL_CTL_DEL && !client.registered) {
+        return;
+    }
+    client.registered = op != EPOLL_CTL_DEL;
+    if (epoll_ctl(m_epoll_fd, op, client.fd, &ev) < 0) {
+        LL_LOG("Socket worker #%u: failed to update client: %d (%s)\n",
+                m_index, -errno, strerror(errno));
+    }
+}
+
+/* Read the paused clients again once the router drained the events */
+void SocketWorker::resumeReading()
+{
+    if (m_paused_clients == 0 ||
+            m_events.capacity() - m_events.size() < READ_MAX_EVENTS) {
+        return;
+    }
+    while (m_paused_clients != 0) {
+        int client_id = __builtin_ctz(m_paused_clients);
+        m_paused_clients &= m_paused_clients - 1;
+        Client &client = m_clients[client_id];
+        if (client.fd >= 0 && client.paused) {
+            client.paused = false;
+            updateEvents(client_id);
+        }
+    }
+}
+
+void SocketWorker::closeClient(int client_id)
+{
+    Client &client = m_clients[client_id];
+    if (client.fd < 0) {
+        return;
+    }
+
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, client.fd, nullptr);
+    ::close(client.fd);
+    client.fd = -1;
+    resetClient(client_id);
+
+    pushEvent(Event(Event::CLIENT_CLOSED, client_id));
+}
+
+/* The dirty flag is left as is: the client may be in m_dirty_clients */
+void SocketWorker::resetClient(int client_id)
+{
+    Client &client = m_clients[client_id];
+    client.message.reset();
+    client.output.clear();
+    client.want_write = false;
+    client.registered = false;
+    client.paused = false;
+    m_paused_clients &= ~(1u << client_id);
+    client.options = 0;
+    client.encoder.reset();
+    client.websocket = WS_NONE;
+    client.input.clear();
+    client.batch.clear();
+    client.batch_skip = 0;
+    client.streaming = false;
+    client.held.clear();
+}
+
+void SocketWorker::pushEvent(Event &&event)
+{
+    /* The router drains the queue at each loop iteration */
+    while (!m_events.emplace(std::move(event))) {
+        if (!m_running) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+SocketWorker::Client::Client() :
+        message(LL_MSG_SIDE_SOCKET)
+{
+    fd = -1;
+    dirty = false;
+    want_write = false;
+    registered = false;
+    paused = false;
+    options = 0;
+    websocket = WS_NONE;
+    batch_skip = 0;
+    streaming = false;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "LatencyHistogram.h"
+#include "LowLevelMessage.h"
+#include "Realtime.h"
+#include "SocketLimits.h"
+#include "SpscQueue.h"
+#include "TelemetryCodec.h"
+#include "WebSocket.h"
+
+#define SOCK_WORKER_QUEUE_SIZE 4096
+#define SOCK_WORKER_MAX_OUTPUT (256 * 1024)
+
+/* Socket reactor running in its own thread. Each worker owns a subset of the
+ * clients: it reads their frames, and writes the frames the router posts to
+ * it through a lock-free queue, using one output buffer per client. */
+class SocketWorker
+{
+public:
+    enum WebSocketState {
+        WS_NONE,      /* Plain TCP client */
+        WS_HANDSHAKE, /* Waiting for the HTTP upgrade request */
+        WS_OPEN,      /* Frames carried as binary messages */
+    };
+
+    /* Connection state of a client detached from its worker, which its next
+     * worker resumes from */
+    struct ClientSnapshot {
+        ClientSnapshot();
+        uint8_t options;
+        uint8_t batch_skip;             /* Of an incomplete batch header */
+        TelemetryEncoder encoder;
+        LowLevelMessage message;        /* Incomplete frame */
+        std::vector<uint8_t> input;     /* Incomplete WebSocket frame */
+        std::vector<uint8_t> output;    /* Not sent yet */
+    };
+
+    /* Router -> worker */
+    struct Job {
+        enum Type {
+            ATTACH, /* Take ownership of a new client socket */
+            SEND,   /* Send a message to every client of client_mask */
+            SET_OPTIONS, /* Apply session options to a client */
+            DETACH, /* Hand the socket of a client back, to move it to the
+                     * slot target_id, or to another process if none */
+            CONTROL_REPLY, /* Send message to a client as a control reply
+                            * record (see ControlMessage.h) */
+            STREAM, /* Send a piece of an info frame to the clients of
+                     * client_mask (see SerialInterface.h) */
+        };
+        Job(Type job_type, int job_fd, int job_client_id);
+        Job(const LowLevelMessage &msg, uint32_t mask);
+        Job(const std::shared_ptr<const LowLevelMessage> &msg, uint32_t mask);
+        Job(const LowLevelInfoFragment &fragment, uint32_t mask);
+
+        Type type;
+        int fd;
+        int client_id;
+        uint32_t client_mask;
+        uint8_t options;
+        int target_id;
+        WebSocketState websocket; /* ATTACH */
+        std::unique_ptr<ClientSnapshot> snapshot; /* ATTACH, optional */
+        LowLevelMessage message;
+        std::shared_ptr<const LowLevelMessage> frame; /* SEND, the same
+                                                       * for every worker */
+
+        /* STREAM */
+        uint8_t command;
+        bool first;
+        bool last;
+        std::vector<uint8_t> fragment;
+    };
+
+    /* Worker -> router */
+    struct Event {
+        enum Type {
+            MESSAGE,        /* Complete message received from a client */
+            CLIENT_CLOSED,  /* Client disconnected, its slot can be reused */
+            DETACHED,       /* Reply to DETACH, fd is -1 if the client closed
+                             * in the meantime */
+        };
+        Event(Type event_type, int event_client_id);
+        Event(const LowLevelMessage &msg);
+
+        Type type;
+        int client_id;
+        int fd;
+        int target_id;
+        WebSocketState websocket;
+        std::unique_ptr<ClientSnapshot> snapshot; /* DETACHED */
+        LowLevelMessage message;
+    };
+
+    SocketWorker();
+    ~SocketWorker();
+
+    /* delivery_latency, if not null, receives the time from the serial
+     * reception of each frame sent to the time it is handed to the kernel */
+    int start(unsigned int index, const RealtimeSettings &settings,
+            LatencyHistogram *delivery_latency);
+    void stop();
+
+    /* Called from the router thread only */
+    bool post(Job &&job);
+    void wake();
+    Event *frontEvent();
+    void popEvent();
+
+private:
+    void run();
+    void handleJob(Job &job);
+    void readClient(int client_id);
+    void parseFrames(int client_id, const uint8_t *data, size_t size,
+            uint64_t timestamp_ns);
+    void readWebSocket(int client_id, const uint8_t *data, size_t size,
+            uint64_t timestamp_ns);
+    void queueFrame(int client_id, const uint8_t *frame, size_t size,
+            const uint8_t *prefix = nullptr, size_t prefix_size = 0);
+    void queueRecord(int client_id, const uint8_t *record, size_t size,
+            const uint8_t *prefix = nullptr, size_t prefix_size = 0);
+    void closeBatch(int client_id);
+    bool appendOutput(int client_id, std::vector<uint8_t> &output,
+            const uint8_t *frame, size_t size,
+            const uint8_t *prefix = nullptr, size_t prefix_size = 0);
+    void streamFragment(int client_id, const Job &job);
+    void endStream(int client_id, bool truncate);
+    void queueWebSocketControl(int client_id, WebSocketOpcode opcode,
+            const uint8_t *payload, size_t size);
+    void flushClient(int client_id);
+    void updateEvents(int client_id);
+    void resumeReading();
+    void closeClient(int client_id);
+    void resetClient(int client_id);
+    void pushEvent(Event &&event);
+
+    struct Client {
+        Client();
+        int fd;
+        bool dirty;
+        bool want_write;
+        bool paused;    /* Not read until the router drains the events */
+        bool registered; /* In the epoll interest list */
+        uint8_t options;
+        TelemetryEncoder encoder;
+        LowLevelMessage message;
+        std::vector<uint8_t> output;
+        WebSocketState websocket;
+        std::vector<uint8_t> input; /* Incomplete WebSocket frame */
+        std::vector<uint8_t> batch; /* Records of the open batch */
+        uint8_t batch_skip; /* Batch header bytes left to skip in the input */
+
+        /* Info frame being streamed: the other frames are held meanwhile */
+        bool streaming;
+        std::vector<uint8_t> held;
+    };
+
+    unsigned int m_index;
+    RealtimeSettings m_settings;
+    LatencyHistogram *m_delivery_latency;
+    std::vector<uint64_t> m_sent_timestamps;
+    int m_epoll_fd;
+    int m_wake_fd;
+    std::atomic<bool> m_running;
+    bool m_wake_pending; /* Router thread only */
+    std::thread m_thread;
+    SpscQueue<Job> m_jobs;
+    SpscQueue<Event> m_events;
+
+    /* Indexed by client id, only the clients owned by this worker are used */
+    Client m_clients[SOCK_INTERFACE_MAX_CLIENTS];
+    std::vector<int> m_dirty_clients;
+    uint32_t m_paused_clients;
+    uint8_t m_buffer[SOCK_INTERFACE_BUFFER_SIZE];
+
+    /* Frames are built after room for a WebSocket header */
+    uint8_t m_send_buffer[WEBSOCKET_MAX_HEADER_SIZE +
+            SOCK_INTERFACE_BUFFER_SIZE];
+    uint8_t m_encode_buffer[SOCK_INTERFACE_BUFFER_SIZE];
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+/* Bounded lock-free queue for exactly one producer thread and one consumer
+ * thread. The capacity is rounded up to a power of two. */
+template<typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) :
+            m_mask(roundCapacity(capacity) - 1),
+            m_slots(static_cast<Slot *>(::operator new(
+                    sizeof(Slot) * (m_mask + 1))))
+    {
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~SpscQueue()
+    {
+        while (front() != nullptr) {
+            pop();
+        }
+        ::operator delete(m_slots);
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /* Producer side. Returns false if the queue is full. */
+    template<typename... Args>
+    bool emplace(Args &&... args)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+            return false;
+        }
+        new (&m_slots[tail & m_mask]) T(std::forward<Args>(args)...);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool push(const T &item)
+    {
+        return emplace(item);
+    }
+
+    /* Consumer side. Returns nullptr if the queue is empty. */
+    T *front()
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return reinterpret_cast<T *>(&m_slots[head & m_mask]);
+    }
+
+    /* Consumer side. Must only be called after front() returned an item. */
+    void pop()
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        reinterpret_cast<T *>(&m_slots[head & m_mask])->~T();
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) -
+                m_head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct Slot {
+        alignas(T) unsigned char data[sizeof(T)];
+    };
+
+    static size_t roundCapacity(size_t capacity)
+    {
+        size_t ret = 1;
+        while (ret < capacity) {
+            ret <<= 1;
+        }
+        return ret;
+    }
+
+    const size_t m_mask;
+    Slot *m_slots;
+
+    /* Consumer and producer indexes live on separate cache lines */
+    char m_pad_head[64];
+    std::atomic<size_t> m_head;
+    char m_pad_tail[64];
+    std::atomic<size_t> m_tail;
+};
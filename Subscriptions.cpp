@@ -0,0 +1,146 @@
+#include "Subscriptions.h"
+
+#include "Probes.h"
+
+Subscriptions::Subscriptions()
+{
+    reset();
+}
+
+Subscriptions::~Subscriptions() = default;
+
+void Subscriptions::reset()
+{
+    for (uint32_t &subscription : m_subscribed) {
+        subscription = DEFAULT_SUBSCRIPTION;
+    }
+    for (uint32_t &filtered : m_filtered) {
+        filtered = 0;
+    }
+}
+
+void Subscriptions::resetClient(int client_id)
+{
+    m_subscribed[client_id] = DEFAULT_SUBSCRIPTION;
+    for (uint32_t &filtered : m_filtered) {
+        filtered &= ~(1u << client_id);
+    }
+}
+
+Subscriptions::ClientState Subscriptions::save(int client_id) const
+{
+    ClientState state = {};
+    state.subscribed = m_subscribed[client_id];
+    for (unsigned int c = 0; c < DATA_CHANNEL_COUNT; c++) {
+        if (m_filtered[c] & (1u << client_id)) {
+            state.filtered |= 1u << c;
+            state.filters[c] = m_filters[c][client_id];
+        }
+    }
+    return state;
+}
+
+void Subscriptions::restore(int client_id, const ClientState &state)
+{
+    m_subscribed[client_id] = state.subscribed;
+    for (unsigned int c = 0; c < DATA_CHANNEL_COUNT; c++) {
+        if (state.filtered & (1u << c)) {
+            m_filtered[c] |= 1u << client_id;
+            m_filters[c][client_id] = state.filters[c];
+        } else {
+            m_filtered[c] &= ~(1u << client_id);
+        }
+    }
+}
+
+uint32_t Subscriptions::subscribed(int client_id) const
+{
+    return m_subscribed[client_id];
+}
+
+void Subscriptions::subscribe(int client_id, unsigned int channel)
+{
+    LL_PROBE(subscription, client_id, channel, 1);
+    m_subscribed[client_id] |= (1u << channel);
+    m_filtered[channel] &= ~(1u << client_id);
+}
+
+void Subscriptions::unsubscribe(int client_id, unsigned int channel)
+{
+    LL_PROBE(subscription, client_id, channel, 0);
+    m_subscribed[client_id] &= ~(1u << channel);
+    m_filtered[channel] &= ~(1u << client_id);
+}
+
+void Subscriptions::subscribeDecimated(int client_id, unsigned int channel,
+        uint16_t decimation)
+{
+    subscribe(client_id, channel);
+    if (decimation <= 1) {
+        return;
+    }
+
+    Filter &filter = m_filters[channel][client_id];
+    filter.decimation = decimation;
+    filter.counter = 0;
+    filter.min_interval_us = 0;
+    filter.last_sent_us = 0;
+    m_filtered[channel] |= (1u << client_id);
+}
+
+void Subscriptions::subscribeRate(int client_id, unsigned int channel,
+        uint16_t max_rate)
+{
+    subscribe(client_id, channel);
+    if (max_rate == 0) {
+        return;
+    }
+
+    Filter &filter = m_filters[channel][client_id];
+    filter.decimation = 0;
+    filter.counter = 0;
+    filter.min_interval_us = 1000000 / max_rate;
+    filter.last_sent_us = 0;
+    m_filtered[channel] |= (1u << client_id);
+}
+
+uint32_t Subscriptions::recipients(unsigned int channel, uint64_t now_us)
+{
+    uint32_t client_mask = 0;
+    for (int i = 0; i < SOCK_INTERFACE_MAX_CLIENTS; i++) {
+        if (m_subscribed[i] & (1u << channel)) {
+            client_mask |= 1u << i;
+        }
+    }
+
+    /* Only the filtered subscriptions need more than a bit test */
+    uint32_t filtered = client_mask & m_filtered[channel];
+    while (filtered != 0) {
+        int i = __builtin_ctz(filtered);
+        filtered &= filtered - 1;
+        if (!accept(m_filters[channel][i], now_us)) {
+            client_mask &= ~(1u << i);
+        }
+    }
+
+    return client_mask;
+}
+
+bool Subscriptions::accept(Filter &filter, uint64_t now_us)
+{
+    if (filter.decimation > 1) {
+        bool ret = (filter.counter == 0);
+        filter.counter++;
+        if (filter.counter >= filter.decimation) {
+            filter.counter = 0;
+        }
+        return ret;
+    }
+
+    if (filter.last_sent_us != 0 &&
+            now_us - filter.last_sent_us < filter.min_interval_us) {
+        return false;
+    }
+    filter.last_sent_us = now_us;
+    return true;
+}
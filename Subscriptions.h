@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "LowLevelMessage.h"
+#include "SocketLimits.h"
+
+#define DEFAULT_SUBSCRIPTION 0x06
+
+/* Data-channel subscriptions of every client. A subscription may carry a
+ * decimation factor or a maximum rate, in which case only part of the
+ * samples of the channel are forwarded to the client. */
+class Subscriptions
+{
+public:
+    struct Filter {
+        uint16_t decimation;
+        uint16_t counter;
+        uint64_t min_interval_us;
+        uint64_t last_sent_us;
+    };
+
+    /* Subscriptions of one client, saved while it is disconnected */
+    struct ClientState {
+        uint32_t subscribed;
+        uint32_t filtered;  /* Bit c set if the channel c has a filter */
+        Filter filters[DATA_CHANNEL_COUNT];
+    };
+
+    Subscriptions();
+    ~Subscriptions();
+
+    /* Restore the default subscriptions of every client */
+    void reset();
+
+    /* Restore the default subscriptions of one client */
+    void resetClient(int client_id);
+
+    ClientState save(int client_id) const;
+    void restore(int client_id, const ClientState &state);
+    uint32_t subscribed(int client_id) const;
+
+    void subscribe(int client_id, unsigned int channel);
+    void unsubscribe(int client_id, unsigned int channel);
+    void subscribeDecimated(int client_id, unsigned int channel,
+            uint16_t decimation);
+    void subscribeRate(int client_id, unsigned int channel, uint16_t max_rate);
+
+    /* Mask of the clients which must receive the sample of the channel
+     * received at now_us (microseconds, monotonic clock) */
+    uint32_t recipients(unsigned int channel, uint64_t now_us);
+
+private:
+    bool accept(Filter &filter, uint64_t now_us);
+
+    /* Bit c of m_subscribed[i] is set if client i subscribed to channel c */
+    uint32_t m_subscribed[SOCK_INTERFACE_MAX_CLIENTS];
+
+    /* Bit i of m_filtered[c] is set if client i has a filter on channel c */
+    uint32_t m_filtered[DATA_CHANNEL_COUNT];
+    Filter m_filters[DATA_CHANNEL_COUNT][SOCK_INTERFACE_MAX_CLIENTS];
+};
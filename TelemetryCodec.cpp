@@ -0,0 +1,179 @@
+#include "TelemetryCodec.h"
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#define MAX_FRAME_LENGTH 0xFE
+
+static inline uint32_t read_word(const uint8_t *payload, size_t size,
+        size_t offset)
+{
+    uint32_t word = 0;
+    for (size_t i = 0; i < 4 && offset + i < size; i++) {
+        word |= (uint32_t)payload[offset + i] << (8 * i);
+    }
+    return word;
+}
+
+static inline void write_word(uint8_t *payload, size_t size, size_t offset,
+        uint32_t word)
+{
+    for (size_t i = 0; i < 4 && offset + i < size; i++) {
+        payload[offset + i] = (uint8_t)(word >> (8 * i));
+    }
+}
+
+TelemetryEncoder::TelemetryEncoder()
+{
+    m_resync = UINT32_MAX;
+}
+
+TelemetryEncoder::~TelemetryEncoder() = default;
+
+void TelemetryEncoder::reset()
+{
+    for (std::vector<uint8_t> &previous : m_previous) {
+        previous.clear();
+    }
+    m_resync = UINT32_MAX;
+}
+
+void TelemetryEncoder::resync()
+{
+    m_resync = UINT32_MAX;
+}
+
+const std::vector<uint8_t> &TelemetryEncoder::previous(
+        unsigned int channel) const
+{
+    channel %= DATA_CHANNEL_COUNT;
+    if (m_resync & (1u << channel)) {
+        return m_none;
+    }
+    return m_previous[channel];
+}
+
+void TelemetryEncoder::setPrevious(unsigned int channel,
+        std::vector<uint8_t> payload)
+{
+    channel %= DATA_CHANNEL_COUNT;
+    m_previous[channel] = std::move(payload);
+    m_resync &= ~(1u << channel);
+}
+
+ssize_t TelemetryEncoder::encode(const LowLevelMessage &message, uint8_t *buf,
+        size_t size)
+{
+    if (buf == nullptr) {
+        return -EFAULT;
+    }
+    if (!message.is_data_channel_msg() || message.is_info_frame()) {
+        return 0;
+    }
+
+    unsigned int channel = message.get_data_channel();
+    std::vector<uint8_t> &previous = m_previous[channel];
+    const uint8_t *payload = message.get_payload();
+    size_t payload_size = message.get_payload_size();
+    if (m_resync & (1u << channel)) {
+        m_resync &= ~(1u << channel);
+        previous.assign(payload, payload + payload_size);
+        return 0;
+    }
+    bool same_size = (previous.size() == payload_size);
+
+    /* Header, command, length, original length, then the varints */
+    size_t max_size = size < MAX_FRAME_LENGTH + 3 ? size : MAX_FRAME_LENGTH + 3;
+    size_t n = 4;
+    bool fits = (n <= max_size);
+    for (size_t offset = 0; fits && offset < payload_size; offset += 4) {
+        uint32_t word = read_word(payload, payload_size, offset);
+        if (same_size) {
+            word ^= read_word(previous.data(), payload_size, offset);
+        }
+        do {
+            if (n >= max_size) {
+                fits = false;
+                break;
+            }
+            buf[n++] = (uint8_t)((word & 0x7F) | (word > 0x7F ? 0x80 : 0));
+            word >>= 7;
+        } while (word != 0);
+    }
+
+    previous.assign(payload, payload + payload_size);
+    if (!fits || n >= payload_size + 3) {
+        return 0;
+    }
+
+    buf[0] = LL_COMPRESSED_HEADER_BYTE;
+    buf[1] = message.get_command();
+    buf[2] = (uint8_t)(n - 3);
+    buf[3] = (uint8_t)payload_size;
+    return n;
+}
+
+TelemetryDecoder::TelemetryDecoder() = default;
+
+TelemetryDecoder::~TelemetryDecoder() = default;
+
+void TelemetryDecoder::reset()
+{
+    for (std::vector<uint8_t> &previous : m_previous) {
+        previous.clear();
+    }
+}
+
+int TelemetryDecoder::decode(uint8_t command, const uint8_t *body, size_t size,
+        LowLevelMessage &message)
+{
+    if (body == nullptr) {
+        return -EFAULT;
+    }
+    if (command >= DATA_CHANNEL_COUNT || size < 1) {
+        return -EBADMSG;
+    }
+
+    std::vector<uint8_t> &previous = m_previous[command];
+    size_t payload_size = body[0];
+    bool same_size = (previous.size() == payload_size);
+    m_payload.assign(payload_size, 0);
+
+    size_t n = 1;
+    for (size_t offset = 0; offset < payload_size; offset += 4) {
+        uint32_t word = 0;
+        unsigned int shift = 0;
+        while (true) {
+            if (n >= size || shift > 28) {
+                return -EBADMSG;
+            }
+            uint8_t byte = body[n++];
+            word |= (uint32_t)(byte & 0x7F) << shift;
+            shift += 7;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        if (same_size) {
+            word ^= read_word(previous.data(), payload_size, offset);
+        }
+        write_word(m_payload.data(), payload_size, offset, word);
+    }
+    if (n != size) {
+        return -EBADMSG;
+    }
+
+    previous = m_payload;
+    return message.set_frame(command, m_payload.data(), payload_size);
+}
+
+void TelemetryDecoder::update(const LowLevelMessage &message)
+{
+    if (!message.is_data_channel_msg() || message.is_info_frame()) {
+        return;
+    }
+    const uint8_t *payload = message.get_payload();
+    m_previous[message.get_data_channel()].assign(payload,
+            payload + message.get_payload_size());
+}
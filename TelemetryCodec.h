@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+#include "LowLevelMessage.h"
+
+/* Header byte of a compressed data-channel frame:
+ *   0xFC | command | length | original payload length | words...
+ * The original payload is cut in 32-bit little-endian words (the last one
+ * being zero-padded), each word is XORed with the same word of the previous
+ * payload of the channel, and the result is written as a varint. The
+ * previous payload is taken as zeros when its length differs.
+ * Info frames and frames which do not get smaller are sent with the regular
+ * framing, which also updates the previous payload of standard frames. So
+ * is the first frame of each channel, and the next one after a frame of the
+ * client may have been lost, to resynchronize the decoder. */
+#define LL_COMPRESSED_HEADER_BYTE 0xFC
+
+class TelemetryEncoder
+{
+public:
+    TelemetryEncoder();
+    ~TelemetryEncoder();
+
+    void reset();
+
+    /* A frame encoded since the last regular frame of each channel may not
+     * reach the client: send the next frame of each channel with the
+     * regular framing */
+    void resync();
+
+    /* Write the compressed frame of a data-channel message in buf. Returns
+     * its size, 0 if the message must be sent with the regular framing, or
+     * a negative error code */
+    ssize_t encode(const LowLevelMessage &message, uint8_t *buf, size_t size);
+
+    /* Reference payload of a channel, to carry the state of the encoder
+     * over to another process. Empty while the channel is resynchronized */
+    const std::vector<uint8_t> &previous(unsigned int channel) const;
+    void setPrevious(unsigned int channel, std::vector<uint8_t> payload);
+
+private:
+    std::vector<uint8_t> m_previous[DATA_CHANNEL_COUNT];
+    uint32_t m_resync; /* Channels whose next frame is not compressed */
+    std::vector<uint8_t> m_none;
+};
+
+class TelemetryDecoder
+{
+public:
+    TelemetryDecoder();
+    ~TelemetryDecoder();
+
+    void reset();
+
+    /* Rebuild a message from the body (everything after the length byte) of
+     * a compressed frame. Returns 0 or a negative error code */
+    int decode(uint8_t command, const uint8_t *body, size_t size,
+            LowLevelMessage &message);
+
+    /* Must be called for every regular data-channel frame received */
+    void update(const LowLevelMessage &message);
+
+private:
+    std::vector<uint8_t> m_previous[DATA_CHANNEL_COUNT];
+    std::vector<uint8_t> m_payload;
+};
@@ -0,0 +1,260 @@
+#include "TelemetryExporter.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "Capture.h"
+
+TelemetryExporter::TelemetryExporter()
+{
+    m_offset = 0;
+    m_skipped = 0;
+}
+
+TelemetryExporter::~TelemetryExporter()
+{
+    close();
+}
+
+int TelemetryExporter::configure(const Config &config)
+{
+    for (const std::string &entry : config.getAll("channel_schema")) {
+        std::istringstream stream(entry);
+        unsigned int channel;
+        std::string fields;
+        if (!(stream >> channel) || !std::getline(stream, fields) ||
+                addSchema(channel, fields) < 0) {
+            printf("Invalid channel_schema entry: '%s'\n", entry.c_str());
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+int TelemetryExporter::addSchema(unsigned int channel,
+        const std::string &fields)
+{
+    if (channel >= DATA_CHANNEL_COUNT || m_file.isOpen()) {
+        return -EINVAL;
+    }
+
+    Channel parsed;
+    std::istringstream stream(fields);
+    std::string field;
+    while (stream >> field) {
+        size_t separator = field.find(':');
+        if (separator == std::string::npos || separator == 0) {
+            return -EINVAL;
+        }
+        Field f;
+        if (value_type_parse(field.substr(separator + 1), f.type) < 0) {
+            return -EINVAL;
+        }
+        f.name = field.substr(0, separator);
+        f.offset = parsed.row_size;
+        if (f.name.size() > UINT8_MAX) {
+            return -EINVAL;
+        }
+        parsed.row_size += value_type_size(f.type);
+        parsed.fields.push_back(f);
+    }
+    if (parsed.fields.empty() || parsed.fields.size() >= UINT8_MAX) {
+        return -EINVAL;
+    }
+
+    parsed.columns.resize(parsed.fields.size());
+    m_channels[channel] = parsed;
+    return 0;
+}
+
+bool TelemetryExporter::hasSchema() const
+{
+    for (const Channel &channel : m_channels) {
+        if (!channel.fields.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int TelemetryExporter::open(const char *path, uint64_t start_wall_clock_us,
+        uint64_t start_monotonic_us)
+{
+    int ret = m_file.open(path);
+    if (ret < 0) {
+        printf("Failed to create export file '%s': %d (%s)\n", path, ret,
+                strerror(-ret));
+        return ret;
+    }
+    m_offset = 0;
+    m_skipped = 0;
+    m_index.clear();
+
+    uint8_t header[24];
+    memcpy(header, "LLCOL1\0\0", 8);
+    capture_write_u64(header + 8, start_wall_clock_us);
+    capture_write_u64(header + 16, start_monotonic_us);
+    return writeBytes(header, sizeof(header));
+}
+
+int TelemetryExporter::close()
+{
+    if (!m_file.isOpen()) {
+        return 0;
+    }
+
+    int ret = 0;
+    for (unsigned int i = 0; i < DATA_CHANNEL_COUNT && ret == 0; i++) {
+        ret = flushChunk(i);
+    }
+
+    uint64_t index_offset = m_offset;
+    uint8_t buf[32];
+    memcpy(buf, "INDX", 4);
+    buf[4] = (uint8_t)m_index.size();
+    buf[5] = (uint8_t)(m_index.size() >> 8);
+    buf[6] = (uint8_t)(m_index.size() >> 16);
+    buf[7] = (uint8_t)(m_index.size() >> 24);
+    if (ret == 0) {
+        ret = writeBytes(buf, 8);
+    }
+    for (const ChunkIndex &chunk : m_index) {
+        if (ret < 0) {
+            break;
+        }
+        memset(buf, 0, sizeof(buf));
+        capture_write_u64(buf, chunk.offset);
+        buf[8] = chunk.channel;
+        buf[12] = (uint8_t)chunk.rows;
+        buf[13] = (uint8_t)(chunk.rows >> 8);
+        buf[14] = (uint8_t)(chunk.rows >> 16);
+        buf[15] = (uint8_t)(chunk.rows >> 24);
+        capture_write_u64(buf + 16, chunk.first_timestamp);
+        capture_write_u64(buf + 24, chunk.last_timestamp);
+        ret = writeBytes(buf, 32);
+    }
+    if (ret == 0) {
+        capture_write_u64(buf, index_offset);
+        memcpy(buf + 8, "LLCOLEND", 8);
+        ret = writeBytes(buf, 16);
+    }
+
+    int close_ret = m_file.close();
+    return ret < 0 ? ret : close_ret;
+}
+
+bool TelemetryExporter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+void TelemetryExporter::write(const LowLevelMessage &message,
+        uint64_t timestamp_us)
+{
+    if (!m_file.isOpen() || !message.is_data_channel_msg()) {
+        return;
+    }
+
+    unsigned int channel_id = message.get_data_channel();
+    Channel &channel = m_channels[channel_id];
+    if (channel.fields.empty()) {
+        return;
+    }
+    if (message.get_payload_size() != channel.row_size) {
+        m_skipped++;
+        return;
+    }
+
+    /* Scatter the row into the columns */
+    const uint8_t *payload = message.get_payload();
+    channel.timestamps.push_back(timestamp_us);
+    for (size_t i = 0; i < channel.fields.size(); i++) {
+        const Field &field = channel.fields[i];
+        channel.columns[i].insert(channel.columns[i].end(),
+                payload + field.offset,
+                payload + field.offset + value_type_size(field.type));
+    }
+
+    if (channel.timestamps.size() >= EXPORT_CHUNK_ROWS) {
+        if (flushChunk(channel_id) < 0) {
+            printf("Failed to write export file, export stopped\n");
+            m_file.close();
+        }
+    }
+}
+
+size_t TelemetryExporter::skipped() const
+{
+    return m_skipped;
+}
+
+int TelemetryExporter::flushChunk(unsigned int channel_id)
+{
+    Channel &channel = m_channels[channel_id];
+    size_t rows = channel.timestamps.size();
+    if (rows == 0) {
+        return 0;
+    }
+
+    ChunkIndex chunk;
+    chunk.offset = m_offset;
+    chunk.channel = channel_id;
+    chunk.rows = rows;
+    chunk.first_timestamp = channel.timestamps.front();
+    chunk.last_timestamp = channel.timestamps.back();
+    m_index.push_back(chunk);
+
+    uint8_t header[12] = {'C', 'H', 'N', 'K', (uint8_t)channel_id,
+            (uint8_t)(channel.fields.size() + 1), 0, 0,
+            (uint8_t)rows, (uint8_t)(rows >> 8), (uint8_t)(rows >> 16),
+            (uint8_t)(rows >> 24)};
+    int ret = writeBytes(header, sizeof(header));
+
+    /* Timestamp column, then one column per field */
+    std::vector<uint8_t> timestamps(rows * 8);
+    for (size_t i = 0; i < rows; i++) {
+        capture_write_u64(&timestamps[i * 8], channel.timestamps[i]);
+    }
+    for (size_t i = 0; i <= channel.fields.size() && ret == 0; i++) {
+        const std::string &name = i == 0 ? std::string("timestamp_us") :
+                channel.fields[i - 1].name;
+        const std::vector<uint8_t> &data = i == 0 ? timestamps :
+                channel.columns[i - 1];
+        uint8_t type = i == 0 ? (uint8_t)VALUE_U64 :
+                (uint8_t)channel.fields[i - 1].type;
+        uint8_t column_header[2] = {type, (uint8_t)name.size()};
+        uint8_t size[4] = {(uint8_t)data.size(), (uint8_t)(data.size() >> 8),
+                (uint8_t)(data.size() >> 16), (uint8_t)(data.size() >> 24)};
+        ret = writeBytes(column_header, sizeof(column_header));
+        if (ret == 0) {
+            ret = writeBytes(name.data(), name.size());
+        }
+        if (ret == 0) {
+            ret = writeBytes(size, sizeof(size));
+        }
+        if (ret == 0) {
+            ret = writeBytes(data.data(), data.size());
+        }
+    }
+
+    channel.timestamps.clear();
+    for (std::vector<uint8_t> &column : channel.columns) {
+        column.clear();
+    }
+    return ret;
+}
+
+int TelemetryExporter::writeBytes(const void *data, size_t size)
+{
+    if (size > 0 && m_file.write(data, size) < 0) {
+        return -EIO;
+    }
+    m_offset += size;
+    return 0;
+}
+
+TelemetryExporter::Channel::Channel()
+{
+    row_size = 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Config.h"
+#include "FileWriter.h"
+#include "LowLevelMessage.h"
+#include "ValueType.h"
+
+#define EXPORT_CHUNK_ROWS 16384
+
+/* Columnar export of data-channel samples, decoded with a per-channel field
+ * schema. File layout (little-endian):
+ *   header: "LLCOL1\0\0", u64 wall-clock time of the start (us since epoch),
+ *           u64 monotonic time of the start (us)
+ *   chunks: "CHNK", u8 channel, u8 column count, u16 zero, u32 row count,
+ *           then for each column: u8 type, u8 name length, name,
+ *           u32 data size, values. The first column is "timestamp_us" (u64,
+ *           monotonic).
+ *   index:  "INDX", u32 chunk count, then per chunk: u64 file offset,
+ *           u8 channel, 3 zero bytes, u32 row count, u64 first timestamp,
+ *           u64 last timestamp
+ *   footer: u64 index offset, "LLCOLEND" */
+class TelemetryExporter
+{
+public:
+    TelemetryExporter();
+    ~TelemetryExporter();
+
+    /* Key: channel_schema = <channel> <name>:<type> [<name>:<type>...]
+     * with type in u8, i8, u16, i16, u32, i32, u64, i64, f32, f64 */
+    int configure(const Config &config);
+    int addSchema(unsigned int channel, const std::string &fields);
+    bool hasSchema() const;
+
+    int open(const char *path, uint64_t start_wall_clock_us,
+            uint64_t start_monotonic_us);
+    int close();
+    bool isOpen() const;
+
+    /* Samples without schema are ignored, samples whose size does not match
+     * their schema are counted as skipped */
+    void write(const LowLevelMessage &message, uint64_t timestamp_us);
+    size_t skipped() const;
+
+private:
+    struct Field {
+        std::string name;
+        ValueType type;
+        size_t offset;
+    };
+
+    struct Channel {
+        Channel();
+        std::vector<Field> fields;
+        size_t row_size;
+        std::vector<uint64_t> timestamps;
+        std::vector<std::vector<uint8_t>> columns;
+    };
+
+    struct ChunkIndex {
+        uint64_t offset;
+        uint8_t channel;
+        uint32_t rows;
+        uint64_t first_timestamp;
+        uint64_t last_timestamp;
+    };
+
+    int flushChunk(unsigned int channel);
+    int writeBytes(const void *data, size_t size);
+
+    FileWriter m_file;
+    uint64_t m_offset;
+    size_t m_skipped;
+    Channel m_channels[DATA_CHANNEL_COUNT];
+    std::vector<ChunkIndex> m_index;
+};
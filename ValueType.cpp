@@ -0,0 +1,59 @@
+#include "ValueType.h"
+
+#include <cerrno>
+#include <cstring>
+
+static const char *TYPE_NAMES[] = {
+    "u8", "i8", "u16", "i16", "u32", "i32", "u64", "i64", "f32", "f64",
+};
+#define TYPE_COUNT (sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]))
+
+int value_type_parse(const std::string &name, ValueType &type)
+{
+    for (size_t i = 0; i < TYPE_COUNT; i++) {
+        if (name == TYPE_NAMES[i]) {
+            type = (ValueType)i;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+size_t value_type_size(ValueType type)
+{
+    switch (type) {
+        case VALUE_U8: case VALUE_I8: return 1;
+        case VALUE_U16: case VALUE_I16: return 2;
+        case VALUE_U32: case VALUE_I32: case VALUE_F32: return 4;
+        default: return 8;
+    }
+}
+
+double value_type_read(ValueType type, const uint8_t *data)
+{
+    uint64_t raw = 0;
+    for (size_t i = 0; i < value_type_size(type); i++) {
+        raw |= (uint64_t)data[i] << (8 * i);
+    }
+    switch (type) {
+        case VALUE_U8: return (uint8_t)raw;
+        case VALUE_I8: return (int8_t)raw;
+        case VALUE_U16: return (uint16_t)raw;
+        case VALUE_I16: return (int16_t)raw;
+        case VALUE_U32: return (uint32_t)raw;
+        case VALUE_I32: return (int32_t)raw;
+        case VALUE_U64: return (double)raw;
+        case VALUE_I64: return (double)(int64_t)raw;
+        case VALUE_F32: {
+            uint32_t bits = (uint32_t)raw;
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        default: {
+            double value;
+            memcpy(&value, &raw, sizeof(value));
+            return value;
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* Type of the little-endian values packed in data-channel samples, named
+ * u8, i8, u16, i16, u32, i32, u64, i64, f32, f64 in the config file. The
+ * codes are those of the export file columns (see TelemetryExporter.h). */
+enum ValueType {
+    VALUE_U8 = 0, VALUE_I8, VALUE_U16, VALUE_I16, VALUE_U32, VALUE_I32,
+    VALUE_U64, VALUE_I64, VALUE_F32, VALUE_F64,
+};
+
+/* Returns -EINVAL if name is not a type name */
+int value_type_parse(const std::string &name, ValueType &type);
+size_t value_type_size(ValueType type);
+double value_type_read(ValueType type, const uint8_t *data);
@@ -0,0 +1,288 @@
+#include "VirtualChannels.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "Log.h"
+#include "ValueType.h"
+
+#define VIRTUAL_MAX_PAYLOAD_SIZE 254
+#define AGGREGATE_VALUE_SIZE 12 /* f32 min, max, mean */
+
+static void write_f32(uint8_t *buf, double value)
+{
+    float f = (float)value;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (uint8_t)(bits >> (8 * i));
+    }
+}
+
+VirtualChannels::VirtualChannels()
+{
+    memset(m_consumers, 0, sizeof(m_consumers));
+    m_frame_count = 0;
+}
+
+VirtualChannels::~VirtualChannels() = default;
+
+int VirtualChannels::configure(const Config &config)
+{
+    for (const std::string &entry : config.getAll("virtual_channel")) {
+        if (parse(entry) < 0) {
+            printf("Invalid virtual_channel entry: '%s'\n", entry.c_str());
+            return -EINVAL;
+        }
+    }
+
+    /* Virtual channels are computed from raw channels only */
+    for (unsigned int channel = 0; channel < DATA_CHANNEL_COUNT; channel++) {
+        for (uint8_t source : m_channels[channel].sources) {
+            if (m_channels[source].kind != NONE) {
+                printf("virtual_channel %u: source channel %u is virtual\n",
+                        channel, source);
+                return -EINVAL;
+            }
+            m_consumers[source] |= 1u << channel;
+        }
+    }
+    return 0;
+}
+
+int VirtualChannels::parse(const std::string &entry)
+{
+    std::istringstream stream(entry);
+    unsigned int channel;
+    std::string kind;
+    if (!(stream >> channel >> kind) || channel >= DATA_CHANNEL_COUNT ||
+            m_channels[channel].kind != NONE) {
+        return -EINVAL;
+    }
+
+    Channel parsed;
+    unsigned int source;
+    if (kind == "aggregate") {
+        std::string type;
+        long window;
+        if (!(stream >> source >> type >> window) || window <= 0) {
+            return -EINVAL;
+        }
+        if (value_type_parse(type, parsed.type) < 0) {
+            return -EINVAL;
+        }
+        parsed.kind = AGGREGATE;
+        parsed.window = window;
+        parsed.sources.push_back(source);
+    } else if (kind == "merge" || kind == "pack") {
+        long decimation = 1;
+        if (kind == "merge" && (!(stream >> decimation) || decimation <= 0)) {
+            return -EINVAL;
+        }
+        parsed.kind = kind == "merge" ? MERGE : PACK;
+        parsed.decimation = decimation;
+        while (stream >> source) {
+            parsed.sources.push_back(source);
+        }
+    } else {
+        return -EINVAL;
+    }
+    if (!stream.eof() || parsed.sources.empty()) {
+        return -EINVAL;
+    }
+
+    uint32_t sources = 0;
+    for (uint8_t s : parsed.sources) {
+        if (s >= DATA_CHANNEL_COUNT || s == channel || (sources & (1u << s))) {
+            return -EINVAL;
+        }
+        sources |= 1u << s;
+    }
+    m_channels[channel] = parsed;
+    return 0;
+}
+
+bool VirtualChannels::isVirtual(unsigned int channel) const
+{
+    return channel < DATA_CHANNEL_COUNT && m_channels[channel].kind != NONE;
+}
+
+size_t VirtualChannels::process(const LowLevelMessage &msg)
+{
+    m_frame_count = 0;
+    uint32_t consumers = m_consumers[msg.get_data_channel()];
+    if (consumers == 0 || msg.is_info_frame()) {
+        return 0;
+    }
+
+    while (consumers != 0) {
+        unsigned int channel = __builtin_ctz(consumers);
+        consumers &= consumers - 1;
+        switch (m_channels[channel].kind) {
+            case AGGREGATE:
+                aggregate(channel, msg);
+                break;
+            case MERGE:
+                merge(channel, msg);
+                break;
+            case PACK:
+                pack(channel, msg);
+                break;
+            default:
+                break;
+        }
+    }
+    return m_frame_count;
+}
+
+const LowLevelMessage &VirtualChannels::frame(size_t index) const
+{
+    return m_frames[index];
+}
+
+void VirtualChannels::reset()
+{
+    for (Channel &channel : m_channels) {
+        channel.count = 0;
+        channel.min.clear();
+        channel.max.clear();
+        channel.sum.clear();
+        memset(channel.skipped, 0, sizeof(channel.skipped));
+        channel.seen = 0;
+        for (std::vector<uint8_t> &latest : channel.latest) {
+            latest.clear();
+        }
+    }
+    m_frame_count = 0;
+}
+
+void VirtualChannels::aggregate(unsigned int channel,
+        const LowLevelMessage &msg)
+{
+    Channel &c = m_channels[channel];
+    size_t type_size = value_type_size(c.type);
+    size_t size = msg.get_payload_size();
+    size_t values = size / type_size;
+    if (values == 0 || size % type_size != 0 ||
+            values * AGGREGATE_VALUE_SIZE > VIRTUAL_MAX_PAYLOAD_SIZE) {
+        LL_LOG("virtual_channel %u: sample of %lu bytes ignored\n", channel,
+                size);
+        return;
+    }
+
+    /* A new window starts when the sample layout changes */
+    if (c.count == 0 || values != c.sum.size()) {
+        c.count = 0;
+        c.min.assign(values, INFINITY);
+        c.max.assign(values, -INFINITY);
+        c.sum.assign(values, 0.0);
+    }
+    const uint8_t *payload = msg.get_payload();
+    for (size_t i = 0; i < values; i++) {
+        double value = value_type_read(c.type, payload + i * type_size);
+        c.min[i] = value < c.min[i] ? value : c.min[i];
+        c.max[i] = value > c.max[i] ? value : c.max[i];
+        c.sum[i] += value;
+    }
+    if (++c.count < c.window) {
+        return;
+    }
+
+    uint8_t frame[VIRTUAL_MAX_PAYLOAD_SIZE];
+    for (size_t i = 0; i < values; i++) {
+        uint8_t *triplet = frame + i * AGGREGATE_VALUE_SIZE;
+        write_f32(triplet, c.min[i]);
+        write_f32(triplet + 4, c.max[i]);
+        write_f32(triplet + 8, c.sum[i] / c.count);
+    }
+    emit(channel, frame, values * AGGREGATE_VALUE_SIZE, msg.get_timestamp());
+    c.count = 0;
+}
+
+void VirtualChannels::merge(unsigned int channel, const LowLevelMessage &msg)
+{
+    Channel &c = m_channels[channel];
+    unsigned int source = msg.get_data_channel();
+    if (c.skipped[source] > 0) {
+        c.skipped[source]--;
+        return;
+    }
+    c.skipped[source] = c.decimation - 1;
+
+    size_t size = msg.get_payload_size();
+    if (size + 1 > VIRTUAL_MAX_PAYLOAD_SIZE) {
+        LL_LOG("virtual_channel %u: sample of %lu bytes ignored\n", channel,
+                size);
+        return;
+    }
+    uint8_t frame[VIRTUAL_MAX_PAYLOAD_SIZE];
+    frame[0] = (uint8_t)source;
+    memcpy(frame + 1, msg.get_payload(), size);
+    emit(channel, frame, size + 1, msg.get_timestamp());
+}
+
+void VirtualChannels::pack(unsigned int channel, const LowLevelMessage &msg)
+{
+    Channel &c = m_channels[channel];
+    unsigned int source = msg.get_data_channel();
+    c.latest[source].assign(msg.get_payload(),
+            msg.get_payload() + msg.get_payload_size());
+    c.seen |= 1u << source;
+    if (source != c.sources[0]) {
+        return;
+    }
+
+    uint8_t frame[VIRTUAL_MAX_PAYLOAD_SIZE];
+    size_t size = 0;
+    for (uint8_t s : c.sources) {
+        const std::vector<uint8_t> &latest = c.latest[s];
+        if (!(c.seen & (1u << s))) {
+            return;
+        }
+        if (size + 1 + latest.size() > VIRTUAL_MAX_PAYLOAD_SIZE) {
+            LL_LOG("virtual_channel %u: packed samples too large\n",
+                    channel);
+            return;
+        }
+        frame[size++] = (uint8_t)latest.size();
+        if (!latest.empty()) {
+            memcpy(frame + size, latest.data(), latest.size());
+            size += latest.size();
+        }
+    }
+    emit(channel, frame, size, msg.get_timestamp());
+}
+
+/* Same as a frame read from serial, broadcast on the channel */
+void VirtualChannels::emit(unsigned int channel, const uint8_t *payload,
+        size_t size, uint64_t timestamp_ns)
+{
+    if (m_frame_count == m_frames.size()) {
+        m_frames.emplace_back(LL_MSG_SIDE_SERIAL);
+    }
+    LowLevelMessage &frame = m_frames[m_frame_count];
+    uint8_t header[4] = {0xFF, 0xFE, (uint8_t)channel, (uint8_t)size};
+    int err;
+    frame.reset();
+    frame.append_bytes(header, sizeof(header), err);
+    frame.append_bytes(payload, size, err);
+    if (!frame.ready()) {
+        return;
+    }
+    frame.set_timestamp(timestamp_ns);
+    m_frame_count++;
+}
+
+VirtualChannels::Channel::Channel()
+{
+    kind = NONE;
+    type = VALUE_U8;
+    window = 0;
+    count = 0;
+    decimation = 1;
+    memset(skipped, 0, sizeof(skipped));
+    seen = 0;
+}
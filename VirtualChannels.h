@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Config.h"
+#include "LowLevelMessage.h"
+#include "ValueType.h"
+
+/* Data channels computed by the router from the samples of other channels,
+ * subscribed to as any other channel. Each one uses a data-channel ID the
+ * board does not send on. Kinds:
+ *   aggregate  min, max and mean of each value of a source channel over a
+ *              window of samples: one frame of f32 triplets per window
+ *   merge      1 sample out of N of several channels, each one prefixed by
+ *              its channel ID (u8)
+ *   pack       the latest sample of several channels, each one prefixed by
+ *              its size (u8), sent on each sample of the first one once
+ *              every channel has sent one
+ * Sources are raw channels, info frames are ignored. */
+class VirtualChannels
+{
+public:
+    VirtualChannels();
+    ~VirtualChannels();
+
+    /* Keys:
+     *   virtual_channel = <channel> aggregate <source> <type> <window>
+     *   virtual_channel = <channel> merge <decimation> <source>...
+     *   virtual_channel = <channel> pack <source>...
+     * with type in u8, i8, u16, i16, u32, i32, u64, i64, f32, f64, the
+     * type of the values of the source samples */
+    int configure(const Config &config);
+
+    bool isVirtual(unsigned int channel) const;
+
+    /* Feed a sample of a raw channel. Returns the number of virtual frames
+     * computed from it, given by frame() until the next call */
+    size_t process(const LowLevelMessage &msg);
+    const LowLevelMessage &frame(size_t index) const;
+
+    /* Restart the windows, e.g. after the serial link was reopened */
+    void reset();
+
+private:
+    enum Kind {
+        NONE, AGGREGATE, MERGE, PACK,
+    };
+
+    struct Channel {
+        Channel();
+        Kind kind;
+        std::vector<uint8_t> sources;
+
+        /* Aggregate */
+        ValueType type;
+        size_t window;
+        size_t count;
+        std::vector<double> min;
+        std::vector<double> max;
+        std::vector<double> sum;
+
+        /* Merge */
+        unsigned int decimation;
+        unsigned int skipped[DATA_CHANNEL_COUNT];
+
+        /* Pack, latest sample by source */
+        uint32_t seen;
+        std::vector<uint8_t> latest[DATA_CHANNEL_COUNT];
+    };
+
+    int parse(const std::string &entry);
+    void aggregate(unsigned int channel, const LowLevelMessage &msg);
+    void merge(unsigned int channel, const LowLevelMessage &msg);
+    void pack(unsigned int channel, const LowLevelMessage &msg);
+    void emit(unsigned int channel, const uint8_t *payload, size_t size,
+            uint64_t timestamp_ns);
+
+    Channel m_channels[DATA_CHANNEL_COUNT];
+    uint32_t m_consumers[DATA_CHANNEL_COUNT]; /* Fed by each raw channel */
+    std::vector<LowLevelMessage> m_frames;
+    size_t m_frame_count;
+};
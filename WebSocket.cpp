@@ -0,0 +1,235 @@
+#include "WebSocket.h"
+
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static uint32_t rotl(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+/* Only used for Sec-WebSocket-Accept, hence no streaming interface */
+static void sha1(const uint8_t *data, size_t size, uint8_t digest[20])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+            0xC3D2E1F0};
+
+    std::string message((const char *)data, size);
+    message.push_back((char)0x80);
+    while (message.size() % 64 != 56) {
+        message.push_back(0);
+    }
+    uint64_t bit_size = (uint64_t)size * 8;
+    for (int i = 7; i >= 0; i--) {
+        message.push_back((char)(bit_size >> (8 * i)));
+    }
+
+    for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+        const uint8_t *p = (const uint8_t *)message.data() + chunk;
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+                    (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for (int i = 0; i < 5; i++) {
+        digest[4 * i] = (uint8_t)(h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)h[i];
+    }
+}
+
+static std::string base64(const uint8_t *data, size_t size)
+{
+    static const char alphabet[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string ret;
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t n = (uint32_t)data[i] << 16;
+        if (i + 1 < size) {
+            n |= (uint32_t)data[i + 1] << 8;
+        }
+        if (i + 2 < size) {
+            n |= data[i + 2];
+        }
+        ret.push_back(alphabet[(n >> 18) & 0x3F]);
+        ret.push_back(alphabet[(n >> 12) & 0x3F]);
+        ret.push_back(i + 1 < size ? alphabet[(n >> 6) & 0x3F] : '=');
+        ret.push_back(i + 2 < size ? alphabet[n & 0x3F] : '=');
+    }
+    return ret;
+}
+
+/* Value of an HTTP header (case-insensitive name), trimmed */
+static bool find_header(const std::string &request, const char *name,
+        std::string &value)
+{
+    size_t name_size = strlen(name);
+    size_t line = request.find("\r\n");
+    while (line != std::string::npos && line + 2 < request.size()) {
+        size_t start = line + 2;
+        line = request.find("\r\n", start);
+        if (line == std::string::npos) {
+            break;
+        }
+        if (line - start > name_size && request[start + name_size] == ':' &&
+                strncasecmp(request.c_str() + start, name, name_size) == 0) {
+            size_t first = request.find_first_not_of(" \t",
+                    start + name_size + 1);
+            size_t last = request.find_last_not_of(" \t", line - 1);
+            if (first == std::string::npos || first > last) {
+                value.clear();
+            } else {
+                value = request.substr(first, last - first + 1);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool contains_token(const std::string &value, const char *token)
+{
+    size_t token_size = strlen(token);
+    for (size_t i = 0; i + token_size <= value.size(); i++) {
+        if (strncasecmp(value.c_str() + i, token, token_size) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int websocket_handshake(const std::string &request, std::string &response)
+{
+    std::string upgrade, connection, key;
+    if (request.compare(0, 4, "GET ") != 0 ||
+            !find_header(request, "Upgrade", upgrade) ||
+            !contains_token(upgrade, "websocket") ||
+            !find_header(request, "Connection", connection) ||
+            !contains_token(connection, "upgrade") ||
+            !find_header(request, "Sec-WebSocket-Key", key) || key.empty()) {
+        response = "HTTP/1.1 400 Bad Request\r\n"
+                   "Connection: close\r\n\r\n";
+        return -EINVAL;
+    }
+
+    key += WEBSOCKET_GUID;
+    uint8_t digest[20];
+    sha1((const uint8_t *)key.data(), key.size(), digest);
+
+    response = "HTTP/1.1 101 Switching Protocols\r\n"
+               "Upgrade: websocket\r\n"
+               "Connection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: " + base64(digest, sizeof(digest)) +
+               "\r\n\r\n";
+    return 0;
+}
+
+size_t websocket_frame_header(uint8_t *buf, WebSocketOpcode opcode,
+        size_t payload_size, bool fin)
+{
+    buf[0] = (fin ? 0x80 : 0x00) | opcode;
+    if (payload_size < 126) {
+        buf[1] = (uint8_t)payload_size;
+        return 2;
+    } else if (payload_size <= UINT16_MAX) {
+        buf[1] = 126;
+        buf[2] = (uint8_t)(payload_size >> 8);
+        buf[3] = (uint8_t)payload_size;
+        return 4;
+    } else {
+        buf[1] = 127;
+        for (int i = 0; i < 8; i++) {
+            buf[2 + i] = (uint8_t)((uint64_t)payload_size >> (8 * (7 - i)));
+        }
+        return 10;
+    }
+}
+
+ssize_t websocket_parse_frame(uint8_t *data, size_t size,
+        WebSocketFrame &frame)
+{
+    if (size < 2) {
+        return 0;
+    }
+
+    /* Client frames are always masked */
+    if (!(data[1] & 0x80)) {
+        return -EPROTO;
+    }
+
+    size_t header_size = 2;
+    uint64_t payload_size = data[1] & 0x7F;
+    if (payload_size == 126) {
+        header_size = 4;
+        if (size < header_size) {
+            return 0;
+        }
+        payload_size = (uint64_t)data[2] << 8 | data[3];
+    } else if (payload_size == 127) {
+        header_size = 10;
+        if (size < header_size) {
+            return 0;
+        }
+        payload_size = 0;
+        for (int i = 0; i < 8; i++) {
+            payload_size = payload_size << 8 | data[2 + i];
+        }
+    }
+    if (payload_size > WEBSOCKET_MAX_PAYLOAD_SIZE ||
+            ((data[0] & 0x08) && payload_size > 125)) {
+        return -EPROTO;
+    }
+
+    const uint8_t *mask = data + header_size;
+    header_size += 4;
+    if (size < header_size + payload_size) {
+        return 0;
+    }
+
+    frame.fin = data[0] & 0x80;
+    frame.opcode = data[0] & 0x0F;
+    frame.payload = data + header_size;
+    frame.payload_size = payload_size;
+    for (size_t i = 0; i < payload_size; i++) {
+        frame.payload[i] ^= mask[i & 3];
+    }
+    return header_size + payload_size;
+}
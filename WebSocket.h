@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+/* Minimal server side of RFC 6455, carrying LowLevel frames (without client
+ * ID) as binary messages */
+#define WEBSOCKET_MAX_HANDSHAKE_SIZE 4096
+#define WEBSOCKET_MAX_HEADER_SIZE 10
+#define WEBSOCKET_MAX_PAYLOAD_SIZE 65536
+
+enum WebSocketOpcode {
+    WS_OPCODE_CONTINUATION = 0x0,
+    WS_OPCODE_TEXT = 0x1,
+    WS_OPCODE_BINARY = 0x2,
+    WS_OPCODE_CLOSE = 0x8,
+    WS_OPCODE_PING = 0x9,
+    WS_OPCODE_PONG = 0xA,
+};
+
+struct WebSocketFrame {
+    bool fin;
+    uint8_t opcode;
+    uint8_t *payload;
+    size_t payload_size;
+};
+
+/* Build the reply to the HTTP upgrade request held by request, which must
+ * end with an empty line. Returns 0, or -EINVAL if the request is not a
+ * valid WebSocket upgrade (response then holds a 400 reply). */
+int websocket_handshake(const std::string &request, std::string &response);
+
+/* Write the header of an unmasked server frame carrying payload_size bytes,
+ * the last one of its message unless fin is false. Returns the header size
+ * (at most WEBSOCKET_MAX_HEADER_SIZE). */
+size_t websocket_frame_header(uint8_t *buf, WebSocketOpcode opcode,
+        size_t payload_size, bool fin = true);
+
+/* Parse the client frame starting at data and unmask its payload in place.
+ * Returns the size of the whole frame, 0 if the frame is incomplete, or
+ * -EPROTO for an unmasked or oversized frame. */
+ssize_t websocket_parse_frame(uint8_t *data, size_t size,
+        WebSocketFrame &frame);
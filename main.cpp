@@ -3,7 +3,11 @@
 #include <cstdlib>
 #include <unistd.h>
 #include <cstring>
+#include <memory>
 
+#include "Config.h"
+#include "Handover.h"
+#include "Log.h"
 #include "MessageRouter.h"
 #include "Pause.h"
 
@@ -33,11 +37,17 @@ int main(int argc, char *argv[])
     uint16_t pause_tcp_port = DEFAULT_PAUSE_TCP_PORT;
     uint8_t pause_token = DEFAULT_PAUSE_TOKEN;
     const char *log_folder = DEFAULT_LOG_FOLDER;
+    unsigned int socket_workers = SOCK_INTERFACE_DEFAULT_WORKERS;
+    const char *config_file = nullptr;
+    const char *handover_path = nullptr;
 
     /* Read settings from arguments if provided */
     int opt;
-    while ((opt = getopt(argc, argv, "s:p:b:q:t:l:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:s:p:b:q:t:l:w:u:")) != -1) {
         switch (opt) {
+            case 'c':
+                config_file = optarg;
+                break;
             case 's':
                 serial_port = optarg;
                 break;
@@ -77,10 +87,25 @@ int main(int argc, char *argv[])
             case 'l':
                 log_folder = optarg;
                 break;
+            case 'w': {
+                unsigned long w = strtoul(optarg, nullptr, 10);
+                if (w > 0 && w <= SOCK_INTERFACE_MAX_CLIENTS) {
+                    socket_workers = w;
+                } else {
+                    printf("Invalid socket worker count provided\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'u':
+                handover_path = optarg;
+                break;
             default: /* '?' */
                 printf("Usage: %s [-c config file] [-s serial port] "
                        "[-b pause ip address] [-q pause tcp port] "
-                       "[-t pause token] [-l log folder]\n", argv[0]);
+                       "[-t pause token] [-l log folder] "
+                       "[-w socket worker threads] "
+                       "[-u handover socket path]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -89,6 +114,38 @@ int main(int argc, char *argv[])
     MessageRouter message_router;
     message_router.setSerialPort(serial_port);
     message_router.setSocketPort(tcp_port);
+    message_router.setSocketWorkerCount(socket_workers);
+    message_router.setLogFolder(log_folder);
+    if (config_file != nullptr) {
+        Config config;
+        ret = config.load(config_file);
+        if (ret == 0) {
+            ret = message_router.configure(config);
+        }
+        if (ret < 0) {
+            printf("Invalid config file '%s'\n", config_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Take the ports over from the instance being upgraded, if any. It
+     * exits once they are acknowledged, releasing the pause socket */
+    Handover handover;
+    if (handover_path != nullptr) {
+        std::unique_ptr<HandoverState> state(new HandoverState());
+        ret = handover.receive(handover_path, *state);
+        if (ret < 0) {
+            exit(-ret);
+        } else if (ret > 0) {
+            printf("Took over %lu clients from the running instance\n",
+                    state->clients.size());
+            message_router.setHandoverState(std::move(state));
+        }
+        ret = handover.listen(handover_path);
+        if (ret < 0) {
+            exit(-ret);
+        }
+    }
 
     /* Instantiate and open the pause socket */
     Pause pause;
@@ -101,9 +158,19 @@ int main(int argc, char *argv[])
     }
 
     printf("LowLevelServer started with log folder '%s'\n", log_folder);
+    fflush(stdout);
+
+    /* Diagnostics from the routing loop are printed by a background thread */
+    ret = log_start();
+    if (ret < 0) {
+        printf("Failed to start logging thread: %d (%s)\n", ret,
+                strerror(-ret));
+        exit(-ret);
+    }
 
     signal(SIGINT, ctrl_c);
-    while (!ctrl_c_pressed) {
+    bool handed_over = false;
+    while (!ctrl_c_pressed && !handed_over) {
 
         while (!message_router.isOpen() && !ctrl_c_pressed) {
             printf("Open message router with port %u and serial %s\n",
@@ -124,6 +191,26 @@ int main(int argc, char *argv[])
                 break;
             }
 
+            if (handover.requested()) {
+                printf("Hand over to the new instance\n");
+                std::unique_ptr<HandoverState> state(new HandoverState());
+                ret = message_router.handOver(*state);
+                if (ret == 0) {
+                    ret = handover.send(*state);
+                }
+                if (ret == 0) {
+                    handed_over = true;
+                    break;
+                }
+                /* Resume from the state which could not be sent */
+                handover.close();
+                handover.listen(handover_path);
+                if (!state->clients.empty() || state->listen_fd >= 0) {
+                    message_router.setHandoverState(std::move(state));
+                }
+                break;
+            }
+
             if (pause.pauseRequested()) {
                 printf("Close message router (pause requested)\n");
                 message_router.close();
@@ -131,11 +218,18 @@ int main(int argc, char *argv[])
                 break;
             }
 
-            usleep(1000); // avoid using too much CPU time
+            if (!message_router.busyPoll()) {
+                usleep(1000); // avoid using too much CPU time
+            }
         }
     }
 
     message_router.close();
+    log_stop();
+
+    /* The new instance waits for the ports to be released */
+    pause.close();
+    handover.close();
     printf("LowLevelServer terminated\n");
 
     return 0;